@@ -2,6 +2,7 @@
 #define NGP_CONFIG_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include "tree.h"
 
 struct config {
@@ -14,6 +15,23 @@ struct config {
     struct tree *file_extensions_tree;
     uint8_t only_user_extensions:1;
 
+    /* long lines are truncated to a window around the match */
+    uint32_t window_size;
+    uint8_t full_lines:1;
+
+    /* lines of context around matches */
+    uint32_t context_before;
+    uint32_t context_after;
+
+    /* results are written to stdout instead of the TUI (enum stream_format) */
+    uint8_t stream_format;
+
+    /* saved result set browsed instead of searching */
+    char *load_path;
+
+    /* memory budget of the results before they're spilled to disk */
+    size_t max_memory;
+
     /* exclusions */
     struct tree *dir_exclusion_tree;
 
@@ -22,9 +40,37 @@ struct config {
     uint8_t regex_search:1;
     uint8_t raw_search:1;
     uint8_t follow_symlinks:1;
+    uint8_t word_search:1;
+
+    /* trigram index of the directory */
+    uint8_t build_index:1;
+    uint8_t no_index:1;
+
+    /* daemon keeping the files of the directory known for searches */
+    uint8_t serve:1;
+    uint8_t no_server:1;
+
+    /* results kept up to date with the changes of the files while browsing */
+    uint8_t watch:1;
+
+    /* files of the directory listed from a snapshot taken by the previous run */
+    uint8_t snapshot:1;
+
+    /* .gitignore and .ignore files of the directories aren't followed */
+    uint8_t no_ignore:1;
+
+    /* files tracked by git listed from the index of the checkout */
+    uint8_t git:1;
+
+    /* list of the files to search instead of crawling the directory, "-" for stdin */
+    char *files_from;
 };
 
 
+/* API ************************************************************************/
+void config_add_default_exclusions(struct tree *dir_exclusion_tree);
+uint64_t config_hash_filters(const struct config *this);
+
 /* CONTRUCTOR *****************************************************************/
 struct config * config_new(int argc, char *argv[]);
 void config_delete(struct config *this);
@@ -6,7 +6,7 @@
 struct display;
 
 /* API ************************************************************************/
-void display_loop(struct display *this, const struct search *search);
+void display_loop(struct display *this, struct search *search);
 
 /* CONSTRUCTOR ****************************************************************/
 struct display * display_new(struct display *parent, char *pattern);
@@ -2,46 +2,134 @@
 #define NGP_ENTRIES_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include <pthread.h>
 
 
+#define MAX_SPANS   1024
+#define NO_FILE     UINT32_MAX
+
+
+struct span {
+    uint32_t start;         /* position of the match in the entry data */
+    uint32_t length;
+};
+
 struct entry {
     uint32_t line;          /* line = 0 is a file */
     char *data;             /* data to hold : file name or line contents */
+    uint32_t length;        /* length of the whole line, data may only be a window of it,
+                               or number of lines of a file */
+    uint32_t offset;        /* offset of data in the whole line */
+    uint16_t nb_spans;      /* number of matches, stored right before data */
     uint8_t visited;        /* if the entry was opened by the user during the session */
+    uint8_t context;        /* line around a match, not a match itself */
+};
+
+struct context_line {
+    const char *data;
+    uint32_t size;          /* size kept of the line */
+    uint32_t length;        /* length of the whole line */
+};
+
+struct block {
+    char *data;             /* strings of entries, allocated contiguously */
+    size_t size;            /* size of the mapping */
+    size_t used;
+    uint8_t spilled;        /* if the block is backed by the temporary file */
 };
 
+struct segment {
+    struct entry *entries;  /* fixed size table, never moves once allocated */
+    struct block *blocks;
+    uint32_t nb_blocks;
+    uint8_t entries_spilled;    /* if the table is backed by the temporary file */
+};
+
+/**
+ * Entries either store the results of the main search or are a view selecting
+ * some of the entries of such a root store, one bit per root entry.
+ */
 struct entries {
-    struct entry *entries;
+    struct segment *segments;
+    uint32_t nb_segments;
+    uint32_t first_in_memory;   /* oldest segment not spilled to disk */
     uint32_t nb_entries;    /* number of entries filled */
-    uint32_t nb_lines;      /* number of lines in the entries (rest are files) */
-    uint32_t size;          /* actual number of entries to hold */
+    uint32_t nb_lines;      /* number of matching lines in the entries */
+    uint32_t nb_files;      /* number of files in a store (rest are context lines) */
+    uint32_t end;           /* root entries up to which the entries are final */
+    uint32_t last_file;     /* index of the last file added */
+    pthread_cond_t updated; /* signaled with entries_mutex when entries are added */
+
+    /* stores loaded from a saved result set */
+    void *mapping;
+    size_t mapping_size;
+
+    /* views */
+    struct entries *root;
+    uint64_t *bits;         /* selected root entries */
+    uint32_t *ranks;        /* number of selected entries before each block of bits */
+    uint32_t nb_rank_blocks;
+    uint32_t nb_removals;   /* times entries were removed, moving the next ones up */
 };
 
 
-pthread_mutex_t entries_mutex;  /* mutex on entries because they are realloced */
+extern pthread_mutex_t entries_mutex;  /* mutex on entries because they are realloced */
 
 
 /* GET ************************************************************************/
 uint8_t entries_is_file(const struct entries *this, const uint32_t index);
 char * entries_find_file(const struct entries *this, const uint32_t index);
+uint32_t entries_find_file_index(const struct entries *this, const uint32_t index);
 uint32_t entries_get_line(const struct entries *this, const uint32_t index);
 char * entries_get_data(const struct entries *this, const uint32_t index);
 uint32_t entries_get_nb_lines(const struct entries *this);
+uint32_t entries_get_nb_files(const struct entries *this);
 uint32_t entries_get_nb_entries(const struct entries *this);
+uint32_t entries_get_nb_removals(const struct entries *this);
 struct entry * entries_get_entry(const struct entries *this, const uint32_t index);
 void entries_set_visited(const struct entries *this, const uint32_t index);
 uint8_t entries_get_visited(const struct entries *this, const uint32_t index);
 void entries_toggle_visited(const struct entries *this, const uint32_t index);
+struct span * entry_get_spans(const struct entry *this);
+uint32_t entries_get_run(const struct entries *this, const uint32_t index,
+                         const uint32_t nb, struct entry **run);
+uint32_t entries_copy(const struct entries *this, const uint32_t index,
+                      const uint32_t nb, struct entry *copy);
+
+/* SPILL TO DISK **************************************************************/
+void entries_set_max_memory(const size_t max_memory);
+
+/* EVENTS *********************************************************************/
+void entries_notify(struct entries *this);
+void entries_set_event_fd(const int fd);
 
 /* ADD ************************************************************************/
 void entries_add(struct entries *this, const uint32_t line, const char *data);
-void entries_copy(struct entries *this, struct entry *copy);
+void entries_add_window(struct entries *this, const uint32_t line,
+                        const char *data, const uint32_t size,
+                        const uint32_t length, const uint32_t offset,
+                        const struct span *spans, const uint16_t nb_spans);
+void entries_add_context(struct entries *this, const uint32_t first_line,
+                         const struct context_line *lines, const uint32_t nb_lines);
+
+/* VIEWS **********************************************************************/
+uint32_t entries_next(const struct entries *this, const uint32_t index,
+                      const uint32_t end);
+void entries_reserve(struct entries *this, const uint32_t end);
+void entries_select(struct entries *this, const uint32_t index);
+void entries_publish(struct entries *this, const uint32_t end,
+                     const uint32_t nb_lines, const uint32_t file_index);
+void entries_follow(struct entries *this);
+void entries_unselect(struct entries *this, const uint32_t start, uint32_t stop,
+                      const uint8_t count_context);
 
 /* CONSTRUCTOR ****************************************************************/
 struct entries * entries_new(void);
-void entries_delete_copy(struct entries *this);
+struct entries * entries_new_view(struct entries *parent);
+struct entries * entries_new_mapped(struct entry *table, const uint32_t nb_entries,
+                                    void *mapping, const size_t mapping_size);
 void entries_delete(struct entries *this);
 
 #endif /* NGP_ENTRIES_H */
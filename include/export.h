@@ -0,0 +1,32 @@
+#ifndef NGP_EXPORT_H
+#define NGP_EXPORT_H
+
+#include <stdint.h>
+
+#include "entries.h"
+#include "search.h"
+#include "config.h"
+
+
+enum export_format {
+    export_format_text,     // one entry data per line
+    export_format_binary,   // entry table and strings, mapped back by --load
+};
+
+struct export;
+
+/* API ************************************************************************/
+uint8_t export_get_status(const struct export *this);
+uint8_t export_get_failed(const struct export *this);
+uint32_t export_get_progress(const struct export *this);
+const char * export_get_path(const struct export *this);
+struct entries * export_get_entries(const struct export *this);
+void export_stop(struct export *this);
+struct entries * export_load(const char *path, struct config *config);
+
+/* CONSTRUCTOR ****************************************************************/
+struct export * export_new(struct entries *entries, const struct search *search,
+                           const enum export_format format);
+void export_delete(struct export *this);
+
+#endif /* NGP_EXPORT_H */
@@ -0,0 +1,45 @@
+#ifndef NGP_FILE_LIST_H
+#define NGP_FILE_LIST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "config.h"
+
+
+enum file_list_flags {
+    file_list_symlink = 1 << 0,     // reached through a symlink
+};
+
+/**
+ * Paths of the files to search under a root, relative to it, in the order
+ * the directories are crawled.
+ */
+struct file_list {
+    char *paths;            // nul terminated paths
+    size_t size;
+    size_t capacity;
+    size_t *offsets;
+    uint8_t *flags;
+    uint32_t nb_files;
+    uint32_t max_files;
+
+    /* directories crawled, the root first as "" */
+    struct file_list *directories;
+};
+
+
+/* API ************************************************************************/
+void file_list_add(struct file_list *this, const char *path, const size_t length,
+                   const uint8_t flags);
+const char * file_list_get_path(const struct file_list *this, const uint32_t index);
+uint8_t file_list_get_flags(const struct file_list *this, const uint32_t index);
+uint32_t file_list_get_nb_files(const struct file_list *this);
+uint8_t file_list_crawl(struct file_list *this, const char *root,
+                        const struct config *config);
+
+/* CONSTRUCTOR ****************************************************************/
+struct file_list * file_list_new(void);
+void file_list_delete(struct file_list *this);
+
+#endif /* NGP_FILE_LIST_H */
@@ -1,9 +1,17 @@
 #ifndef NGP_FILE_UTILS_H
 #define NGP_FILE_UTILS_H
 
+#include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include "tree.h"
 
+
+#define ROUND_UP(size, align)   (((size) + (align) - 1) & ~((size_t) (align) - 1))
+
+/* FNV-1a offset basis, hashes start from it */
+#define FILE_UTILS_HASH_SEED    0xcbf29ce484222325ULL
+
 /* UTILS **********************************************************************/
 uint8_t file_utils_exists(const char *path);
 uint8_t file_utils_is_file(const char *path);
@@ -11,5 +19,15 @@ uint8_t file_utils_is_dir(const char *path);
 uint8_t file_utils_is_symlink(const char *path);
 
 uint8_t file_utils_check_extension(const char *file_name, const struct tree *file_extensions_tree);
+uint8_t file_utils_cache_path(const char *real_root, const char *extension,
+                              char *path, const size_t size, const uint8_t create);
+
+uint64_t file_utils_hash(uint64_t hash, const void *data, const size_t size);
+uint64_t file_utils_hash_value(const uint64_t hash, const uint64_t value);
+
+FILE * file_utils_create_temporary(const char *path, char *tmp_path, const size_t size);
+uint8_t file_utils_write_padding(FILE *output, const size_t size);
+uint8_t file_utils_commit_temporary(FILE *output, const char *tmp_path, const char *path,
+                                    uint8_t status);
 
 #endif /* NGP_FILE_UTILS_H */
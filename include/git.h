@@ -0,0 +1,10 @@
+#ifndef NGP_GIT_H
+#define NGP_GIT_H
+
+#include "file_list.h"
+
+
+/* API ************************************************************************/
+struct file_list * git_list(const char *directory);
+
+#endif /* NGP_GIT_H */
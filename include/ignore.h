@@ -0,0 +1,20 @@
+#ifndef NGP_IGNORE_H
+#define NGP_IGNORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+struct ignore;
+
+/* API ************************************************************************/
+uint8_t ignore_is_file(const char *name);
+uint8_t ignore_match(const struct ignore *this, const char *path, const size_t length,
+                     const uint8_t directory);
+
+/* CONSTRUCTOR ****************************************************************/
+struct ignore * ignore_new(const struct ignore *parent, const char *directory,
+                           const size_t length);
+void ignore_delete(struct ignore *this);
+
+#endif /* NGP_IGNORE_H */
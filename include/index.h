@@ -0,0 +1,42 @@
+#ifndef NGP_INDEX_H
+#define NGP_INDEX_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+
+/* symbols are the longest runs of these, as whole word searches see them */
+#define WORD_CHAR(c)    (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || \
+                         ((c) >= '0' && (c) <= '9') || (c) == '_')
+
+
+struct index;
+
+/**
+ * Line of a file of the index a symbol appears on.
+ */
+struct index_line {
+    uint32_t file;
+    uint32_t line;
+    uint64_t offset;            // of the start of the line in the file
+};
+
+/* API ************************************************************************/
+uint8_t index_build(const char *root, const struct config *config);
+uint32_t index_get_nb_files(const struct index *this);
+const char * index_get_path(const struct index *this, const uint32_t file);
+uint8_t index_get_flags(const struct index *this, const uint32_t file);
+uint32_t index_find_file(const struct index *this, const char *path);
+uint8_t index_is_current(const struct index *this, const uint32_t file, const struct stat *sb);
+uint32_t index_find_symbol(const struct index *this, const char *name,
+                           struct index_line **lines);
+uint32_t index_query(const struct index *this, const char *pattern,
+                     const uint8_t regex, uint32_t **files);
+
+/* CONSTRUCTOR ****************************************************************/
+struct index * index_new(const char *root, const uint64_t filters);
+void index_delete(struct index *this);
+
+#endif /* NGP_INDEX_H */
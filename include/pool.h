@@ -0,0 +1,20 @@
+#ifndef NGP_POOL_H
+#define NGP_POOL_H
+
+#include <stdint.h>
+
+#include <pthread.h>
+
+
+struct pool;
+
+/* API ************************************************************************/
+void pool_submit(struct pool *this,
+                 void (*job)(void *context, const uint32_t index),
+                 void *context, const uint32_t nb_jobs);
+
+/* CONSTRUCTOR ****************************************************************/
+struct pool * pool_new(uint32_t nb_threads);
+void pool_delete(struct pool *this);
+
+#endif /* NGP_POOL_H */
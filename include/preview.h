@@ -0,0 +1,19 @@
+#ifndef NGP_PREVIEW_H
+#define NGP_PREVIEW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+struct preview;
+
+/* API ************************************************************************/
+const char * preview_get_line(struct preview *this, const char *path,
+                              const uint32_t line, size_t *length);
+void preview_clear(struct preview *this);
+
+/* CONSTRUCTOR ****************************************************************/
+struct preview * preview_new(void);
+void preview_delete(struct preview *this);
+
+#endif /* NGP_PREVIEW_H */
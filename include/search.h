@@ -5,17 +5,27 @@
 
 #include "entries.h"
 #include "config.h"
+#include "file_list.h"
 #include "tree.h"
 
 
 struct search {
-    uint8_t status:1;
-    uint8_t stop:1;
+    /* set and read across threads, kept out of the bitfields below */
+    _Atomic uint8_t status;     // the search is running
+    _Atomic uint8_t stop;       // the search was asked to stop
+
     uint8_t case_insensitive:1;
     uint8_t raw_search:1;
     uint8_t regex_search:1;
     uint8_t follow_symlinks:1;
     uint8_t invert_search:1;    // used by subsearch to exclude patterns
+    uint8_t full_lines:1;
+    uint8_t path_search:1;      // used by subsearch to match file names
+    uint8_t match_context:1;    // used by subsearch to match context lines too
+    uint8_t use_index:1;        // search the files of the trigram index of the directory
+    uint8_t whole_word:1;       // matches can't be part of a longer word
+    uint8_t list_read:1;        // the list of files was read to its end
+    uint8_t ignore_files:1;     // the crawl skips what the ignore files of the directories ignore
 
     /* search parameters */
     char *directory;
@@ -23,23 +33,58 @@ struct search {
     char * (*parser)(const struct search *, const char *, int);
     struct tree *file_extensions_tree;
     struct tree *dir_exclusion_tree;
+    const struct config *config;    // options the files of an index are listed with
     regex_t *regex;
+    uint32_t window_size;       // size of the window kept around matches
+    uint32_t context_before;    // lines of context kept around matches
+    uint32_t context_after;
+    struct context_line *context_ring;  // last lines seen, for the context before matches
+    uint32_t context_ring_size;
+
+    /* files known already, by the server of a root holding the directory */
+    const struct file_list *files;
+    const char *files_prefix;   // path of the directory in the root, "" for the root
+    int server;                 // socket of the server answering the search, -1 if none
+
+    /* files listed in a file or a pipe, searched as they're read instead of
+       crawling the directory */
+    int list;                   // descriptor of the list, -1 if none
+    int list_separator;         // nul or newline, -1 until the first path ends
+    char *list_buffer;          // part of the list read and not searched yet
+    uint32_t list_start;
+    uint32_t list_end;
+
+    /* files found by the crawl of the directory, searched again for new patterns */
+    struct file_list *crawled;
+    pthread_t thread;
+    uint8_t started;            // if the thread was created and not joined yet
 
     /* storage */
     struct entries *entries;
 
+    /* watch mode: the entries of changed files are replaced by new ones */
+    struct entries *watched;        // view of the entries not replaced, shown instead
+    struct file_list *directories;  // directories searched, to be watched
+
     /* subsearch */
     struct search *subsearch;
     struct search *parent;
-    pthread_t subsearch_search_thread;
-    uint32_t parent_previous_nb_entries;
-    uint8_t first_line_of_file;
-    uint32_t previous_file_index;
+    struct entries *refined;    // results of the previous pattern, narrowed by this one
+
+    /* chain of subsearches, owned by the root search */
+    pthread_t chain_thread;
+    pthread_mutex_t chain_mutex;
+    uint8_t chain_changed;
 };
 
 
 /* API ************************************************************************/
+void search_start(struct search *this);
+void search_join(struct search *this);
 void search_stop(struct search *this);
+uint8_t search_restart(struct search *this, const char *pattern,
+                       const uint8_t case_insensitive, const uint8_t regex_search);
+void search_rescan(struct search *this, const char *path);
 
 /* GETTERS ********************************************************************/
 char * search_get_pattern(const struct search *this);
@@ -48,6 +93,7 @@ regex_t * search_get_regex(const struct search *this);
 struct entries * search_get_entries(const struct search *this);
 struct search * search_get_parent(const struct search *this);
 uint8_t search_get_invert(const struct search *this);
+uint8_t search_get_path(const struct search *this);
 uint8_t search_get_sensitive(const struct search *this);
 
 /* SEARCH THREAD ENTRY POINT **************************************************/
@@ -10,6 +10,11 @@ char * search_algorithm_normal_search(const struct search *this,
 char * search_algorithm_insensitive_search(const struct search *this,
                                            const char *line, const int size);
 
+/* WHOLE WORD SEARCH **********************************************************/
+uint8_t search_algorithm_is_word(const char *pattern);
+char * search_algorithm_word_search(const struct search *this,
+                                    const char *line, const int size);
+
 /* BOYER-MOORE-HORSPOOL *******************************************************/
 void search_algorithm_pre_bmh(const char *pattern);
 char * search_algorithm_bmh(const struct search *this,
@@ -17,7 +22,17 @@ char * search_algorithm_bmh(const struct search *this,
 
 /* REGEX SEARCH ***************************************************************/
 regex_t * search_algorithm_compile_regex(const char *pattern);
+regex_t * search_algorithm_compile_word_regex(const char *pattern);
 char * search_algorithm_regex_search(const struct search *this,
                                      const char *line, const int size);
 
+/* PATH SEARCH ****************************************************************/
+char * search_algorithm_glob_search(const struct search *this,
+                                    const char *path, const int size);
+
+/* MATCH SPANS ****************************************************************/
+uint16_t search_algorithm_spans(const struct search *this, const char *line,
+                                const int size, const int flags,
+                                struct span *spans, const uint16_t max_spans);
+
 #endif /* NGP_SEARCH_ALGORITHM_H */
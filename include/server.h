@@ -0,0 +1,17 @@
+#ifndef NGP_SERVER_H
+#define NGP_SERVER_H
+
+#include <stdint.h>
+
+#include "config.h"
+#include "search.h"
+
+
+/* SERVER *********************************************************************/
+uint8_t server_serve(const char *root, const struct config *config);
+
+/* CLIENT *********************************************************************/
+int server_search(const char *directory, int argc, char *argv[]);
+void server_receive(struct search *search);
+
+#endif /* NGP_SERVER_H */
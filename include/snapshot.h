@@ -0,0 +1,11 @@
+#ifndef NGP_SNAPSHOT_H
+#define NGP_SNAPSHOT_H
+
+#include "config.h"
+#include "file_list.h"
+
+
+/* API ************************************************************************/
+struct file_list * snapshot_list(const char *root, const struct config *config);
+
+#endif /* NGP_SNAPSHOT_H */
@@ -0,0 +1,17 @@
+#ifndef NGP_STREAM_H
+#define NGP_STREAM_H
+
+#include "search.h"
+
+
+enum stream_format {
+    stream_format_none,     // results are shown in the TUI
+    stream_format_text,     // grep compatible
+    stream_format_json,     // one JSON object per line
+};
+
+
+/* API ************************************************************************/
+void stream_loop(const struct search *search, const enum stream_format format);
+
+#endif /* NGP_STREAM_H */
@@ -7,16 +7,23 @@
 enum search_type {
     search_type_string,
     search_type_nocase,
-    search_type_regex
+    search_type_regex,
+    search_type_path,       // literal or glob, matched on file names
+    search_type_path_regex
 };
 
 struct subsearch_user_params {
     char pattern[4096];
     uint8_t invert_search;
     uint8_t search_type;
+    uint8_t match_context;  // context lines are matched too
 };
 
 
+/* API ************************************************************************/
+struct search * subsearch_refine(struct search *this,
+                                 const struct subsearch_user_params *user_params);
+
 /* CONSTRUCTOR ****************************************************************/
 struct search * subsearch_new(struct search *parent, const struct subsearch_user_params *user_params);
 void subsearch_delete(struct search *this);
@@ -17,6 +17,7 @@ struct tree
 uint8_t is_string_in_tree(const struct tree *this, const char *string);
 uint8_t is_string_in_tree_size(const struct tree *this, const char *string, const size_t string_len);
 void tree_add_string(struct tree *this, const char *string);
+uint64_t tree_hash(const struct tree *this);
 
 /* CONTRUCTOR *****************************************************************/
 struct tree * tree_new(void);
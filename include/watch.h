@@ -0,0 +1,10 @@
+#ifndef NGP_WATCH_H
+#define NGP_WATCH_H
+
+#include "search.h"
+
+
+/* API ************************************************************************/
+void watch_run(struct search *search);
+
+#endif /* NGP_WATCH_H */
@@ -3,9 +3,51 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
 
 #include "config.h"
+#include "file_utils.h"
 #include "tree.h"
+#include "stream.h"
+
+
+#define DEFAULT_WINDOW_SIZE 512
+#define MAX_WINDOW_SIZE     (1024 * 1024)   // of the part of long lines kept, -L keeps them whole
+#define MAX_CONTEXT_LINES   10000   // lines of context kept around matches, at most
+
+
+enum long_options {
+    opt_max_mem = 256,  // after all short options
+    opt_stream,
+    opt_load,
+    opt_index,
+    opt_no_index,
+    opt_serve,
+    opt_no_server,
+    opt_watch,
+    opt_snapshot,
+    opt_files_from,
+    opt_git,
+    opt_no_ignore,
+};
+
+static struct option long_options[] = {
+    {"max-mem", required_argument, NULL, opt_max_mem},
+    {"stream", optional_argument, NULL, opt_stream},
+    {"load", required_argument, NULL, opt_load},
+    {"index", no_argument, NULL, opt_index},
+    {"no-index", no_argument, NULL, opt_no_index},
+    {"serve", no_argument, NULL, opt_serve},
+    {"no-server", no_argument, NULL, opt_no_server},
+    {"watch", no_argument, NULL, opt_watch},
+    {"snapshot", no_argument, NULL, opt_snapshot},
+    {"files-from", required_argument, NULL, opt_files_from},
+    {"git", no_argument, NULL, opt_git},
+    {"no-ignore", no_argument, NULL, opt_no_ignore},
+    {NULL, 0, NULL, 0}
+};
 
 
 /* UTILS **********************************************************************/
@@ -20,15 +62,72 @@ static char * remove_dot(const char *string)
     return (char *)&string[i];
 }
 
+/**
+ * Parse a size in bytes with an optional K, M or G suffix.
+ * Returns 0 on error.
+ */
+static size_t parse_size(const char *string)
+{
+    char *suffix = NULL;
+    unsigned int shift = 0;
+
+    if (!isdigit((unsigned char) string[0])) {
+        return 0;
+    }
+
+    errno = 0;
+    unsigned long long size = strtoull(string, &suffix, 10);
+    if (errno == ERANGE) {
+        return 0;
+    }
+
+    switch (*suffix) {
+    case 'G':
+    case 'g':
+        shift += 10;
+        /* fall through */
+    case 'M':
+    case 'm':
+        shift += 10;
+        /* fall through */
+    case 'K':
+    case 'k':
+        shift += 10;
+        suffix++;
+        break;
+    default:
+        break;
+    }
+
+    if (*suffix != '\0' || size > SIZE_MAX >> shift) {
+        return 0;
+    }
+
+    return size << shift;
+}
+
+/**
+ * Parse a decimal number, up to max.
+ */
+static uint8_t parse_number(const char *string, const uint32_t max, uint32_t *number)
+{
+    char *end = NULL;
+    unsigned long value = strtoul(string, &end, 10);
+
+    if (!isdigit((unsigned char) string[0]) || *end != '\0' || value > max) {
+        return EXIT_FAILURE;
+    }
+
+    *number = value;
+    return EXIT_SUCCESS;
+}
+
 
 /* PARSING ********************************************************************/
 static uint8_t parse_config(struct config *this)
 {
     /* Directories ignored */
-    tree_add_string(this->dir_exclusion_tree, ".");
-    tree_add_string(this->dir_exclusion_tree, "..");
-    tree_add_string(this->dir_exclusion_tree, ".git");
-    tree_add_string(this->dir_exclusion_tree, ".svn");
+    config_add_default_exclusions(this->dir_exclusion_tree);
 
     /* don't add custom extensions if user requested -o */
     if (this->only_user_extensions) {
@@ -52,8 +151,9 @@ static uint8_t parse_config(struct config *this)
 static uint8_t parse_arguments(struct config *this, int argc, char *argv[])
 {
     int opt;
+    uint8_t window_set = 0;
 
-    while ((opt = getopt(argc, argv, "ierfo:t:x:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "ierfwLo:t:x:W:A:B:C:", long_options, NULL)) != -1) {
         switch (opt) {
         case 'i':
             this->insensitive_search = 1;
@@ -71,6 +171,39 @@ static uint8_t parse_arguments(struct config *this, int argc, char *argv[])
             this->follow_symlinks = 1;
             break;
 
+        case 'w':
+            this->word_search = 1;
+            break;
+
+        case 'L':
+            this->full_lines = 1;
+            break;
+
+        case 'W':
+            if (parse_number(optarg, MAX_WINDOW_SIZE, &this->window_size) == EXIT_FAILURE ||
+                this->window_size == 0) {
+                return EXIT_FAILURE;
+            }
+            window_set = 1;
+            break;
+
+        case 'A':
+        case 'B':
+        case 'C': {
+            uint32_t nb_lines = 0;
+            if (parse_number(optarg, MAX_CONTEXT_LINES, &nb_lines) == EXIT_FAILURE) {
+                return EXIT_FAILURE;
+            }
+
+            if (opt != 'B') {
+                this->context_after = nb_lines;
+            }
+            if (opt != 'A') {
+                this->context_before = nb_lines;
+            }
+            break;
+        }
+
         case 'o':
             this->only_user_extensions = 1;
             tree_add_string(this->file_extensions_tree, remove_dot(optarg));
@@ -84,11 +217,109 @@ static uint8_t parse_arguments(struct config *this, int argc, char *argv[])
             tree_add_string(this->dir_exclusion_tree, optarg);
             break;
 
+        case opt_max_mem:
+            this->max_memory = parse_size(optarg);
+            if (this->max_memory == 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case opt_stream:
+            if (optarg == NULL || strcmp(optarg, "text") == 0) {
+                this->stream_format = stream_format_text;
+            } else if (strcmp(optarg, "json") == 0) {
+                this->stream_format = stream_format_json;
+            } else {
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case opt_load:
+            free(this->load_path);
+            this->load_path = strdup(optarg);
+            break;
+
+        case opt_index:
+            this->build_index = 1;
+            break;
+
+        case opt_no_index:
+            this->no_index = 1;
+            break;
+
+        case opt_serve:
+            this->serve = 1;
+            break;
+
+        case opt_no_server:
+            this->no_server = 1;
+            break;
+
+        case opt_watch:
+            this->watch = 1;
+            break;
+
+        case opt_snapshot:
+            this->snapshot = 1;
+            break;
+
+        case opt_files_from:
+            free(this->files_from);
+            this->files_from = strdup(optarg);
+            break;
+
+        case opt_git:
+            this->git = 1;
+            break;
+
+        case opt_no_ignore:
+            this->no_ignore = 1;
+            break;
+
         default:
             return EXIT_FAILURE;
         }
     }
 
+    /* only searches browsed in the display are kept up to date */
+    if (this->stream_format || this->load_path) {
+        this->watch = 0;
+    }
+
+    /* indexes and servers know only the files the ignore files let through */
+    if (this->no_ignore) {
+        this->no_index = 1;
+        this->no_server = 1;
+    }
+
+    /* files listed from the git index or from a snapshot are searched as
+       they're listed, not as an index or a server knows them */
+    if (this->git || this->snapshot) {
+        this->no_index = 1;
+        this->no_server = 1;
+    }
+
+    /* listed files are searched as they're given, without anything known of
+       the directory */
+    if (this->files_from) {
+        this->watch = 0;
+        this->snapshot = 0;
+        this->git = 0;
+        this->no_index = 1;
+        this->no_server = 1;
+    }
+
+    /* indexing and serving take only the directory */
+    if ((this->build_index || this->serve) && argc - optind <= 1) {
+        this->directory = strdup(argc - optind == 1 ? argv[optind] : ".");
+        return EXIT_SUCCESS;
+    }
+
+    /* the search of a result set is saved along with it */
+    if (this->load_path && argc - optind == 0) {
+        return EXIT_SUCCESS;
+    }
+
     if (argc - optind == 1) {
         this->pattern = strdup(argv[optind++]);
         this->directory = strdup(".");
@@ -103,16 +334,50 @@ static uint8_t parse_arguments(struct config *this, int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    /* streamed lines are read by other tools, keep them whole unless asked */
+    if (this->stream_format && !window_set) {
+        this->full_lines = 1;
+    }
+
     return EXIT_SUCCESS;
 }
 
 
+/* API ************************************************************************/
+/**
+ * Add the directories every search skips, whatever its -x options.
+ */
+void config_add_default_exclusions(struct tree *dir_exclusion_tree)
+{
+    tree_add_string(dir_exclusion_tree, ".");
+    tree_add_string(dir_exclusion_tree, "..");
+    tree_add_string(dir_exclusion_tree, ".git");
+    tree_add_string(dir_exclusion_tree, ".svn");
+}
+
+/**
+ * Hash the options deciding which files a search looks into: file lists and
+ * indexes made with other ones are not reused.
+ */
+uint64_t config_hash_filters(const struct config *this)
+{
+    uint64_t hash = tree_hash(this->file_extensions_tree);
+
+    hash = file_utils_hash_value(hash, tree_hash(this->dir_exclusion_tree));
+    hash = file_utils_hash_value(hash, this->raw_search | this->follow_symlinks << 1 |
+                                       this->no_ignore << 2);
+
+    return hash;
+}
+
+
 /* CONTRUCTOR *****************************************************************/
 struct config * config_new(int argc, char *argv[])
 {
     struct config *this = calloc(1, sizeof(struct config));
     this->file_extensions_tree = tree_new();
     this->dir_exclusion_tree = tree_new();
+    this->window_size = DEFAULT_WINDOW_SIZE;
 
     if (parse_arguments(this, argc, argv) == EXIT_FAILURE) {
         printf("Failed parsing arguments\n");
@@ -133,6 +398,8 @@ void config_delete(struct config *this)
 {
     tree_delete(this->dir_exclusion_tree);
     tree_delete(this->file_extensions_tree);
+    free(this->load_path);
+    free(this->files_from);
     free(this->pattern);
     free(this->directory);
     free(this);
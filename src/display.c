@@ -7,12 +7,18 @@
 #include <locale.h>
 #include <ncurses.h>
 
+#include <poll.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/eventfd.h>
 
 #include "display.h"
 #include "entries.h"
+#include "export.h"
 #include "open.h"
+#include "preview.h"
 #include "search.h"
+#include "search_algorithm.h"
 #include "subsearch.h"
 
 
@@ -22,6 +28,18 @@
 #define BACKSPACE   8
 #define SUPPR       127
 
+#define PREVIEW_INTERVAL    50  // refresh period of the results while typing (ms)
+#define REFRESH_INTERVAL    30  // minimum time between two refreshes on new results (ms)
+#define ROLL_INTERVAL       100 // refresh period of the rolling wheel while searching (ms)
+
+#define PREVIEW_CONTEXT     5   // lines shown before and after the selected line
+#define PREVIEW_HEIGHT      (2 * PREVIEW_CONTEXT + 2)
+
+#define ROW_CACHE_SIZE      256 // rendered rows kept by display
+#define MAX_ROW_SLICES      32  // slices of a rendered row, matches past them aren't highlighted
+
+#define UTF8_CONTINUATION(c)    (((uint8_t) (c) & 0xc0) == 0x80)
+
 
 /* ncurse colors */
 enum colors {
@@ -32,19 +50,59 @@ enum colors {
     green,
 };
 
+/**
+ * A line cut in slices ready to be printed, cached by display so that only
+ * rows newly exposed by scrolling are rendered.
+ */
+struct slice {
+    uint32_t start;     // position in the entry data
+    uint32_t length;
+    uint8_t color;
+};
+
+struct row {
+    uint32_t index;     // entry the row was rendered for
+    int width;          // width of the terminal the row was rendered for
+    uint8_t visited;
+    uint8_t valid;
+
+    const char *data;
+    char line_str[12];
+    uint16_t nb_slices;
+    struct slice slices[MAX_ROW_SLICES];
+};
+
 struct display {
     /* positions of current session */
-    uint32_t index;     // position of first entry to display in entries (0->nb_entries by increment of (LINES - 1))
-    int32_t cursor;     // position of cursor on screen (0->(LINES - 1))
+    uint32_t index;     // position of first entry to display in entries (0->nb_entries by increment of a page)
+    int32_t cursor;     // position of cursor on screen (0->page size)
 
     struct display *parent_display;
     char *patterns;     // patterns for the status bar
 
     int display_vertical_size;
+
+    /* state of the screen, to only draw what changed */
+    uint8_t redraw;             // everything must be drawn again
+    uint32_t drawn_index;
+    int32_t drawn_cursor;
+    uint32_t drawn_nb_entries;
+    uint32_t drawn_nb_removals;
+    char drawn_status[256];
+
+    struct row *rows;   // rendered rows, by entry index modulo ROW_CACHE_SIZE
+
+    /* eventfd the entries signal their updates to, of the main display only.
+       It's closed once the threads writing to it are done. */
+    int event_fd;
 };
 
 extern struct search *current_search;
 
+static struct preview *preview = NULL;  // files mapped for the preview pane
+static uint8_t preview_shown = 0;
+static struct export *export = NULL;    // last export of results, one at a time
+
 
 /* NCURSES ENVIRONMENT ********************************************************/
 static void ncurses_init(void)
@@ -78,22 +136,32 @@ static void ncurses_clear_screen(void)
 
 
 /* PRINT SEARCH TO FILE *******************************************************/
-static void save_search_output(const struct entries *entries)
+/**
+ * Save the entries shown in the background, its progress is in the status bar.
+ */
+static void save_search_output(struct entries *entries, const struct search *main_search,
+                               const enum export_format format)
 {
-    uint32_t nb_entries = entries_get_nb_entries(entries);
-
-    FILE *output = fopen("ngp.out", "w+");
-    if (!output) {
-        return;
+    if (export) {
+        if (export_get_status(export)) {
+            return;
+        }
+        export_delete(export);
     }
 
-    uint32_t i = 0;
-    for (i = 0; i < nb_entries; i++) {
-        char *data = entries_get_data(entries, i);
-        fprintf(output, "%s\n", data);
-    }
+    export = export_new(entries, main_search, format);
+}
 
-    fclose(output);
+/**
+ * Abort the export of entries about to be freed.
+ */
+static void cancel_search_output(const struct entries *entries)
+{
+    if (export && export_get_entries(export) == entries) {
+        export_stop(export);
+        export_delete(export);
+        export = NULL;
+    }
 }
 
 
@@ -109,10 +177,6 @@ static void display_bar(struct display *this, const struct search *search, const
         roll_char = rollingwheel[++i%4];
     }
 
-    /* build first part of status line that shows patterns */
-    char *buf = calloc(COLS, sizeof(char));
-    snprintf(buf, COLS, "%s%*s", this->patterns, (int)(COLS - strlen(this->patterns)), "");
-
     /* calculate percent of entries scrolled */
     int percent_completed = 0;
     uint32_t nb_entries = entries_get_nb_entries(entries);
@@ -120,143 +184,212 @@ static void display_bar(struct display *this, const struct search *search, const
         percent_completed = (100 * (this->index + this->cursor + 1)) / nb_entries;
     }
 
+    /* show where the last export is at */
+    char export_status[128] = {0};
+    if (export && export_get_status(export)) {
+        snprintf(export_status, sizeof(export_status), "saving %u%%   ", export_get_progress(export));
+    } else if (export && export_get_failed(export)) {
+        snprintf(export_status, sizeof(export_status), "save failed   ");
+    } else if (export) {
+        snprintf(export_status, sizeof(export_status), "saved %.64s   ", export_get_path(export));
+    }
+
     /* build second part of status line that shows number of entries */
     char tmp[256] = {0};
-    snprintf(tmp, 256, "   %d %d%% %s", entries_get_nb_lines(entries), percent_completed, roll_char);
+    snprintf(tmp, 256, "   %s%d %d%% %s", export_status, entries_get_nb_lines(entries),
+             percent_completed, roll_char);
 
-    /* fuuuuuuu-sion */
-    memcpy(buf + COLS - strlen(tmp), tmp, strlen(tmp));
+    if (!this->redraw && strcmp(tmp, this->drawn_status) == 0) {
+        return;
+    }
+    strcpy(this->drawn_status, tmp);
 
-    /* print status line */
+    /* print status line: patterns on the left, number of entries on the right */
+    int tmp_len = strlen(tmp);
     attron(COLOR_PAIR(normal));
-    mvaddstr(LINES - 1, 0, buf);
-    free(buf);
+    mvprintw(LINES - 1, 0, "%-*.*s", COLS - 1, COLS - 1, this->patterns);
+    if (tmp_len < COLS) {
+        mvaddstr(LINES - 1, COLS - tmp_len, tmp);
+    }
 }
 
 
 /* PRINT DATA *****************************************************************/
 /**
- * Find and colorize regex patterns.
+ * Get the spans of the pattern highlighted in the current search.
+ * Spans of the main search were recorded during the scan; subsearch patterns
+ * are searched in the visible entries only.
  */
-static void colorize_regex_pattern(char *line_contents)
+static uint16_t get_spans(const struct entry *entry, struct span *spans,
+                          const struct span **result)
 {
-    /* only one match cuz I'm lazy */
-    regmatch_t pmatch[1];
-    regexec(search_get_regex(current_search), line_contents, 1, pmatch, 0);
-    size_t start = pmatch[0].rm_so;
-    int stop = pmatch[0].rm_eo;
-
-    char *ptr = line_contents;
+    /* excluded patterns and file names are never highlighted */
+    const struct search *search = current_search;
+    while (search_get_invert(search) || search_get_path(search)) {
+        search = search_get_parent(search);
+    }
 
-    if ((int)start > COLS) {
-        return;
+    if (search_get_parent(search) == NULL) {
+        *result = entry_get_spans(entry);
+        return entry->nb_spans;
     }
 
-    printw("%.*s", start, ptr);
-    ptr += start;
+    *result = spans;
+    return search_algorithm_spans(search, entry->data, strlen(entry->data), 0,
+                                  spans, MAX_SPANS);
+}
 
-    attron(COLOR_PAIR(red));
+/**
+ * Find where to start printing a line so that its first match is on screen:
+ * lines wider than the screen are centered on the match.
+ */
+static size_t center_on_match(const char *line_contents, const int width,
+                              const struct span *spans, const uint16_t nb_spans)
+{
+    if (nb_spans == 0 || spans[0].start + spans[0].length <= (uint32_t) width) {
+        return 0;
+    }
 
-    int max_print = 0;
-    if (stop > COLS) {
-        max_print = COLS - start;
-    } else {
-        max_print = stop - start;
+    size_t start = 0;
+    if (spans[0].start > (uint32_t) width / 2) {
+        start = spans[0].start - width / 2;
     }
 
-    printw("%.*s", max_print, ptr);
-    ptr += start;
+    while (start > 0 && UTF8_CONTINUATION(line_contents[start])) {
+        start--;
+    }
 
-    attron(COLOR_PAIR(normal));
+    return start;
 }
 
 /**
- * Find and colorize normal patterns.
+ * Cut a line in slices to print: the visible part of the line, centered on
+ * its first match, and the matches highlighted in it.
  */
-static void colorize_normal_patterns(char *line_contents, const uint8_t visited)
+static void render_row(struct row *row, const struct entry *entry,
+                       const uint8_t visited)
 {
-    char *ptr = line_contents;
+    /* like grep, context lines are numbered with a dash */
+    int line_str_len = snprintf(row->line_str, sizeof(row->line_str),
+                                entry->context ? "%d-" : "%d:", entry->line);
+    int width = COLS - line_str_len;
+
+    struct span local_spans[MAX_SPANS];
+    const struct span *spans = NULL;
+    uint16_t nb_spans = get_spans(entry, local_spans, &spans);
+
+    const char *line_contents = entry->data;
+    size_t position = center_on_match(line_contents, width, spans, nb_spans);
+    size_t stop = position + strnlen(line_contents + position, width);
+
+    int color = visited ? magenta : normal;
+    row->data = line_contents;
+    row->visited = visited;
+    row->nb_slices = 0;
+
+    /* slice the matches out of the line, the last slice takes what's left */
+    uint16_t i = 0;
+    for (i = 0; i < nb_spans && position < stop &&
+                row->nb_slices < MAX_ROW_SLICES - 2; i++) {
+        size_t span_start = spans[i].start;
+        size_t span_stop = span_start + spans[i].length;
+
+        if (span_stop <= position) {
+            continue;
+        }
+        if (span_start >= stop) {
+            break;
+        }
 
-    char *pattern = search_get_pattern(current_search);
-    char *pattern_position = NULL;
+        if (span_start > position) {
+            row->slices[row->nb_slices++] = (struct slice) {position, span_start - position, color};
+            position = span_start;
+        }
 
-    char *(*search_function)(const char *, const char *);
+        if (span_stop > stop) {
+            span_stop = stop;
+        }
 
-    if (search_get_sensitive(current_search)) {
-        search_function = strcasestr;
-    } else {
-        search_function = strstr;
+        row->slices[row->nb_slices++] = (struct slice) {position, span_stop - position, red};
+        position = span_stop;
     }
 
-    /* find next occurrence of pattern */
-    while ((pattern_position = search_function(ptr, pattern))) {
-
-        /* return if pattern is off-screen */
-        if (pattern_position - line_contents > COLS) {
-            break;
-        }
+    if (position < stop) {
+        row->slices[row->nb_slices++] = (struct slice) {position, stop - position, color};
+    }
+}
 
-        printw("%.*s", pattern_position - ptr, ptr);
-        ptr += pattern_position - ptr;
+/**
+ * Get the rendered row of an entry from the cache of the display, rendering
+ * it if the entry or the width of the terminal changed.
+ */
+static const struct row * get_row(struct display *this, const uint32_t index,
+                                  const struct entry *entry, const uint8_t visited,
+                                  struct row *local_row)
+{
+    struct row *row = local_row;
 
-        /* print pattern then move ptr by pattern size */
-        attron(COLOR_PAIR(red));
-        printw("%.*s", strlen(pattern), pattern_position);
-        if (visited) {
-            attron(COLOR_PAIR(magenta));
-        } else {
-            attron(COLOR_PAIR(normal));
+    if (this->rows) {
+        row = &this->rows[index % ROW_CACHE_SIZE];
+        if (row->valid && row->index == index && row->width == COLS &&
+            row->visited == visited) {
+            return row;
         }
-        ptr += strlen(pattern);
     }
+
+    render_row(row, entry, visited);
+    row->index = index;
+    row->width = COLS;
+    row->valid = 1;
+
+    return row;
 }
 
-static void print_line_contents(const uint32_t y_position,
-                                const uint32_t line_number,
-                                char *line_contents,
+static void print_line_contents(struct display *this, const uint32_t y_position,
+                                const struct entry *entry,
                                 const uint8_t visited)
 {
-    char line_str[10] = {0};
-    size_t line_str_len = snprintf(line_str, 10, "%d:", line_number);
+    struct row local_row;
+    const struct row *row = get_row(this, this->index + y_position, entry,
+                                    visited, &local_row);
+
+    /* context lines are dimmed */
+    if (entry->context) {
+        attron(A_DIM);
+    }
 
     /* print the line number */
     attron(COLOR_PAIR(yellow));
-    mvprintw(y_position, 0, "%s", line_str);
+    mvprintw(y_position, 0, "%s", row->line_str);
 
-    /* first, print whole line contents */
     if (visited) {
         attron(A_REVERSE);
-        attron(COLOR_PAIR(magenta));
-    } else {
-        attron(COLOR_PAIR(normal));
     }
-    mvprintw(y_position, line_str_len, "%.*s", COLS - line_str_len, line_contents);
-    move(y_position, line_str_len); // reset cursor to beginning of line
 
-    /* next, overwrite patterns on the line */
-    if (search_get_regex(current_search)) {
-        colorize_regex_pattern(line_contents);
-    } else {
-        colorize_normal_patterns(line_contents, visited);
+    /* print the line contents */
+    uint16_t i = 0;
+    for (i = 0; i < row->nb_slices; i++) {
+        attron(COLOR_PAIR(row->slices[i].color));
+        printw("%.*s", (int) row->slices[i].length, row->data + row->slices[i].start);
     }
 
     /* reset colors if need be */
+    attron(COLOR_PAIR(normal));
     if (visited) {
-        attron(COLOR_PAIR(normal));
         attroff(A_REVERSE);
     }
+    attroff(A_DIM);
 }
 
-static void print_line(struct display *this,
-                       const uint32_t y_position, uint32_t line, char *data,
-                       const uint8_t visited)
+static void print_line(struct display *this, const uint32_t y_position,
+                       const struct entry *entry)
 {
     if (y_position == (uint32_t) this->cursor) {
         attron(A_REVERSE);
-        print_line_contents(y_position, line, data, 0);
+        print_line_contents(this, y_position, entry, 0);
         attroff(A_REVERSE);
     } else {
-        print_line_contents(y_position, line, data, visited);
+        print_line_contents(this, y_position, entry, entry->visited);
     }
 }
 
@@ -275,15 +408,19 @@ static void display_entry(struct display *this, const struct entry *entry, const
     if (entry->line == 0) {
         print_file(this, y_position, entry->data);
     } else {
-        print_line(this, y_position, entry->line, entry->data, entry->visited);
+        print_line(this, y_position, entry);
     }
 }
 
-static void display_entries(struct display *this, const struct entries *entries)
+/**
+ * Draw the rows in [first, last) of the screen.
+ */
+static void display_rows(struct display *this, const struct entries *entries,
+                         const uint32_t first, const uint32_t last)
 {
     uint32_t i = 0;
 
-    for (i = this->index; i < this->index + (LINES - 1); i++) {
+    for (i = this->index + first; i < this->index + last; i++) {
 
         if (entries_get_data(entries, i) == NULL) {
             break;
@@ -293,6 +430,154 @@ static void display_entries(struct display *this, const struct entries *entries)
     }
 }
 
+static void display_entries(struct display *this, const struct entries *entries)
+{
+    display_rows(this, entries, 0, this->display_vertical_size - 1);
+}
+
+/* PREVIEW ********************************************************************/
+/**
+ * Height of the list of entries, the preview pane is below it when shown.
+ */
+static int list_height(void)
+{
+    if (preview_shown && LINES > 2 * PREVIEW_HEIGHT) {
+        return LINES - PREVIEW_HEIGHT;
+    }
+
+    return LINES;
+}
+
+/**
+ * Show the lines around the selected entry, read from its file.
+ */
+static void display_preview(struct display *this, const struct entries *entries)
+{
+    uint32_t index = this->index + this->cursor;
+    int top = this->display_vertical_size - 1;
+    int y = 0;
+
+    char *file = NULL;
+    uint32_t line = 0;
+    if (entries_get_data(entries, index)) {
+        struct entry *entry = entries_get_entry(entries, index);
+        line = entry->line;
+        file = line ? entries_find_file(entries, index) : entry->data;
+    }
+
+    /* title of the pane */
+    attron(COLOR_PAIR(green));
+    attron(A_REVERSE);
+    mvprintw(top, 0, "%-*.*s", COLS, COLS, file ? file : "");
+    attroff(A_REVERSE);
+
+    uint32_t first = line > PREVIEW_CONTEXT ? line - PREVIEW_CONTEXT : 1;
+    char *buf = malloc(COLS + 1);
+
+    for (y = top + 1; y < LINES - 1; y++) {
+        uint32_t number = first + y - top - 1;
+
+        move(y, 0);
+        clrtoeol();
+
+        size_t length = 0;
+        const char *data = NULL;
+        if (file) {
+            data = preview_get_line(preview, file, number, &length);
+        }
+        if (data == NULL) {
+            continue;
+        }
+
+        attron(COLOR_PAIR(yellow));
+        printw("%d:", number);
+
+        /* clip the line and keep it on its row */
+        size_t width = COLS - getcurx(stdscr);
+        size_t i = 0;
+        for (i = 0; i < length && i < width; i++) {
+            buf[i] = (data[i] == '\t' || data[i] == '\r') ? ' ' : data[i];
+        }
+        buf[i] = 0;
+
+        attron(COLOR_PAIR(normal));
+        if (number == line) {
+            attron(A_BOLD);
+        }
+        printw("%s", buf);
+        attroff(A_BOLD);
+    }
+
+    free(buf);
+}
+
+
+/**
+ * Bring the screen up to date, only drawing the rows that changed since the
+ * last refresh: all of them after scrolling, the rows of the old and new
+ * cursor positions, and rows of new entries.
+ */
+static void display_refresh(struct display *this, const struct search *main_search,
+                            const struct entries *entries)
+{
+    uint32_t nb_rows = this->display_vertical_size - 1;
+    uint32_t nb_entries = entries_get_nb_entries(entries);
+    uint32_t nb_removals = entries_get_nb_removals(entries);
+
+    /* entries removed from watched results moved the next ones up */
+    if (nb_removals != this->drawn_nb_removals) {
+        if (nb_entries && this->index + this->cursor >= nb_entries) {
+            this->cursor = (nb_entries - 1) % nb_rows;
+            this->index = nb_entries - 1 - this->cursor;
+        }
+        if (this->rows) {
+            memset(this->rows, 0, ROW_CACHE_SIZE * sizeof(struct row));
+        }
+        this->redraw = 1;
+    }
+
+    if (this->redraw || this->index != this->drawn_index) {
+        this->redraw = 1;
+        erase();
+        display_rows(this, entries, 0, nb_rows);
+    } else {
+        if (this->cursor != this->drawn_cursor) {
+            if (this->drawn_cursor >= 0 && (uint32_t) this->drawn_cursor < nb_rows) {
+                display_rows(this, entries, this->drawn_cursor, this->drawn_cursor + 1);
+            }
+            if (this->cursor >= 0 && (uint32_t) this->cursor < nb_rows) {
+                display_rows(this, entries, this->cursor, this->cursor + 1);
+            }
+        }
+
+        if (nb_entries > this->drawn_nb_entries &&
+            this->drawn_nb_entries < this->index + nb_rows) {
+            uint32_t first = 0;
+            if (this->drawn_nb_entries > this->index) {
+                first = this->drawn_nb_entries - this->index;
+            }
+            display_rows(this, entries, first, nb_rows);
+        }
+    }
+
+    /* the preview follows the selected entry */
+    uint32_t selected = this->index + this->cursor;
+    if (preview_shown && this->display_vertical_size < LINES &&
+        (this->redraw || selected != this->drawn_index + this->drawn_cursor ||
+         (selected >= this->drawn_nb_entries && selected < nb_entries))) {
+        display_preview(this, entries);
+    }
+
+    display_bar(this, main_search, entries);
+    refresh();
+
+    this->redraw = 0;
+    this->drawn_index = this->index;
+    this->drawn_cursor = this->cursor;
+    this->drawn_nb_entries = nb_entries;
+    this->drawn_nb_removals = nb_removals;
+}
+
 
 /* MOVE COMMANDS **************************************************************/
 static void page_down(struct display *this, const struct entries *entries)
@@ -300,20 +585,17 @@ static void page_down(struct display *this, const struct entries *entries)
     uint32_t nb_entries = entries_get_nb_entries(entries);
 
     /* if there isn't a next page, move to the last entry on this page */
-    if (this->index + (LINES - 1) >= nb_entries) {
+    if (this->index + (this->display_vertical_size - 1) >= nb_entries) {
         this->cursor = nb_entries - this->index - 1;
         return;
     }
 
-    this->index += (LINES - 1);
+    this->index += (this->display_vertical_size - 1);
     this->cursor = 0;
 
     if (entries_is_file(entries, this->index + this->cursor)) {
         this->cursor += 1;
     }
-
-    clear();
-    display_entries(this, entries);
 }
 
 static void page_up(struct display *this, const struct entries *entries)
@@ -323,15 +605,12 @@ static void page_up(struct display *this, const struct entries *entries)
         return;
     }
 
-    this->cursor = (LINES - 1) - 1;
-    this->index -= (LINES - 1);
+    this->cursor = (this->display_vertical_size - 1) - 1;
+    this->index -= (this->display_vertical_size - 1);
 
     if (entries_is_file(entries, this->index + this->cursor)) {
         this->cursor -= 1;
     }
-
-    clear();
-    display_entries(this, entries);
 }
 
 static void key_down(struct display *this, const struct entries *entries)
@@ -340,7 +619,7 @@ static void key_down(struct display *this, const struct entries *entries)
         return;
     }
 
-    if (this->cursor == (LINES - 1) - 1) {
+    if (this->cursor == (this->display_vertical_size - 1) - 1) {
         page_down(this, entries);
         return;
     }
@@ -352,7 +631,7 @@ static void key_down(struct display *this, const struct entries *entries)
         this->cursor++;
     }
 
-    if (this->cursor > (LINES - 1) - 1) {
+    if (this->cursor > (this->display_vertical_size - 1) - 1) {
         page_down(this, entries);
         return;
     }
@@ -384,16 +663,17 @@ static void goto_home(struct display *this)
 {
     this->index = 0;
     this->cursor = 1;
-    clear();
 }
 
 static void goto_end(struct display *this, const struct entries *entries)
 {
     uint32_t nb_entries = entries_get_nb_entries(entries);
+    if (nb_entries == 0) {
+        return;
+    }
 
-    this->index = (nb_entries / (LINES - 1)) * (LINES - 1);
-    this->cursor = nb_entries % (LINES - 1) - 1;
-    clear();
+    this->index = ((nb_entries - 1) / (this->display_vertical_size - 1)) * (this->display_vertical_size - 1);
+    this->cursor = (nb_entries - 1) - this->index;
 }
 
 
@@ -422,24 +702,139 @@ static void print_mode_window(WINDOW *modew,
     mvwprintw(modew, 3, 1, "%s", "regex");
     wattroff(modew, A_REVERSE);
 
+    /* file names, literal or glob */
+    if (user_param->search_type == search_type_path) {
+        wattron(modew, A_REVERSE);
+    }
+    mvwprintw(modew, 4, 1, "%s", "path");
+    wattroff(modew, A_REVERSE);
+
+    /* file names, regex */
+    if (user_param->search_type == search_type_path_regex) {
+        wattron(modew, A_REVERSE);
+    }
+    mvwprintw(modew, 5, 1, "%s", "pathre");
+    wattroff(modew, A_REVERSE);
+
+    /* context lines, toggled with tab */
+    if (user_param->match_context) {
+        wattron(modew, A_REVERSE);
+    }
+    mvwprintw(modew, 6, 1, "%s", "+ctx");
+    wattroff(modew, A_REVERSE);
+
+    wrefresh(modew);
+}
+
+/**
+ * Sleep until a key is pressed, entries are updated by the search threads,
+ * or the timeout expires. Returns 1 if entries were updated.
+ */
+static uint8_t wait_event(const int event_fd, const int timeout)
+{
+    struct pollfd fds[2] = {
+        {.fd = STDIN_FILENO, .events = POLLIN},
+        {.fd = event_fd, .events = POLLIN},
+    };
+
+    if (poll(fds, 2, timeout) <= 0 || !(fds[1].revents & POLLIN)) {
+        return 0;
+    }
+
+    uint64_t events = 0;
+    if (read(event_fd, &events, sizeof(events)) < 0) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Show the results of the subsearch being typed under the subsearch windows.
+ */
+static void preview_subsearch(struct display *this, const struct search *main_search,
+                              const struct search *subsearch,
+                              WINDOW *modew, WINDOW *searchw)
+{
+    struct display preview = *this;
+    const struct entries *entries = search_get_entries(current_search);
+
+    if (subsearch) {
+        preview.index = 0;
+        preview.cursor = -1;
+        entries = search_get_entries(subsearch);
+    }
+    preview.redraw = 1;
+    preview.rows = NULL;    // rows of the display are for its own entries
+
+    erase();
+    display_entries(&preview, entries);
+    display_bar(&preview, main_search, entries);
+    refresh();
+
+    touchwin(modew);
     wrefresh(modew);
+    touchwin(searchw);
+    wrefresh(searchw);
+}
+
+/**
+ * Start filtering the pattern typed so far, cancelling the filter of the
+ * previous keystroke. Returns the subsearch for the pattern, or NULL if
+ * there is nothing to filter.
+ */
+static struct search * update_subsearch(struct search *subsearch,
+                                        const struct subsearch_user_params *user_param)
+{
+    uint8_t valid = user_param->pattern[0] != 0;
+
+    if (valid && (user_param->search_type == search_type_regex ||
+                  user_param->search_type == search_type_path_regex)) {
+        regex_t *regex = search_algorithm_compile_regex(user_param->pattern);
+        valid = regex != NULL;
+        if (regex) {
+            regfree(regex);
+            free(regex);
+        }
+    }
+
+    if (!valid) {
+        if (subsearch) {
+            subsearch_delete(subsearch);
+        }
+        return NULL;
+    }
+
+    if (subsearch) {
+        return subsearch_refine(subsearch, user_param);
+    }
+
+    return subsearch_new(current_search, user_param);
 }
 
 /**
  * Pops a new window for the user to write a new pattern to look for.
+ * Results are filtered as the pattern is typed. Returns the subsearch of the
+ * pattern, or NULL if it was cancelled.
  */
-static uint8_t subsearch_window(struct subsearch_user_params *user_param)
+static struct search * subsearch_window(struct display *this, const struct search *main_search,
+                                        struct subsearch_user_params *user_param)
 {
 	int	j = 0, car;
 
     char *search = user_param->pattern;
+    struct search *subsearch = NULL;
 
-    WINDOW *modew = newwin(5, 8, ((LINES - 1)-5)/2 , (COLS-50)/2 - 7);
+    WINDOW *modew = newwin(8, 8, ((LINES - 1)-8)/2 , (COLS-50)/2 - 7);
     box(modew, 0, 0);
     print_mode_window(modew, user_param);
 
 	WINDOW *searchw = newwin(3, 50, ((LINES - 1)-3)/2 , (COLS-50)/2);
 	box(searchw, 0, 0);
+    wtimeout(searchw, 0);
+
+    uint8_t updated = 1;    // the preview is out of date
+    uint8_t searching = search_get_status(main_search);
 
     char *include_format = "To include: %s ";
     char *exclude_format = "To exclude: %s ";
@@ -452,7 +847,22 @@ static uint8_t subsearch_window(struct subsearch_user_params *user_param)
     }
     mvwprintw(searchw, 1, 1, format, "");
 
-	while ((car = wgetch(searchw)) != '\n' && j < 4096) {
+	while ((car = wgetch(searchw)) != '\n' && j < (int) sizeof(user_param->pattern) - 1) {
+
+        /* no key pressed, show the progress of the filter once it changes */
+        if (car == ERR) {
+            if (updated || searching != search_get_status(main_search)) {
+                searching = search_get_status(main_search);
+                preview_subsearch(this, main_search, subsearch, modew, searchw);
+            }
+
+            /* the end of the search, and entries without events, are polled for */
+            int timeout = searching || this->event_fd < 0 ? PREVIEW_INTERVAL : -1;
+            updated = wait_event(this->event_fd, timeout) || this->event_fd < 0;
+            continue;
+        }
+
+        updated = 1;
 
 		if (car == ESCAPE) {
 
@@ -461,9 +871,12 @@ static uint8_t subsearch_window(struct subsearch_user_params *user_param)
 
             /* no char received after means ESCAPE key */
             if (car == ERR) {
+                if (subsearch) {
+                    subsearch_delete(subsearch);
+                }
                 delwin(searchw);
 	            delwin(modew);
-                return EXIT_FAILURE;
+                return NULL;
             }
 
             /* extended keycodes */
@@ -479,39 +892,131 @@ static uint8_t subsearch_window(struct subsearch_user_params *user_param)
 
                 /* down key */
                 if (car == 66) {
-                    if (user_param->search_type < 2) {
+                    if (user_param->search_type < search_type_path_regex) {
                         user_param->search_type++;
                     }
                 }
 
                 print_mode_window(modew, user_param);
+                subsearch = update_subsearch(subsearch, user_param);
             }
 
-            nodelay(searchw, FALSE);
+            wtimeout(searchw, 0);
             continue;
 		}
 
+        /* match context lines too */
+        if (car == '\t') {
+            user_param->match_context = !user_param->match_context;
+            print_mode_window(modew, user_param);
+            subsearch = update_subsearch(subsearch, user_param);
+            continue;
+        }
+
 		if (car == BACKSPACE || car == SUPPR) {
 			if (j > 0) {
 				search[--j] = 0;
             }
 			mvwprintw(searchw, 1, 1, format, search);
+            subsearch = update_subsearch(subsearch, user_param);
 			continue;
 		}
 
 		search[j++] = car;
+        search[j] = 0;
 		mvwprintw(searchw, 1, 1, format, search);
+        subsearch = update_subsearch(subsearch, user_param);
 	}
 
-	search[j] = 0;
 	delwin(searchw);
 	delwin(modew);
 
-    if (j <= 0) {
-        return EXIT_FAILURE;
+    return subsearch;
+}
+
+
+/**
+ * Pops a window for the user to write the pattern replacing the one of the
+ * main search, searched as a string, ignoring case or as a regex. Returns 0
+ * if it was cancelled or if the regex is invalid.
+ */
+static uint8_t pattern_window(struct subsearch_user_params *user_param)
+{
+    static const char *types[] = {"string", "nocase", "regex"};
+    char *pattern = user_param->pattern;
+    int j = 0, car;
+    uint8_t i = 0;
+
+    WINDOW *modew = newwin(5, 8, ((LINES - 1)-5)/2 , (COLS-50)/2 - 7);
+    box(modew, 0, 0);
+
+    WINDOW *searchw = newwin(3, 50, ((LINES - 1)-3)/2 , (COLS-50)/2);
+    box(searchw, 0, 0);
+    mvwprintw(searchw, 1, 1, "New pattern: %s ", "");
+
+    while (1) {
+        for (i = 0; i <= search_type_regex; i++) {
+            if (user_param->search_type == i) {
+                wattron(modew, A_REVERSE);
+            }
+            mvwprintw(modew, i + 1, 1, "%s", types[i]);
+            wattroff(modew, A_REVERSE);
+        }
+        wrefresh(modew);
+
+        car = wgetch(searchw);
+        if (car == '\n') {
+            break;
+        }
+
+        if (car == ESCAPE) {
+            nodelay(searchw, TRUE);
+            car = wgetch(searchw);
+            nodelay(searchw, FALSE);
+
+            /* no char received after means ESCAPE key */
+            if (car == ERR) {
+                j = 0;
+                break;
+            }
+
+            /* up and down keys choose the type of search */
+            if (car == 91) {
+                car = wgetch(searchw);
+                if (car == 65 && user_param->search_type > 0) {
+                    user_param->search_type--;
+                }
+                if (car == 66 && user_param->search_type < search_type_regex) {
+                    user_param->search_type++;
+                }
+            }
+            continue;
+        }
+
+        if (car == BACKSPACE || car == SUPPR) {
+            if (j > 0) {
+                pattern[--j] = 0;
+            }
+        } else if (j < (int) sizeof(user_param->pattern) - 1) {
+            pattern[j++] = car;
+            pattern[j] = 0;
+        }
+        mvwprintw(searchw, 1, 1, "New pattern: %s ", pattern);
+    }
+
+    delwin(searchw);
+    delwin(modew);
+
+    if (j > 0 && user_param->search_type == search_type_regex) {
+        regex_t *regex = search_algorithm_compile_regex(pattern);
+        if (regex == NULL) {
+            return 0;
+        }
+        regfree(regex);
+        free(regex);
     }
 
-    return EXIT_SUCCESS;
+    return j > 0;
 }
 
 
@@ -522,54 +1027,74 @@ static void resize(struct display *this)
        is always at the same place in the display */
     uint32_t current_position = this->index + this->cursor;
 
-    this->display_vertical_size = LINES;
+    this->display_vertical_size = list_height();
     this->cursor = current_position % (this->display_vertical_size - 1);
     this->index = current_position - this->cursor;
+    this->redraw = 1;
+    memset(this->rows, 0, ROW_CACHE_SIZE * sizeof(struct row));
     ncurses_clear_screen();
 }
 
-void display_loop(struct display *this, const struct search *main_search)
+static uint64_t now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void display_loop(struct display *this, struct search *main_search)
 {
     uint8_t run = 1;
-    int ch = 0;
+    uint8_t replaced = 0;       // the main pattern was replaced during the session
+    uint8_t updated = 1;        // entries changed since the last refresh, or first draw
+    uint64_t last_refresh = 0;
     struct entries *entries = search_get_entries(main_search);
 
+    int event_fd = this->event_fd;
+    preview = preview_new();
+
     ncurses_init();
-    while ((ch = getch()) && run) {
-        int sleep_time = 10000;
+    while (run) {
+        int ch = getch();
+
+        /* nothing to read, sleep until there's something new to show */
+        if (ch == ERR) {
+            int timeout = -1;
+            if (updated) {
+                uint64_t elapsed = now_ms() - last_refresh;
+                timeout = elapsed < REFRESH_INTERVAL ? REFRESH_INTERVAL - elapsed : 0;
+            } else if (search_get_status(main_search) || event_fd < 0) {
+                timeout = ROLL_INTERVAL;
+            }
+            updated |= wait_event(event_fd, timeout);
+        }
+
         switch(ch) {
 
         case KEY_NPAGE:
             page_down(this, entries);
-            sleep_time = 0;
             break;
 
         case KEY_PPAGE:
             page_up(this, entries);
-            sleep_time = 0;
             break;
 
         case KEY_DOWN:
             key_down(this, entries);
-            sleep_time = 0;
             break;
 
         case KEY_UP:
             key_up(this, entries);
-            sleep_time = 0;
             break;
 
         /* goto line number */
         case KEY_HOME:
             goto_home(this);
-            ncurses_clear_screen();
-            sleep_time = 0;
             break;
 
         case KEY_END:
             goto_end(this, entries);
-            ncurses_clear_screen();
-            sleep_time = 0;
             break;
 
         case KEY_RESIZE: {
@@ -581,10 +1106,14 @@ void display_loop(struct display *this, const struct search *main_search)
         case QUIT: {
             struct search *parent_search = search_get_parent(current_search);
             if (parent_search) {
+                cancel_search_output(entries);
                 subsearch_delete(current_search);
                 current_search = parent_search;
                 entries = search_get_entries(current_search);
+
+                struct display *subdisplay = this;
                 this = this->parent_display;
+                display_delete(subdisplay);
 
                 /* force parent resize because child might have resized too
                    and since we're reusing old indexes they might need to be
@@ -605,6 +1134,9 @@ void display_loop(struct display *this, const struct search *main_search)
             ncurses_stop();
             open_entry(entries, entry_index);
             ncurses_init();
+            /* the file may have been edited */
+            preview_clear(preview);
+            this->redraw = 1;
             break;
         }
 
@@ -612,13 +1144,13 @@ void display_loop(struct display *this, const struct search *main_search)
         case '/': {
             struct subsearch_user_params user_params = {0};
 
-            uint8_t result = subsearch_window(&user_params);
-            if (result == EXIT_FAILURE) {
+            struct search *subsearch = subsearch_window(this, main_search, &user_params);
+            if (subsearch == NULL) {
                 ncurses_clear_screen();
+                this->redraw = 1;
                 break;
             }
 
-            struct search *subsearch = subsearch_new(current_search, &user_params);
             current_search = subsearch;
             entries = search_get_entries(current_search);
 
@@ -634,13 +1166,13 @@ void display_loop(struct display *this, const struct search *main_search)
             struct subsearch_user_params user_params = {0};
             user_params.invert_search = 1;
 
-            uint8_t result = subsearch_window(&user_params);
-            if (result == EXIT_FAILURE) {
+            struct search *subsearch = subsearch_window(this, main_search, &user_params);
+            if (subsearch == NULL) {
                 ncurses_clear_screen();
+                this->redraw = 1;
                 break;
             }
 
-            struct search *subsearch = subsearch_new(current_search, &user_params);
             current_search = subsearch;
             entries = search_get_entries(current_search);
 
@@ -656,25 +1188,98 @@ void display_loop(struct display *this, const struct search *main_search)
             break;
 
         case 'p':
-            save_search_output(entries);
+            save_search_output(entries, main_search, export_format_text);
             break;
 
+        case 'P':
+            save_search_output(entries, main_search, export_format_binary);
+            break;
+
+        case 'v':
+            preview_shown = !preview_shown;
+            resize(this);
+            break;
+
+        /* search another pattern in place of the main one */
+        case 'r': {
+            struct subsearch_user_params user_params = {0};
+
+            if (!pattern_window(&user_params)) {
+                ncurses_clear_screen();
+                this->redraw = 1;
+                break;
+            }
+
+            /* subsearches filter the results being replaced */
+            while (search_get_parent(current_search)) {
+                struct search *parent_search = search_get_parent(current_search);
+                cancel_search_output(entries);
+                subsearch_delete(current_search);
+                current_search = parent_search;
+                entries = search_get_entries(current_search);
+
+                struct display *subdisplay = this;
+                this = this->parent_display;
+                display_delete(subdisplay);
+            }
+
+            cancel_search_output(entries);
+            if (search_restart(main_search, user_params.pattern,
+                               user_params.search_type == search_type_nocase,
+                               user_params.search_type == search_type_regex) == EXIT_SUCCESS) {
+                entries = search_get_entries(main_search);
+                free(this->patterns);
+                this->patterns = strdup(user_params.pattern);
+                this->index = 0;
+                this->cursor = 0;
+                replaced = 1;
+            }
+            resize(this);
+            break;
+        }
+
         default:
             break;
         }
 
-        usleep(sleep_time);
-        display_entries(this, entries);
-        display_bar(this, main_search, entries);
+        /* keys are shown right away, new results at a limited rate */
+        uint64_t now = now_ms();
+        if (ch != ERR || now - last_refresh >= REFRESH_INTERVAL) {
+            display_refresh(this, main_search, entries);
+            last_refresh = now;
+            updated = 0;
+        }
 
-        /* check if main search thread has ended without results */
-        if (!search_get_parent(current_search) &&
-            !search_get_status(main_search) && entries->nb_entries == 0) {
+        /* check if main search thread has ended without results, watched
+           searches wait for the files to change, replaced patterns for
+           another one */
+        if (!search_get_parent(current_search) && !search_get_status(main_search) &&
+            entries->nb_entries == 0 && main_search->watched == NULL && !replaced) {
             run = 0;
         }
     }
 
     ncurses_stop();
+    preview_delete(preview);
+    preview = NULL;
+
+    /* exports are finished before leaving, showing how far they got */
+    if (export) {
+        uint8_t waited = 0;
+        while (export_get_status(export)) {
+            printf("\rsaving %s %u%%", export_get_path(export), export_get_progress(export));
+            fflush(stdout);
+            usleep(ROLL_INTERVAL * 1000);
+            waited = 1;
+        }
+        if (waited) {
+            printf("\rsaving %s %s\n", export_get_path(export),
+                   export_get_failed(export) ? "failed" : "100%");
+        }
+
+        export_delete(export);
+        export = NULL;
+    }
 }
 
 
@@ -704,13 +1309,30 @@ struct display * display_new(struct display *parent_display, char *pattern)
         this->patterns = strdup(pattern);
     }
 
-    this->display_vertical_size = LINES;
+    this->display_vertical_size = list_height();
+    this->redraw = 1;
+    this->rows = calloc(ROW_CACHE_SIZE, sizeof(struct row));
+
+    this->event_fd = -1;
+    if (this->parent_display == NULL) {
+        this->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        entries_set_event_fd(this->event_fd);
+    }
 
     return this;
 }
 
+/**
+ * Delete a display. The main display must be deleted only once the searches
+ * that may signal updates to it are stopped and joined.
+ */
 void display_delete(struct display *this)
 {
+    if (this->event_fd >= 0) {
+        entries_set_event_fd(-1);
+        close(this->event_fd);
+    }
+    free(this->rows);
     free(this->patterns);
     free(this);
 }
@@ -1,19 +1,103 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <pthread.h>    //mutex
 
 #include "entries.h"
+#include "file_utils.h"
+
+#define SEGMENT_SHIFT   16
+#define SEGMENT_SIZE    (1 << SEGMENT_SHIFT)    // entries per segment
+#define SEGMENT_MASK    (SEGMENT_SIZE - 1)
+#define BLOCK_SIZE      (1 << 20)               // size of string blocks
+
+#define ENTRY(this, index) \
+    (&(this)->segments[(index) >> SEGMENT_SHIFT].entries[(index) & SEGMENT_MASK])
+
+#define WORD_BITS           64
+#define RANK_BLOCK_BITS     512     // selected entries are counted by blocks
+#define RANK_BLOCK_WORDS    (RANK_BLOCK_BITS / WORD_BITS)
+
 
-#define ALLOC_SIZE  5000
+pthread_mutex_t entries_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Memory budget shared by all the entries. Once it is exceeded, the oldest
+ * segments are written to an unlinked temporary file and mapped back in place
+ * so that pointers to entries and their data stay valid.
+ */
+struct spill {
+    size_t max_memory;  // 0 means no limit
+    size_t memory;      // anonymous memory currently held by entries
+    int fd;
+    off_t offset;       // end of the temporary file
+};
+
+static struct spill spill = {0, 0, -1, 0};
+
+
+/* VIEW SELECTION *************************************************************/
+/**
+ * Find the root index of the index-th selected entry of a view: binary search
+ * of its block of bits, then count bits in the block.
+ */
+static uint32_t view_select(const struct entries *this, const uint32_t index)
+{
+    uint32_t low = 0;
+    uint32_t high = this->end / RANK_BLOCK_BITS;
+
+    while (low < high) {
+        uint32_t middle = (low + high + 1) / 2;
+        if (this->ranks[middle] <= index) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    uint32_t remaining = index - this->ranks[low];
+    uint32_t word = low * RANK_BLOCK_WORDS;
+    uint32_t count;
+
+    while (remaining >= (count = __builtin_popcountll(this->bits[word]))) {
+        remaining -= count;
+        word++;
+    }
+
+    uint64_t bits = this->bits[word];
+    while (remaining--) {
+        bits &= bits - 1;
+    }
+
+    return word * WORD_BITS + __builtin_ctzll(bits);
+}
+
+/**
+ * Get an entry of a store or a view, with entries_mutex taken.
+ */
+static struct entry * get_entry(const struct entries *this, uint32_t index)
+{
+    if (this->root) {
+        index = view_select(this, index);
+        this = this->root;
+    }
+
+    return ENTRY(this, index);
+}
 
 
 /* GETTERS ********************************************************************/
 uint8_t entries_is_file(const struct entries *this, const uint32_t index)
 {
     pthread_mutex_lock(&entries_mutex);
-    uint8_t is_file = !this->entries[index].line;
+    uint8_t is_file = !get_entry(this, index)->line;
     pthread_mutex_unlock(&entries_mutex);
     return is_file;
 }
@@ -27,17 +111,43 @@ char * entries_find_file(const struct entries *this, const uint32_t index)
     }
 
     pthread_mutex_lock(&entries_mutex);
-    while (this->entries[--i].line != 0) {}
-    char *filename = this->entries[i].data;
+
+    /* the file of a selected line is always selected too */
+    if (this->root) {
+        i = view_select(this, i);
+        this = this->root;
+    }
+
+    do {
+        i--;
+    } while (ENTRY(this, i)->line != 0);
+    char *filename = ENTRY(this, i)->data;
     pthread_mutex_unlock(&entries_mutex);
 
     return filename;
 }
 
+/**
+ * Get the index of the file an entry of a store belongs to, a file belongs to
+ * itself.
+ */
+uint32_t entries_find_file_index(const struct entries *this, const uint32_t index)
+{
+    uint32_t i = index;
+
+    pthread_mutex_lock(&entries_mutex);
+    while (i > 0 && ENTRY(this, i)->line != 0) {
+        i--;
+    }
+    pthread_mutex_unlock(&entries_mutex);
+
+    return i;
+}
+
 uint32_t entries_get_line(const struct entries *this, const uint32_t index)
 {
     pthread_mutex_lock(&entries_mutex);
-    uint32_t entry_line = this->entries[index].line;
+    uint32_t entry_line = get_entry(this, index)->line;
     pthread_mutex_unlock(&entries_mutex);
 
     return entry_line;
@@ -45,8 +155,12 @@ uint32_t entries_get_line(const struct entries *this, const uint32_t index)
 
 char * entries_get_data(const struct entries *this, const uint32_t index)
 {
+    char *entry_data = NULL;
+
     pthread_mutex_lock(&entries_mutex);
-    char *entry_data = this->entries[index].data;
+    if (index < this->nb_entries) {
+        entry_data = get_entry(this, index)->data;
+    }
     pthread_mutex_unlock(&entries_mutex);
 
     return entry_data;
@@ -61,6 +175,15 @@ uint32_t entries_get_nb_lines(const struct entries *this)
     return nb_lines;
 }
 
+uint32_t entries_get_nb_files(const struct entries *this)
+{
+    pthread_mutex_lock(&entries_mutex);
+    uint32_t nb_files = this->nb_files;
+    pthread_mutex_unlock(&entries_mutex);
+
+    return nb_files;
+}
+
 uint32_t entries_get_nb_entries(const struct entries *this)
 {
     pthread_mutex_lock(&entries_mutex);
@@ -70,10 +193,19 @@ uint32_t entries_get_nb_entries(const struct entries *this)
     return nb_entries;
 }
 
+uint32_t entries_get_nb_removals(const struct entries *this)
+{
+    pthread_mutex_lock(&entries_mutex);
+    uint32_t nb_removals = this->nb_removals;
+    pthread_mutex_unlock(&entries_mutex);
+
+    return nb_removals;
+}
+
 struct entry * entries_get_entry(const struct entries *this, const uint32_t index)
 {
     pthread_mutex_lock(&entries_mutex);
-    struct entry *entry = &this->entries[index];
+    struct entry *entry = get_entry(this, index);
     pthread_mutex_unlock(&entries_mutex);
 
     return entry;
@@ -82,14 +214,14 @@ struct entry * entries_get_entry(const struct entries *this, const uint32_t inde
 void entries_set_visited(const struct entries *this, const uint32_t index)
 {
     pthread_mutex_lock(&entries_mutex);
-    this->entries[index].visited = 1;
+    get_entry(this, index)->visited = 1;
     pthread_mutex_unlock(&entries_mutex);
 }
 
 uint8_t entries_get_visited(const struct entries *this, const uint32_t index)
 {
     pthread_mutex_lock(&entries_mutex);
-    uint8_t visited = this->entries[index].visited;
+    uint8_t visited = get_entry(this, index)->visited;
     pthread_mutex_unlock(&entries_mutex);
 
     return visited;
@@ -98,62 +230,624 @@ uint8_t entries_get_visited(const struct entries *this, const uint32_t index)
 void entries_toggle_visited(const struct entries *this, const uint32_t index)
 {
     pthread_mutex_lock(&entries_mutex);
-    this->entries[index].visited ^= 1;
+    get_entry(this, index)->visited ^= 1;
     pthread_mutex_unlock(&entries_mutex);
 }
 
+/**
+ * Spans of the matches are stored in the same allocation, right before the
+ * entry data.
+ */
+struct span * entry_get_spans(const struct entry *this)
+{
+    return (struct span *) this->data - this->nb_spans;
+}
+
+
+/**
+ * Get the entries of a store from index on, as long as they're contiguous in
+ * memory, so that they can be read without taking the lock for each one.
+ * Returns the number of entries in the run, at most nb.
+ */
+uint32_t entries_get_run(const struct entries *this, const uint32_t index,
+                         const uint32_t nb, struct entry **run)
+{
+    uint32_t nb_run = SEGMENT_SIZE - (index & SEGMENT_MASK);
+    if (nb_run > nb) {
+        nb_run = nb;
+    }
+
+    pthread_mutex_lock(&entries_mutex);
+    *run = ENTRY(this, index);
+    pthread_mutex_unlock(&entries_mutex);
+
+    return nb_run;
+}
+
+/**
+ * Copy at most nb entries of a store or a view from index on, taking the lock
+ * once. Entry data never moves, it can still be read once the lock is
+ * released. Returns the number of entries copied.
+ */
+uint32_t entries_copy(const struct entries *this, const uint32_t index,
+                      const uint32_t nb, struct entry *copy)
+{
+    uint32_t i = 0;
+
+    pthread_mutex_lock(&entries_mutex);
+    uint32_t nb_copy = index < this->nb_entries ? this->nb_entries - index : 0;
+    if (nb_copy > nb) {
+        nb_copy = nb;
+    }
+
+    if (this->root == NULL) {
+        for (i = 0; i < nb_copy; i++) {
+            copy[i] = *ENTRY(this, index + i);
+        }
+    } else if (nb_copy) {
+        /* walk the selected bits from the first entry on */
+        uint32_t position = view_select(this, index);
+        uint32_t word = position / WORD_BITS;
+        uint64_t bits = this->bits[word] & (~0ULL << (position % WORD_BITS));
+
+        for (i = 0; i < nb_copy; i++) {
+            while (bits == 0) {
+                bits = this->bits[++word];
+            }
+            copy[i] = *ENTRY(this->root, word * WORD_BITS + __builtin_ctzll(bits));
+            bits &= bits - 1;
+        }
+    }
+    pthread_mutex_unlock(&entries_mutex);
+
+    return nb_copy;
+}
+
+
+/* EVENTS *********************************************************************/
+static int event_fd = -1;   // eventfd of the display, written on every update
+
+/**
+ * Wake up the threads waiting for new entries. Producers call this once per
+ * batch of entries rather than once per entry.
+ */
+void entries_notify(struct entries *this)
+{
+    pthread_mutex_lock(&entries_mutex);
+    pthread_cond_broadcast(&this->updated);
+    pthread_mutex_unlock(&entries_mutex);
+
+    int fd = __atomic_load_n(&event_fd, __ATOMIC_RELAXED);
+    if (fd < 0) {
+        return;
+    }
+
+    /* a saturated counter means the display has wakeups pending already,
+       other errors mean the descriptor can't be written, it's given up */
+    uint64_t event = 1;
+    ssize_t written = write(fd, &event, sizeof(event));
+    if (written < 0 && errno != EAGAIN && errno != EINTR) {
+        __atomic_compare_exchange_n(&event_fd, &fd, -1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Set the eventfd to signal updates of any entries to, -1 for none.
+ */
+void entries_set_event_fd(const int fd)
+{
+    __atomic_store_n(&event_fd, fd, __ATOMIC_RELAXED);
+}
+
+
+/* SPILL TO DISK **************************************************************/
+void entries_set_max_memory(const size_t max_memory)
+{
+    spill.max_memory = max_memory;
+}
+
+static uint8_t spill_open(void)
+{
+    if (spill.fd != -1) {
+        return EXIT_SUCCESS;
+    }
+
+    const char *tmpdir = getenv("TMPDIR");
+    if (tmpdir == NULL) {
+        tmpdir = "/tmp";
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/ngp.XXXXXX", tmpdir);
+
+    spill.fd = mkstemp(path);
+    if (spill.fd == -1) {
+        return EXIT_FAILURE;
+    }
+
+    /* the file lives as long as it is open */
+    unlink(path);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Write a mapping to the temporary file and map the file back over it.
+ * Contents don't change, only their backing does.
+ */
+static uint8_t spill_mapping(void *address, const size_t size, const int prot)
+{
+    size_t written = 0;
+
+    while (written < size) {
+        ssize_t ret = pwrite(spill.fd, (char *) address + written,
+                             size - written, spill.offset + written);
+        if (ret <= 0) {
+            return EXIT_FAILURE;
+        }
+        written += ret;
+    }
+
+    if (mmap(address, size, prot, MAP_SHARED | MAP_FIXED, spill.fd,
+             spill.offset) == MAP_FAILED) {
+        return EXIT_FAILURE;
+    }
+
+    spill.offset += size;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Spill the table and the blocks of a segment that aren't yet. Returns
+ * EXIT_FAILURE if some are left in memory, to be spilled on the next try.
+ */
+static uint8_t spill_segment(struct segment *segment)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uint32_t i = 0;
+
+    /* entries stay writable for the visited flag */
+    if (!segment->entries_spilled) {
+        pthread_mutex_lock(&entries_mutex);
+        uint8_t status = spill_mapping(segment->entries, SEGMENT_SIZE * sizeof(struct entry),
+                                       PROT_READ | PROT_WRITE);
+        pthread_mutex_unlock(&entries_mutex);
+        if (status == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+
+        segment->entries_spilled = 1;
+        __atomic_sub_fetch(&spill.memory, SEGMENT_SIZE * sizeof(struct entry), __ATOMIC_RELAXED);
+    }
+
+    for (i = 0; i < segment->nb_blocks; i++) {
+        struct block *block = &segment->blocks[i];
+        size_t used_size = ROUND_UP(block->used, page_size);
+        if (block->spilled) {
+            continue;
+        }
+
+        /* give back the unused end of the block */
+        if (used_size < block->size) {
+            munmap(block->data + used_size, block->size - used_size);
+            block->size = used_size;
+        }
+
+        if (spill_mapping(block->data, block->size, PROT_READ) == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+        block->spilled = 1;
+        __atomic_sub_fetch(&spill.memory, block->used, __ATOMIC_RELAXED);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Spill the oldest full segments of these entries until memory is back under
+ * budget. The last segment is still being filled and stays in memory. A
+ * segment that couldn't be spilled whole is tried again on the next check.
+ */
+static void check_memory(struct entries *this)
+{
+    if (!spill.max_memory ||
+        __atomic_load_n(&spill.memory, __ATOMIC_RELAXED) <= spill.max_memory) {
+        return;
+    }
+
+    if (spill_open() == EXIT_FAILURE) {
+        return;
+    }
+
+    while (this->first_in_memory + 1 < this->nb_segments &&
+           __atomic_load_n(&spill.memory, __ATOMIC_RELAXED) > spill.max_memory) {
+        if (spill_segment(&this->segments[this->first_in_memory]) == EXIT_FAILURE) {
+            break;
+        }
+        this->first_in_memory++;
+    }
+}
+
 
 /* ADD ************************************************************************/
 static void check_alloc(struct entries *this)
 {
-    if (this->nb_entries < this->size) {
+    if (this->nb_entries < this->nb_segments * SEGMENT_SIZE) {
         return;
     }
 
+    struct entry *table = mmap(NULL, SEGMENT_SIZE * sizeof(struct entry),
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+        exit(-1);
+    }
+
     pthread_mutex_lock(&entries_mutex);
-    void *tmp = realloc(this->entries, (this->size + ALLOC_SIZE) * sizeof(struct entry));
+    void *tmp = realloc(this->segments, (this->nb_segments + 1) * sizeof(struct segment));
     if (tmp != NULL) {
-        this->entries = tmp;
+        this->segments = tmp;
     } else {
         exit(-1);
     }
+    memset(&this->segments[this->nb_segments], 0, sizeof(struct segment));
+    this->segments[this->nb_segments].entries = table;
     pthread_mutex_unlock(&entries_mutex);
 
-    this->size += ALLOC_SIZE;
+    this->nb_segments++;
+    __atomic_add_fetch(&spill.memory, SEGMENT_SIZE * sizeof(struct entry), __ATOMIC_RELAXED);
+
+    check_memory(this);
+}
+
+/**
+ * Bump allocator in the blocks of the last segment: strings of a segment are
+ * contiguous so that they can be spilled along with it.
+ */
+static char * segment_alloc(struct segment *segment, size_t size)
+{
+    size = ROUND_UP(size, sizeof(uint64_t));
+
+    struct block *block = NULL;
+    if (segment->nb_blocks) {
+        block = &segment->blocks[segment->nb_blocks - 1];
+    }
+
+    if (block == NULL || block->used + size > block->size) {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t block_size = size > BLOCK_SIZE ? ROUND_UP(size, page_size) : BLOCK_SIZE;
+
+        char *data = mmap(NULL, block_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            exit(-1);
+        }
+
+        void *tmp = realloc(segment->blocks, (segment->nb_blocks + 1) * sizeof(struct block));
+        if (tmp == NULL) {
+            exit(-1);
+        }
+        segment->blocks = tmp;
+
+        block = &segment->blocks[segment->nb_blocks++];
+        block->data = data;
+        block->size = block_size;
+        block->used = 0;
+    }
+
+    char *ptr = block->data + block->used;
+    block->used += size;
+    __atomic_add_fetch(&spill.memory, size, __ATOMIC_RELAXED);
+
+    return ptr;
 }
 
 void entries_add(struct entries *this, const uint32_t line, const char *data)
+{
+    size_t data_size = strlen(data);
+
+    entries_add_window(this, line, data, data_size, data_size, 0, NULL, 0);
+}
+
+/**
+ * Add an entry holding only a window of size characters of the line, starting
+ * at offset. Length is the size of the whole line. Spans are the positions of
+ * the matches in the window.
+ */
+void entries_add_window(struct entries *this, const uint32_t line,
+                        const char *data, const uint32_t size,
+                        const uint32_t length, const uint32_t offset,
+                        const struct span *spans, const uint16_t nb_spans)
 {
     /* check size of entries */
     check_alloc(this);
 
-    /* copy input string */
-    size_t data_size = strlen(data);
-    char *data_copy = malloc(data_size + 1);
-    memcpy(data_copy, data, data_size);
-    data_copy[data_size] = 0;
+    /* copy spans and input string in a single allocation */
+    size_t spans_size = nb_spans * sizeof(struct span);
+    struct segment *segment = &this->segments[this->nb_entries >> SEGMENT_SHIFT];
+    char *block = segment_alloc(segment, spans_size + size + 1);
+    if (nb_spans) {
+        memcpy(block, spans, spans_size);
+    }
 
-    this->entries[this->nb_entries].line = line;
-    this->entries[this->nb_entries].data = data_copy;
-    this->nb_entries++;
+    char *data_copy = block + spans_size;
+    memcpy(data_copy, data, size);
+    data_copy[size] = 0;
+
+    struct entry *entry = ENTRY(this, this->nb_entries);
+    entry->line = line;
+    entry->data = data_copy;
+    entry->length = length;
+    entry->offset = offset;
+    entry->nb_spans = nb_spans;
+    entry->visited = 0;
+    entry->context = 0;
+
+    /* files count their lines so that they can be skipped at once */
     if (line != 0) {
+        ENTRY(this, this->last_file)->length++;
         this->nb_lines++;
+    } else {
+        entry->length = 0;
+        this->last_file = this->nb_entries;
+        this->nb_files++;
     }
+
+    this->nb_entries++;
+    this->end = this->nb_entries;
 }
 
-void entries_copy(struct entries *this, struct entry *copy)
+/**
+ * Add consecutive context lines starting at line first_line. Their strings
+ * are copied together in a single allocation.
+ */
+void entries_add_context(struct entries *this, const uint32_t first_line,
+                         const struct context_line *lines, const uint32_t nb_lines)
 {
-    /* check size of entries */
+    size_t total_size = 0;
+    uint32_t i = 0;
+
+    for (i = 0; i < nb_lines; i++) {
+        total_size += lines[i].size + 1;
+    }
+
+    /* copy everything before new segments may spill the current one */
     check_alloc(this);
+    struct segment *segment = &this->segments[this->nb_entries >> SEGMENT_SHIFT];
+    char *data_copy = segment_alloc(segment, total_size);
+
+    char *position = data_copy;
+    for (i = 0; i < nb_lines; i++) {
+        memcpy(position, lines[i].data, lines[i].size);
+        position[lines[i].size] = 0;
+        position += lines[i].size + 1;
+    }
 
-    this->entries[this->nb_entries].line = copy->line;
-    this->entries[this->nb_entries].data = copy->data;
-    this->entries[this->nb_entries].visited = copy->visited;
+    for (i = 0; i < nb_lines; i++) {
+        check_alloc(this);
+
+        struct entry *entry = ENTRY(this, this->nb_entries);
+        entry->line = first_line + i;
+        entry->data = data_copy;
+        entry->length = lines[i].length;
+        entry->offset = 0;
+        entry->nb_spans = 0;
+        entry->visited = 0;
+        entry->context = 1;
+
+        ENTRY(this, this->last_file)->length++;
+        data_copy += lines[i].size + 1;
+        this->nb_entries++;
+    }
 
-    this->nb_entries++;
-    if (copy->line != 0) {
-        this->nb_lines++;
+    this->end = this->nb_entries;
+}
+
+/* VIEWS **********************************************************************/
+/**
+ * Count the selected root entries of a view in [start, stop).
+ */
+static uint32_t count_bits(const uint64_t *bits, const uint32_t start,
+                           const uint32_t stop)
+{
+    uint32_t count = 0;
+    uint32_t position = start;
+
+    while (position < stop) {
+        uint32_t word = position / WORD_BITS;
+        uint64_t mask = ~0ULL << (position % WORD_BITS);
+
+        if (stop < (word + 1) * WORD_BITS) {
+            mask &= ~(~0ULL << (stop % WORD_BITS));
+        }
+
+        count += __builtin_popcountll(bits[word] & mask);
+        position = (word + 1) * WORD_BITS;
     }
+
+    return count;
+}
+
+/**
+ * Get the first root index from index selected by this, or end if there is
+ * none before end. Every root entry is selected by the root itself.
+ */
+uint32_t entries_next(const struct entries *this, const uint32_t index,
+                      const uint32_t end)
+{
+    if (this->root == NULL || index >= end) {
+        return index;
+    }
+
+    pthread_mutex_lock(&entries_mutex);
+    uint32_t word = index / WORD_BITS;
+    uint64_t bits = this->bits[word] & (~0ULL << (index % WORD_BITS));
+
+    while (bits == 0 && ++word * WORD_BITS < end) {
+        bits = this->bits[word];
+    }
+    pthread_mutex_unlock(&entries_mutex);
+
+    if (bits == 0) {
+        return end;
+    }
+
+    uint32_t next = word * WORD_BITS + __builtin_ctzll(bits);
+    return next < end ? next : end;
+}
+
+/**
+ * Make room in a view for the selection of root entries up to end.
+ */
+void entries_reserve(struct entries *this, const uint32_t end)
+{
+    uint32_t nb_rank_blocks = end / RANK_BLOCK_BITS + 1;
+    if (nb_rank_blocks <= this->nb_rank_blocks) {
+        return;
+    }
+
+    /* grow by half to avoid reallocating at each update */
+    nb_rank_blocks += nb_rank_blocks / 2;
+
+    pthread_mutex_lock(&entries_mutex);
+    uint64_t *bits = realloc(this->bits, nb_rank_blocks * RANK_BLOCK_WORDS * sizeof(uint64_t));
+    uint32_t *ranks = realloc(this->ranks, nb_rank_blocks * sizeof(uint32_t));
+    if (bits == NULL || ranks == NULL) {
+        exit(-1);
+    }
+
+    memset(bits + this->nb_rank_blocks * RANK_BLOCK_WORDS, 0,
+           (nb_rank_blocks - this->nb_rank_blocks) * RANK_BLOCK_WORDS * sizeof(uint64_t));
+    this->bits = bits;
+    this->ranks = ranks;
+    this->nb_rank_blocks = nb_rank_blocks;
+    pthread_mutex_unlock(&entries_mutex);
+}
+
+/**
+ * Select a root entry. Selections past the end of the view are only visible
+ * once published.
+ */
+void entries_select(struct entries *this, const uint32_t index)
+{
+    __atomic_fetch_or(&this->bits[index / WORD_BITS],
+                      1ULL << (index % WORD_BITS), __ATOMIC_RELAXED);
+}
+
+/**
+ * Make the selection of root entries up to end visible. File file_index was
+ * found before the published part and is selected first if need be: since
+ * only lines of that file follow it, it still comes after every selected
+ * entry.
+ */
+void entries_publish(struct entries *this, const uint32_t end,
+                     const uint32_t nb_lines, const uint32_t file_index)
+{
+    pthread_mutex_lock(&entries_mutex);
+
+    if (file_index != NO_FILE &&
+        !(this->bits[file_index / WORD_BITS] & (1ULL << (file_index % WORD_BITS)))) {
+        entries_select(this, file_index);
+        this->nb_entries++;
+
+        uint32_t block = 0;
+        for (block = file_index / RANK_BLOCK_BITS + 1; block <= this->end / RANK_BLOCK_BITS; block++) {
+            this->ranks[block]++;
+        }
+    }
+
+    /* count selected entries and rank blocks up to end */
+    uint32_t position = this->end;
+    while (position < end) {
+        uint32_t block_end = (position / RANK_BLOCK_BITS + 1) * RANK_BLOCK_BITS;
+        uint32_t stop = block_end < end ? block_end : end;
+
+        this->nb_entries += count_bits(this->bits, position, stop);
+        position = stop;
+
+        if (position == block_end) {
+            this->ranks[position / RANK_BLOCK_BITS] = this->nb_entries;
+        }
+    }
+
+    this->end = end;
+    this->nb_lines += nb_lines;
+
+    pthread_mutex_unlock(&entries_mutex);
+}
+
+/**
+ * Select and publish the root entries added since the last call, for a view
+ * showing every entry of its root but the ones unselected from it.
+ */
+void entries_follow(struct entries *this)
+{
+    pthread_mutex_lock(&entries_mutex);
+    uint32_t end = this->root->end;
+    pthread_mutex_unlock(&entries_mutex);
+
+    if (end == this->end) {
+        return;
+    }
+    entries_reserve(this, end);
+
+    uint32_t nb_lines = 0;
+    uint32_t i = 0;
+
+    pthread_mutex_lock(&entries_mutex);
+    for (i = this->end; i < end; i++) {
+        const struct entry *entry = ENTRY(this->root, i);
+
+        nb_lines += entry->line && !entry->context;
+        entries_select(this, i);
+    }
+    pthread_mutex_unlock(&entries_mutex);
+
+    entries_publish(this, end, nb_lines, NO_FILE);
+}
+
+/**
+ * Remove the published root entries in [start, stop) from a view, the
+ * following ones move up. Context lines count as lines if count_context is
+ * set, as they do in views matching them.
+ */
+void entries_unselect(struct entries *this, const uint32_t start, uint32_t stop,
+                      const uint8_t count_context)
+{
+    uint32_t nb_removed = 0;
+    uint32_t i = 0;
+
+    pthread_mutex_lock(&entries_mutex);
+    if (stop > this->end) {
+        stop = this->end;
+    }
+
+    for (i = start; i < stop; i++) {
+        uint64_t bit = 1ULL << (i % WORD_BITS);
+        if (!(this->bits[i / WORD_BITS] & bit)) {
+            continue;
+        }
+
+        const struct entry *entry = ENTRY(this->root, i);
+        this->bits[i / WORD_BITS] &= ~bit;
+        this->nb_lines -= entry->line && (!entry->context || count_context);
+        nb_removed++;
+    }
+
+    /* count the rank blocks again from the first one changed */
+    if (nb_removed) {
+        uint32_t block = 0;
+        for (block = start / RANK_BLOCK_BITS + 1; block <= this->end / RANK_BLOCK_BITS; block++) {
+            this->ranks[block] = this->ranks[block - 1] +
+                count_bits(this->bits, (block - 1) * RANK_BLOCK_BITS, block * RANK_BLOCK_BITS);
+        }
+
+        this->nb_entries -= nb_removed;
+        this->nb_removals++;
+    }
+
+    pthread_mutex_unlock(&entries_mutex);
 }
 
 
@@ -161,26 +855,89 @@ void entries_copy(struct entries *this, struct entry *copy)
 struct entries * entries_new(void)
 {
     struct entries *this = calloc(1, sizeof(struct entries));
+    pthread_cond_init(&this->updated, NULL);
+
+    return this;
+}
 
-    this->entries = calloc(ALLOC_SIZE, sizeof(struct entry));
-    this->size = ALLOC_SIZE;
+/**
+ * Create an empty view on the root store of parent.
+ */
+struct entries * entries_new_view(struct entries *parent)
+{
+    struct entries *this = entries_new();
+
+    this->root = parent->root ? parent->root : parent;
+    this->ranks = calloc(1, sizeof(uint32_t));
+    this->bits = calloc(RANK_BLOCK_WORDS, sizeof(uint64_t));
+    this->nb_rank_blocks = 1;
 
     return this;
 }
 
-void entries_delete_copy(struct entries *this)
+/**
+ * Create a store over a table of entries mapped from a saved result set. The
+ * mapping is released along with the store.
+ */
+struct entries * entries_new_mapped(struct entry *table, const uint32_t nb_entries,
+                                    void *mapping, const size_t mapping_size)
 {
-    free(this->entries);
-    free(this);
+    struct entries *this = entries_new();
+    uint32_t i = 0;
+
+    this->nb_segments = (nb_entries + SEGMENT_SIZE - 1) >> SEGMENT_SHIFT;
+    this->segments = calloc(this->nb_segments, sizeof(struct segment));
+    for (i = 0; i < this->nb_segments; i++) {
+        this->segments[i].entries = table + ((size_t) i << SEGMENT_SHIFT);
+    }
+
+    for (i = 0; i < nb_entries; i++) {
+        if (table[i].line == 0) {
+            this->last_file = i;
+            this->nb_files++;
+        } else if (!table[i].context) {
+            this->nb_lines++;
+        }
+    }
+
+    this->nb_entries = nb_entries;
+    this->end = nb_entries;
+    this->first_in_memory = this->nb_segments;
+    this->mapping = mapping;
+    this->mapping_size = mapping_size;
+
+    return this;
 }
 
 void entries_delete(struct entries *this)
 {
     uint32_t i = 0;
-    for (i = 0; i < this->nb_entries; i++) {
-        free(this->entries[i].data);
+    uint32_t j = 0;
+
+    if (this->mapping) {
+        munmap(this->mapping, this->mapping_size);
+        this->nb_segments = 0;
+    }
+
+    for (i = 0; i < this->nb_segments; i++) {
+        struct segment *segment = &this->segments[i];
+        size_t released = segment->entries_spilled ? 0 : SEGMENT_SIZE * sizeof(struct entry);
+
+        for (j = 0; j < segment->nb_blocks; j++) {
+            munmap(segment->blocks[j].data, segment->blocks[j].size);
+            if (!segment->blocks[j].spilled) {
+                released += segment->blocks[j].used;
+            }
+        }
+        munmap(segment->entries, SEGMENT_SIZE * sizeof(struct entry));
+
+        __atomic_sub_fetch(&spill.memory, released, __ATOMIC_RELAXED);
+        free(segment->blocks);
     }
 
-    free(this->entries);
+    pthread_cond_destroy(&this->updated);
+    free(this->bits);
+    free(this->ranks);
+    free(this->segments);
     free(this);
 }
@@ -0,0 +1,546 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "export.h"
+#include "file_utils.h"
+
+
+#define EXPORT_CHUNK_SIZE   4096            // entries copied with the lock taken once
+#define EXPORT_BUFFER_SIZE  (256 * 1024)
+#define MAX_OUTPUTS         1000            // ngp.out, ngp.1.out, ... ngp.999.out
+
+#define RESULTS_MAGIC       "NGPRSLT"
+#define RESULTS_VERSION     1
+#define RESULTS_ALIGN       8
+
+
+/**
+ * Binary result sets start with this header, followed by the table of entries
+ * as they are in memory except that data holds an offset in the blob of
+ * strings. Spans are stored in the blob right before the data, as in memory.
+ * The header is written last so that an incomplete file is never loaded.
+ */
+struct results_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t nb_entries;
+    uint32_t flags;
+    uint32_t context_before;
+    uint32_t context_after;
+    uint64_t table_offset;
+    uint64_t blob_offset;
+    uint64_t blob_size;
+    uint64_t pattern;       // offsets in the blob of the search pattern and directory
+    uint64_t directory;
+};
+
+enum results_flags {
+    results_insensitive = 1 << 0,
+    results_regex = 1 << 1,
+};
+
+/**
+ * Writes are gathered in a buffer, at increasing offsets from the start of
+ * the output.
+ */
+struct writer {
+    int fd;
+    off_t offset;           // offset of the buffer in the file
+    char *buffer;
+    size_t used;
+};
+
+/**
+ * Entries of a snapshot of a view are written to a new file by a thread, so
+ * that the display can go on while large result sets are saved.
+ */
+struct export {
+    struct entries *entries;
+    enum export_format format;
+    char *path;
+    pthread_t thread;
+    uint32_t nb_entries;    // entries when the export started
+    uint32_t nb_done;
+    uint8_t status;         // running
+    uint8_t started;        // if the thread was created
+    uint8_t failed;
+    uint8_t stop;
+
+    /* search of the results, saved in binary result sets */
+    char *pattern;
+    char *directory;
+    uint32_t flags;
+    uint32_t context_before;
+    uint32_t context_after;
+};
+
+
+/* WRITER *********************************************************************/
+static uint8_t write_at(const int fd, const void *data, const size_t size, const off_t offset)
+{
+    size_t written = 0;
+
+    while (written < size) {
+        ssize_t ret = pwrite(fd, (const char *) data + written, size - written,
+                             offset + written);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return EXIT_FAILURE;
+        }
+        written += ret;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static uint8_t writer_flush(struct writer *this)
+{
+    if (write_at(this->fd, this->buffer, this->used, this->offset) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    this->offset += this->used;
+    this->used = 0;
+
+    return EXIT_SUCCESS;
+}
+
+static uint8_t writer_write(struct writer *this, const void *data, const size_t size)
+{
+    if (this->used + size > EXPORT_BUFFER_SIZE && writer_flush(this) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    /* large writes don't go through the buffer */
+    if (size > EXPORT_BUFFER_SIZE) {
+        if (write_at(this->fd, data, size, this->offset) == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+        this->offset += size;
+        return EXIT_SUCCESS;
+    }
+
+    memcpy(this->buffer + this->used, data, size);
+    this->used += size;
+
+    return EXIT_SUCCESS;
+}
+
+static uint64_t writer_position(const struct writer *this)
+{
+    return this->offset + this->used;
+}
+
+static uint8_t writer_align(struct writer *this)
+{
+    static const char zeros[RESULTS_ALIGN] = {0};
+    uint64_t position = writer_position(this);
+
+    return writer_write(this, zeros, ROUND_UP(position, RESULTS_ALIGN) - position);
+}
+
+
+/* FORMATS ********************************************************************/
+/**
+ * Create the first of ngp.<extension>, ngp.1.<extension>... that doesn't
+ * exist yet, previous exports are never overwritten.
+ */
+static int open_output(struct export *this)
+{
+    const char *extension = this->format == export_format_binary ? "res" : "out";
+    char path[PATH_MAX];
+    uint32_t i = 0;
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if (i == 0) {
+            snprintf(path, sizeof(path), "ngp.%s", extension);
+        } else {
+            snprintf(path, sizeof(path), "ngp.%u.%s", i, extension);
+        }
+
+        int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            this->path = strdup(path);
+            return fd;
+        }
+        if (errno != EEXIST) {
+            break;
+        }
+    }
+
+    return -1;
+}
+
+static void report_progress(struct export *this, const uint32_t nb_done)
+{
+    __atomic_store_n(&this->nb_done, nb_done, __ATOMIC_RELAXED);
+    entries_notify(this->entries);
+}
+
+static uint8_t export_text(struct export *this, struct writer *writer, struct entry *chunk)
+{
+    uint32_t index = 0;
+    uint32_t i = 0;
+
+    while (index < this->nb_entries && !__atomic_load_n(&this->stop, __ATOMIC_RELAXED)) {
+        uint32_t nb = entries_copy(this->entries, index, EXPORT_CHUNK_SIZE, chunk);
+        if (nb == 0) {
+            break;
+        }
+        if (nb > this->nb_entries - index) {
+            nb = this->nb_entries - index;
+        }
+
+        for (i = 0; i < nb; i++) {
+            if (writer_write(writer, chunk[i].data, strlen(chunk[i].data)) == EXIT_FAILURE ||
+                writer_write(writer, "\n", 1) == EXIT_FAILURE) {
+                return EXIT_FAILURE;
+            }
+        }
+
+        index += nb;
+        report_progress(this, index);
+    }
+
+    if (__atomic_load_n(&this->stop, __ATOMIC_RELAXED)) {
+        return EXIT_FAILURE;
+    }
+
+    return writer_flush(writer);
+}
+
+/**
+ * Files count the lines that follow them in the export, which are not those
+ * of the store when exporting a view. The count of a file is known once the
+ * next file starts, its entry is written again then if its chunk is gone.
+ */
+struct file_count {
+    struct entry entry;
+    uint32_t index;
+    uint8_t valid;
+};
+
+static uint8_t close_file(const struct file_count *file, const int fd,
+                          const uint64_t table_offset, struct entry *chunk,
+                          const uint32_t chunk_start)
+{
+    if (!file->valid) {
+        return EXIT_SUCCESS;
+    }
+
+    if (file->index >= chunk_start) {
+        chunk[file->index - chunk_start] = file->entry;
+        return EXIT_SUCCESS;
+    }
+
+    return write_at(fd, &file->entry, sizeof(struct entry),
+                    table_offset + (uint64_t) file->index * sizeof(struct entry));
+}
+
+static uint8_t export_binary(struct export *this, struct writer *writer, struct entry *chunk)
+{
+    struct results_header header;
+    struct file_count file;
+    uint32_t index = 0;
+    uint32_t i = 0;
+
+    memset(&header, 0, sizeof(header));
+    memset(&file, 0, sizeof(file));
+
+    header.table_offset = ROUND_UP(sizeof(struct results_header), 64);
+    header.blob_offset = header.table_offset + (uint64_t) this->nb_entries * sizeof(struct entry);
+    writer->offset = header.blob_offset;
+
+    while (index < this->nb_entries) {
+        if (__atomic_load_n(&this->stop, __ATOMIC_RELAXED)) {
+            return EXIT_FAILURE;
+        }
+
+        uint32_t nb = entries_copy(this->entries, index, EXPORT_CHUNK_SIZE, chunk);
+        if (nb == 0) {
+            break;
+        }
+        if (nb > this->nb_entries - index) {
+            nb = this->nb_entries - index;
+        }
+
+        for (i = 0; i < nb; i++) {
+            struct entry *entry = &chunk[i];
+            size_t spans_size = entry->nb_spans * sizeof(struct span);
+
+            if (writer_align(writer) == EXIT_FAILURE ||
+                writer_write(writer, entry_get_spans(entry), spans_size) == EXIT_FAILURE) {
+                return EXIT_FAILURE;
+            }
+
+            uint64_t data_offset = writer_position(writer) - header.blob_offset;
+            if (writer_write(writer, entry->data, strlen(entry->data) + 1) == EXIT_FAILURE) {
+                return EXIT_FAILURE;
+            }
+            entry->data = (char *) (uintptr_t) data_offset;
+            entry->visited = 0;
+
+            if (entry->line == 0) {
+                if (close_file(&file, writer->fd, header.table_offset, chunk, index) == EXIT_FAILURE) {
+                    return EXIT_FAILURE;
+                }
+                entry->length = 0;
+                file.entry = *entry;
+                file.index = index + i;
+                file.valid = 1;
+            } else {
+                file.entry.length++;
+            }
+        }
+
+        /* the count of the last file so far is written again when it ends */
+        if (close_file(&file, writer->fd, header.table_offset, chunk, index) == EXIT_FAILURE ||
+            write_at(writer->fd, chunk, nb * sizeof(struct entry),
+                     header.table_offset + (uint64_t) index * sizeof(struct entry)) == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+
+        index += nb;
+        report_progress(this, index);
+    }
+
+    if (close_file(&file, writer->fd, header.table_offset, chunk, index) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    header.pattern = writer_position(writer) - header.blob_offset;
+    if (writer_write(writer, this->pattern, strlen(this->pattern) + 1) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    header.directory = writer_position(writer) - header.blob_offset;
+    if (writer_write(writer, this->directory, strlen(this->directory) + 1) == EXIT_FAILURE ||
+        writer_flush(writer) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    memcpy(header.magic, RESULTS_MAGIC, sizeof(header.magic));
+    header.version = RESULTS_VERSION;
+    header.entry_size = sizeof(struct entry);
+    header.nb_entries = index;
+    header.flags = this->flags;
+    header.context_before = this->context_before;
+    header.context_after = this->context_after;
+    header.blob_size = writer_position(writer) - header.blob_offset;
+
+    return write_at(writer->fd, &header, sizeof(header), 0);
+}
+
+static void * export_thread(void *context)
+{
+    struct export *this = (struct export *) context;
+    struct writer writer = {0};
+    uint8_t status = EXIT_FAILURE;
+
+    writer.fd = open_output(this);
+    if (writer.fd >= 0) {
+        writer.buffer = malloc(EXPORT_BUFFER_SIZE);
+        struct entry *chunk = malloc(EXPORT_CHUNK_SIZE * sizeof(struct entry));
+
+        if (this->format == export_format_binary) {
+            status = export_binary(this, &writer, chunk);
+        } else {
+            status = export_text(this, &writer, chunk);
+        }
+
+        /* don't leave incomplete exports behind */
+        close(writer.fd);
+        if (status == EXIT_FAILURE) {
+            unlink(this->path);
+        }
+
+        free(chunk);
+        free(writer.buffer);
+    }
+
+    this->failed = status == EXIT_FAILURE;
+    __atomic_store_n(&this->status, 0, __ATOMIC_RELEASE);
+    entries_notify(this->entries);
+
+    return NULL;
+}
+
+
+/* API ************************************************************************/
+uint8_t export_get_status(const struct export *this)
+{
+    return __atomic_load_n(&this->status, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Only meaningful once the export is done.
+ */
+uint8_t export_get_failed(const struct export *this)
+{
+    return this->failed;
+}
+
+/**
+ * Percentage of the entries written.
+ */
+uint32_t export_get_progress(const struct export *this)
+{
+    if (this->nb_entries == 0) {
+        return 100;
+    }
+
+    uint64_t nb_done = __atomic_load_n(&this->nb_done, __ATOMIC_RELAXED);
+    return nb_done * 100 / this->nb_entries;
+}
+
+/**
+ * Path of the output, set once the export is done.
+ */
+const char * export_get_path(const struct export *this)
+{
+    return this->path;
+}
+
+struct entries * export_get_entries(const struct export *this)
+{
+    return this->entries;
+}
+
+/**
+ * Abort the export, the output is removed.
+ */
+void export_stop(struct export *this)
+{
+    __atomic_store_n(&this->stop, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Map a binary result set as a store of entries, and set the search of the
+ * results in config. Returns NULL if the file is not a complete result set.
+ */
+struct entries * export_load(const char *path, struct config *config)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || (size_t) sb.st_size < sizeof(struct results_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    /* the table is relocated in place, pages of strings stay shared */
+    size_t size = sb.st_size;
+    char *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct results_header *header = (struct results_header *) data;
+    if (memcmp(header->magic, RESULTS_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != RESULTS_VERSION ||
+        header->entry_size != sizeof(struct entry) ||
+        header->table_offset % RESULTS_ALIGN != 0 ||
+        header->blob_offset < header->table_offset +
+                              (uint64_t) header->nb_entries * sizeof(struct entry) ||
+        header->blob_offset > size || header->blob_size == 0 ||
+        header->blob_size > size - header->blob_offset ||
+        header->pattern >= header->blob_size || header->directory >= header->blob_size) {
+        munmap(data, size);
+        return NULL;
+    }
+
+    char *blob = data + header->blob_offset;
+    struct entry *table = (struct entry *) (data + header->table_offset);
+    uint32_t i = 0;
+
+    /* strings are nul terminated up to the end of the blob */
+    uint8_t valid = blob[header->blob_size - 1] == 0 &&
+                    (header->nb_entries == 0 || table[0].line == 0);
+    for (i = 0; valid && i < header->nb_entries; i++) {
+        uintptr_t offset = (uintptr_t) table[i].data;
+        if (offset >= header->blob_size ||
+            offset < table[i].nb_spans * sizeof(struct span)) {
+            valid = 0;
+            break;
+        }
+        table[i].data = blob + offset;
+    }
+
+    if (!valid) {
+        munmap(data, size);
+        return NULL;
+    }
+
+    free(config->pattern);
+    free(config->directory);
+    config->pattern = strdup(blob + header->pattern);
+    config->directory = strdup(blob + header->directory);
+    config->insensitive_search = !!(header->flags & results_insensitive);
+    config->regex_search = !!(header->flags & results_regex);
+    config->context_before = header->context_before;
+    config->context_after = header->context_after;
+
+    return entries_new_mapped(table, header->nb_entries, data, size);
+}
+
+
+/* CONSTRUCTOR ****************************************************************/
+/**
+ * Start writing the entries in a new file. Entries added from now on are not
+ * part of the export.
+ */
+struct export * export_new(struct entries *entries, const struct search *search,
+                           const enum export_format format)
+{
+    struct export *this = calloc(1, sizeof(struct export));
+
+    this->entries = entries;
+    this->format = format;
+    this->nb_entries = entries_get_nb_entries(entries);
+    this->pattern = strdup(search->pattern);
+    this->directory = strdup(search->directory);
+    this->flags = (search->case_insensitive ? results_insensitive : 0) |
+                  (search->regex_search ? results_regex : 0);
+    this->context_before = search->context_before;
+    this->context_after = search->context_after;
+    this->status = 1;
+
+    if (pthread_create(&this->thread, NULL, export_thread, this) == 0) {
+        this->started = 1;
+    } else {
+        this->status = 0;
+        this->failed = 1;
+    }
+
+    return this;
+}
+
+/**
+ * Wait for the export to be done, and free it.
+ */
+void export_delete(struct export *this)
+{
+    if (this->started) {
+        pthread_join(this->thread, NULL);
+    }
+
+    free(this->directory);
+    free(this->pattern);
+    free(this->path);
+    free(this);
+}
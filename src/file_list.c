@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <dirent.h>
+
+#include "file_list.h"
+#include "file_utils.h"
+#include "ignore.h"
+#include "tree.h"
+
+
+/* CRAWL **********************************************************************/
+/**
+ * Add the files under directory that a search would look into: same
+ * extensions, excluded directories, ignore files and symlinks rules. Path is
+ * the buffer holding directory, of length length, root_length is the part of
+ * it left out of the list.
+ */
+static void crawl_directory(struct file_list *this, char *path, size_t length,
+                            const size_t root_length, const struct config *config,
+                            const struct ignore *parent)
+{
+    DIR *dir_stream = opendir(path);
+    if (dir_stream == NULL) {
+        return;
+    }
+
+    struct ignore *rules = config->no_ignore ? NULL : ignore_new(parent, path, length);
+    const struct ignore *ignore = rules ? rules : parent;
+
+    size_t relative_length = length > root_length ? length - root_length : 0;
+    file_list_add(this->directories, &path[length - relative_length], relative_length, 0);
+
+    if (path[length - 1] != '/') {
+        path[length++] = '/';
+    }
+
+    struct dirent *dir_entry = NULL;
+    while ((dir_entry = readdir(dir_stream)) != NULL) {
+        char *name = dir_entry->d_name;
+        size_t name_length = strlen(name);
+
+        if (length + name_length >= PATH_MAX) {
+            continue;
+        }
+        memcpy(&path[length], name, name_length + 1);
+
+        if (dir_entry->d_type == DT_DIR) {
+            if (!is_string_in_tree_size(config->dir_exclusion_tree, name, name_length) &&
+                !(ignore && ignore_match(ignore, path, length + name_length, 1))) {
+                crawl_directory(this, path, length + name_length, root_length, config, ignore);
+            }
+            continue;
+        }
+
+        uint8_t flags = 0;
+        if (dir_entry->d_type == DT_REG) {
+            flags = 0;
+        } else if ((dir_entry->d_type & DT_LNK) && config->follow_symlinks) {
+            flags = file_list_symlink;
+        } else {
+            continue;
+        }
+
+        if (!config->raw_search &&
+            !file_utils_check_extension(name, config->file_extensions_tree)) {
+            continue;
+        }
+
+        if (ignore && ignore_match(ignore, path, length + name_length, 0)) {
+            continue;
+        }
+
+        file_list_add(this, &path[root_length], length + name_length - root_length, flags);
+    }
+
+    closedir(dir_stream);
+    if (rules) {
+        ignore_delete(rules);
+    }
+}
+
+
+/* API ************************************************************************/
+void file_list_add(struct file_list *this, const char *path, const size_t length,
+                   const uint8_t flags)
+{
+    if (this->nb_files == this->max_files) {
+        this->max_files = this->max_files ? 2 * this->max_files : 1024;
+        this->offsets = realloc(this->offsets, this->max_files * sizeof(size_t));
+        this->flags = realloc(this->flags, this->max_files * sizeof(uint8_t));
+    }
+
+    if (this->size + length + 1 > this->capacity) {
+        while (this->size + length + 1 > this->capacity) {
+            this->capacity = this->capacity ? 2 * this->capacity : 64 * 1024;
+        }
+        this->paths = realloc(this->paths, this->capacity);
+    }
+
+    memcpy(this->paths + this->size, path, length);
+    this->paths[this->size + length] = 0;
+
+    this->offsets[this->nb_files] = this->size;
+    this->flags[this->nb_files] = flags;
+    this->nb_files++;
+    this->size += length + 1;
+}
+
+const char * file_list_get_path(const struct file_list *this, const uint32_t index)
+{
+    return this->paths + this->offsets[index];
+}
+
+uint8_t file_list_get_flags(const struct file_list *this, const uint32_t index)
+{
+    return this->flags[index];
+}
+
+uint32_t file_list_get_nb_files(const struct file_list *this)
+{
+    return this->nb_files;
+}
+
+/**
+ * Add the files under root, as paths relative to it.
+ */
+uint8_t file_list_crawl(struct file_list *this, const char *root,
+                        const struct config *config)
+{
+    char path[PATH_MAX];
+    size_t length = strlen(root);
+
+    if (length == 0 || length >= PATH_MAX - 1 || !file_utils_is_dir(root)) {
+        return EXIT_FAILURE;
+    }
+    memcpy(path, root, length + 1);
+
+    if (this->directories == NULL) {
+        this->directories = file_list_new();
+    }
+
+    /* paths start after the separator following the root */
+    size_t root_length = root[length - 1] == '/' ? length : length + 1;
+    crawl_directory(this, path, length, root_length, config, NULL);
+
+    return EXIT_SUCCESS;
+}
+
+
+/* CONSTRUCTOR ****************************************************************/
+struct file_list * file_list_new(void)
+{
+    return calloc(1, sizeof(struct file_list));
+}
+
+void file_list_delete(struct file_list *this)
+{
+    if (this->directories) {
+        file_list_delete(this->directories);
+    }
+    free(this->paths);
+    free(this->offsets);
+    free(this->flags);
+    free(this);
+}
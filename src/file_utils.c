@@ -1,5 +1,9 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -70,3 +74,112 @@ uint8_t file_utils_check_extension(const char *file_name, const struct tree *fil
 
     return 0;
 }
+
+/**
+ * Build the path of a cache file of a root directory, named after a hash of
+ * its real path, in $XDG_CACHE_HOME/ngp or ~/.cache/ngp. The directories are
+ * created if asked.
+ */
+uint8_t file_utils_cache_path(const char *real_root, const char *extension,
+                              char *path, const size_t size, const uint8_t create)
+{
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char directory[PATH_MAX];
+    int length = 0;
+
+    if (cache_home && cache_home[0] == '/') {
+        length = snprintf(directory, sizeof(directory), "%s/ngp", cache_home);
+    } else if (home) {
+        length = snprintf(directory, sizeof(directory), "%s/.cache", home);
+        if (create && length > 0 && (size_t) length < sizeof(directory)) {
+            mkdir(directory, 0700);
+        }
+        length = snprintf(directory, sizeof(directory), "%s/.cache/ngp", home);
+    } else {
+        return EXIT_FAILURE;
+    }
+
+    if (length < 0 || (size_t) length >= sizeof(directory)) {
+        return EXIT_FAILURE;
+    }
+
+    if (create) {
+        mkdir(directory, 0700);
+    }
+
+    uint64_t hash = file_utils_hash(FILE_UTILS_HASH_SEED, real_root, strlen(real_root));
+
+    length = snprintf(path, size, "%s/%016llx.%s", directory, (unsigned long long) hash, extension);
+    if (length < 0 || (size_t) length >= size) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Hash size bytes of data with FNV-1a, from hash.
+ */
+uint64_t file_utils_hash(uint64_t hash, const void *data, const size_t size)
+{
+    const uint8_t *bytes = data;
+    size_t i = 0;
+
+    for (i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * Mix a value in a hash, as FNV-1a does a byte.
+ */
+uint64_t file_utils_hash_value(const uint64_t hash, const uint64_t value)
+{
+    return (hash ^ value) * 0x100000001b3ULL;
+}
+
+/**
+ * Open a temporary file next to path, named in tmp_path of size size, to be
+ * renamed over it by file_utils_commit_temporary once written whole: readers
+ * of path never map a partial file.
+ */
+FILE * file_utils_create_temporary(const char *path, char *tmp_path, const size_t size)
+{
+    int length = snprintf(tmp_path, size, "%s.%d", path, (int) getpid());
+    if (length < 0 || (size_t) length >= size) {
+        return NULL;
+    }
+
+    return fopen(tmp_path, "w");
+}
+
+uint8_t file_utils_write_padding(FILE *output, const size_t size)
+{
+    static const char zeros[8] = {0};
+
+    return fwrite(zeros, 1, size, output) == size ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Close a temporary file and rename it over path if it was written with
+ * status EXIT_SUCCESS, remove it otherwise. Returns the final status.
+ */
+uint8_t file_utils_commit_temporary(FILE *output, const char *tmp_path, const char *path,
+                                    uint8_t status)
+{
+    if (fclose(output) != 0) {
+        status = EXIT_FAILURE;
+    }
+
+    if (status == EXIT_SUCCESS && rename(tmp_path, path) < 0) {
+        status = EXIT_FAILURE;
+    }
+    if (status == EXIT_FAILURE) {
+        unlink(tmp_path);
+    }
+
+    return status;
+}
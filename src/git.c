@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "git.h"
+#include "file_utils.h"
+
+
+#define INDEX_SIGNATURE     "DIRC"
+#define INDEX_HEADER_SIZE   12      // signature, version, number of entries
+#define STAT_DATA_SIZE      40      // ctime, mtime, dev, ino, mode, uid, gid, size
+#define SHA1_SIZE           20
+#define SHA256_SIZE         32
+
+#define FLAG_EXTENDED       0x4000
+#define FLAG_STAGE          0x3000
+#define FLAG_SKIP_WORKTREE  0x4000  // of the extended flags, the file isn't checked out
+
+#define MODE_TYPE           0170000
+#define MODE_FILE           0100000
+#define MODE_SYMLINK        0120000
+
+
+/**
+ * Index of a git checkout, mapped: a header, the entries sorted by path, then
+ * extensions and a checksum. Each entry holds the stat data of the file when
+ * it was last staged, its object id, flags and its path, which version 4
+ * compresses as the part of the previous path kept and a new suffix.
+ */
+struct git_index {
+    const uint8_t *data;
+    const uint8_t *end;         // of the entries and extensions, before the checksum
+    uint32_t version;
+    uint32_t nb_entries;
+    size_t hash_size;
+};
+
+
+/* UTILS **********************************************************************/
+static uint32_t get_be32(const uint8_t *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static uint16_t get_be16(const uint8_t *p)
+{
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+/**
+ * Read a small file whole, nul terminated. Returns NULL if it can't be read.
+ */
+static char * read_file(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    char *contents = malloc(sb.st_size + 1);
+    ssize_t size = read(fd, contents, sb.st_size);
+    close(fd);
+    if (size < 0) {
+        free(contents);
+        return NULL;
+    }
+    contents[size] = '\0';
+
+    return contents;
+}
+
+
+/* REPOSITORY *****************************************************************/
+/**
+ * Find the checkout holding a directory, from its real path: the length of
+ * the path of the root of the checkout, and its git directory in a buffer of
+ * size PATH_MAX. .git is either the git directory or a file pointing to it,
+ * for worktrees and submodules.
+ */
+static uint8_t find_git_directory(const char *real_directory, size_t *root_length,
+                                  char *git_directory)
+{
+    size_t length = strlen(real_directory);
+
+    while (1) {
+        struct stat sb;
+        int size = snprintf(git_directory, PATH_MAX, "%.*s/.git", (int) length, real_directory);
+        if (size >= PATH_MAX || lstat(git_directory, &sb) < 0) {
+            sb.st_mode = 0;
+        }
+
+        if (S_ISDIR(sb.st_mode)) {
+            *root_length = length;
+            return EXIT_SUCCESS;
+        }
+
+        if (S_ISREG(sb.st_mode)) {
+            char *link = read_file(git_directory);
+            if (link == NULL || strncmp(link, "gitdir: ", 8) != 0) {
+                free(link);
+                return EXIT_FAILURE;
+            }
+
+            char *target = link + 8;
+            target[strcspn(target, "\r\n")] = '\0';
+            if (target[0] == '/') {
+                size = snprintf(git_directory, PATH_MAX, "%s", target);
+            } else {
+                size = snprintf(git_directory, PATH_MAX, "%.*s/%s", (int) length,
+                                real_directory, target);
+            }
+            free(link);
+
+            *root_length = length;
+            return size < PATH_MAX ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if (length == 0) {
+            return EXIT_FAILURE;
+        }
+
+        /* parent directory, "" for / */
+        while (length && real_directory[length - 1] != '/') {
+            length--;
+        }
+        length--;
+    }
+}
+
+/**
+ * Size of the object ids of the repository, SHA-256 ones if its config says
+ * so. Worktrees share the config of the main repository.
+ */
+static size_t get_hash_size(const char *git_directory)
+{
+    char path[PATH_MAX];
+    char *common = NULL;
+    char *config = NULL;
+    size_t hash_size = SHA1_SIZE;
+    int size = 0;
+
+    if (snprintf(path, sizeof(path), "%s/commondir", git_directory) >= PATH_MAX) {
+        return hash_size;
+    }
+
+    common = read_file(path);
+    if (common) {
+        common[strcspn(common, "\r\n")] = '\0';
+        if (common[0] == '/') {
+            size = snprintf(path, sizeof(path), "%s/config", common);
+        } else {
+            size = snprintf(path, sizeof(path), "%s/%s/config", git_directory, common);
+        }
+        free(common);
+    } else {
+        size = snprintf(path, sizeof(path), "%s/config", git_directory);
+    }
+
+    config = size < PATH_MAX ? read_file(path) : NULL;
+    const char *format = config ? strcasestr(config, "objectformat") : NULL;
+    if (format) {
+        format += strlen("objectformat");
+        format += strspn(format, " \t=");
+        if (strncasecmp(format, "sha256", 6) == 0) {
+            hash_size = SHA256_SIZE;
+        }
+    }
+    free(config);
+
+    return hash_size;
+}
+
+
+/* INDEX **********************************************************************/
+static uint8_t index_open(struct git_index *this, const uint8_t *data, const size_t size,
+                          const size_t hash_size)
+{
+    if (size < INDEX_HEADER_SIZE + hash_size ||
+        memcmp(data, INDEX_SIGNATURE, strlen(INDEX_SIGNATURE)) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    this->data = data;
+    this->end = data + size - hash_size;
+    this->version = get_be32(data + 4);
+    this->nb_entries = get_be32(data + 8);
+    this->hash_size = hash_size;
+
+    return this->version >= 2 && this->version <= 4 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Read the number of bytes of the previous path left out of the path of a
+ * version 4 entry, a varint the way git encodes offsets. Returns the position
+ * past it, NULL if it's truncated.
+ */
+static const uint8_t * read_strip(const uint8_t *p, const uint8_t *end, size_t *strip)
+{
+    if (p >= end) {
+        return NULL;
+    }
+
+    uint8_t byte = *p++;
+    size_t value = byte & 0x7f;
+
+    while (byte & 0x80) {
+        if (p >= end || value >= PATH_MAX) {
+            return NULL;
+        }
+        byte = *p++;
+        value = ((value + 1) << 7) | (byte & 0x7f);
+    }
+
+    *strip = value;
+    return p;
+}
+
+/**
+ * Add the files of the index under the prefix to the list, relative to it.
+ * Their type is told by the mode of the entries, without looking at them:
+ * submodules, files left out of a sparse checkout and the stages of a
+ * conflict but the first are skipped. Returns EXIT_FAILURE if the index is
+ * corrupt, or split and missing entries.
+ */
+static uint8_t index_list(const struct git_index *this, const char *prefix,
+                          struct file_list *list)
+{
+    size_t prefix_length = strlen(prefix);
+    const uint8_t *position = this->data + INDEX_HEADER_SIZE;
+    size_t entry_header_size = STAT_DATA_SIZE + this->hash_size + 2;
+    char path[PATH_MAX];
+    size_t length = 0;
+    char conflicted[PATH_MAX] = "";     // last path with stages listed
+    uint32_t i = 0;
+
+    for (i = 0; i < this->nb_entries; i++) {
+        const uint8_t *entry = position;
+        if ((size_t) (this->end - entry) < entry_header_size) {
+            return EXIT_FAILURE;
+        }
+
+        uint32_t mode = get_be32(entry + 24);
+        uint16_t flags = get_be16(entry + STAT_DATA_SIZE + this->hash_size);
+        uint16_t extended_flags = 0;
+        const uint8_t *name = entry + entry_header_size;
+
+        if (flags & FLAG_EXTENDED) {
+            if (this->version < 3 || this->end - name < 2) {
+                return EXIT_FAILURE;
+            }
+            extended_flags = get_be16(name);
+            name += 2;
+        }
+
+        /* paths before version 4 replace the previous path whole */
+        size_t strip = length;
+        if (this->version == 4) {
+            name = read_strip(name, this->end, &strip);
+            if (name == NULL || strip > length) {
+                return EXIT_FAILURE;
+            }
+        }
+
+        const uint8_t *name_end = memchr(name, '\0', this->end - name);
+        if (name_end == NULL || length - strip + (name_end - name) >= PATH_MAX) {
+            return EXIT_FAILURE;
+        }
+        memcpy(path + length - strip, name, name_end - name);
+        length = length - strip + (name_end - name);
+        path[length] = '\0';
+
+        /* entries before version 4 are padded with 1 to 8 nul bytes */
+        if (this->version == 4) {
+            position = name_end + 1;
+        } else {
+            position = entry + ((name_end - entry + 8) & ~7);
+        }
+
+        uint32_t type = mode & MODE_TYPE;
+        if ((type != MODE_FILE && type != MODE_SYMLINK) ||
+            (extended_flags & FLAG_SKIP_WORKTREE) ||
+            strncmp(path, prefix, prefix_length) != 0) {
+            continue;
+        }
+
+        if (flags & FLAG_STAGE) {
+            if (strcmp(path, conflicted) == 0) {
+                continue;
+            }
+            memcpy(conflicted, path, length + 1);
+        }
+
+        file_list_add(list, path + prefix_length, length - prefix_length,
+                      type == MODE_SYMLINK ? file_list_symlink : 0);
+    }
+
+    /* a split index keeps most entries in a shared one */
+    while (this->end - position >= 8) {
+        size_t size = get_be32(position + 4);
+        if (memcmp(position, "link", 4) == 0 || size > (size_t) (this->end - position - 8)) {
+            return EXIT_FAILURE;
+        }
+        position += 8 + size;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/* API ************************************************************************/
+/**
+ * List the files tracked by git under a directory of a checkout, as paths
+ * relative to it, from the index of the checkout alone: untracked files and
+ * directories are never looked at. Returns NULL if the directory isn't in a
+ * checkout or its index can't be read.
+ */
+struct file_list * git_list(const char *directory)
+{
+    char real_directory[PATH_MAX];
+    char git_directory[PATH_MAX];
+    char path[PATH_MAX];
+    size_t root_length = 0;
+
+    if (!file_utils_is_dir(directory) || realpath(directory, real_directory) == NULL ||
+        find_git_directory(real_directory, &root_length, git_directory) == EXIT_FAILURE ||
+        snprintf(path, sizeof(path), "%s/index", git_directory) >= PATH_MAX) {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || sb.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(data, sb.st_size, MADV_SEQUENTIAL);
+
+    /* paths of the index are relative to the root of the checkout */
+    char prefix[PATH_MAX];
+    const char *relative = real_directory + root_length;
+    relative += *relative == '/';
+    snprintf(prefix, sizeof(prefix), "%s%s", relative, *relative ? "/" : "");
+
+    struct git_index index;
+    struct file_list *list = file_list_new();
+    if (index_open(&index, data, sb.st_size, get_hash_size(git_directory)) == EXIT_FAILURE ||
+        index_list(&index, prefix, list) == EXIT_FAILURE) {
+        file_list_delete(list);
+        list = NULL;
+    }
+
+    munmap(data, sb.st_size);
+    return list;
+}
@@ -0,0 +1,708 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ignore.h"
+#include "file_utils.h"
+
+
+#define NO_RULE             -1
+#define MAX_ELEMENTS        1024    // of a glob, longer patterns are dropped
+#define STATE_WORDS         (MAX_ELEMENTS / 64 + 1)
+#define MAX_CLASSES         UINT16_MAX
+
+
+/* ignore files of a directory, the rules of the last ones take precedence */
+static const char *ignore_files[] = {".gitignore", ".ignore"};
+
+enum rule_type {
+    rule_name,          // name without wildcards: build
+    rule_path,          // path from the directory without wildcards: /build, src/gen
+    rule_suffix,        // name ending with a literal suffix: *.o
+    rule_glob,          // anything else, compiled to an automaton
+};
+
+enum element_type {
+    element_char,
+    element_any,            // ?
+    element_class,          // [a-z]
+    element_star,           // *, within a name
+    element_directories,    // **/, any number of directories
+    element_anything,       // trailing **, everything under
+};
+
+/**
+ * Element of a glob, a state of its automaton: the automaton moves on to the
+ * next element once this one matched, the last one accepts.
+ */
+struct element {
+    uint8_t type;           // enum element_type
+    uint8_t c;
+    uint16_t class;         // index in the classes
+};
+
+struct rule {
+    const char *key;            // name, path or suffix matched by a table
+    uint32_t key_length;
+    int32_t previous;           // previous rule of the same key, NO_RULE if none
+    uint32_t first_element;     // automaton of a glob
+    uint32_t nb_elements;
+    uint8_t type;               // enum rule_type
+    uint8_t negate:1;           // !pattern, the paths matched are not ignored
+    uint8_t directory:1;        // pattern/, matches directories only
+    uint8_t anchored:1;         // matches the path from the directory instead of the name
+};
+
+/**
+ * Rules of a type by key, the last rule of each key first.
+ */
+struct table {
+    int32_t *slots;
+    uint32_t mask;
+};
+
+/**
+ * Rules of the ignore files of a directory, compiled once, chained to the
+ * rules of its parent directories. A path is matched against the rules of
+ * the deepest directory first, the last rule matching it decides. Rules
+ * without wildcards and *.suffix ones are looked up in tables, the others
+ * run an automaton.
+ */
+struct ignore {
+    const struct ignore *parent;
+    size_t base_length;         // paths matched are relative to the directory past this
+    char *contents;             // of the ignore files, holding the keys
+
+    struct rule *rules;
+    uint32_t nb_rules;
+    uint32_t max_rules;
+
+    struct table names;
+    struct table paths;
+    struct table suffixes;
+    uint32_t *suffix_lengths;   // distinct lengths of the suffixes
+    uint32_t nb_suffix_lengths;
+    int32_t *globs;             // in the order of the rules
+    uint32_t nb_globs;
+
+    struct element *elements;
+    uint32_t nb_elements;
+    uint32_t max_elements;
+    uint8_t (*classes)[32];
+    uint32_t nb_classes;
+};
+
+
+/* UTILS **********************************************************************/
+static uint32_t hash_key(const char *key, const size_t length)
+{
+    return file_utils_hash(FILE_UTILS_HASH_SEED, key, length);
+}
+
+/**
+ * Append an ignore file to the contents read so far, followed by a newline.
+ */
+static void read_ignore_file(const char *path, char **contents, size_t *size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode)) {
+        close(fd);
+        return;
+    }
+
+    *contents = realloc(*contents, *size + sb.st_size + 2);
+    ssize_t nb_read = read(fd, *contents + *size, sb.st_size);
+    close(fd);
+
+    *size += nb_read > 0 ? nb_read : 0;
+    (*contents)[(*size)++] = '\n';
+    (*contents)[*size] = '\0';
+}
+
+static uint8_t has_wildcards(const char *pattern)
+{
+    for (; *pattern; pattern++) {
+        if (*pattern == '\\' && pattern[1]) {
+            pattern++;
+        } else if (*pattern == '*' || *pattern == '?' || *pattern == '[') {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static size_t unescape(char *pattern)
+{
+    char *from = pattern;
+    char *to = pattern;
+
+    for (; *from; from++) {
+        if (*from == '\\' && from[1]) {
+            from++;
+        }
+        *to++ = *from;
+    }
+    *to = '\0';
+
+    return to - pattern;
+}
+
+
+/* TABLES *********************************************************************/
+static uint32_t table_find(const struct ignore *this, const struct table *table,
+                           const char *key, const size_t length)
+{
+    uint32_t i = hash_key(key, length) & table->mask;
+
+    while (table->slots[i] != NO_RULE) {
+        const struct rule *rule = &this->rules[table->slots[i]];
+        if (rule->key_length == length && memcmp(rule->key, key, length) == 0) {
+            break;
+        }
+        i = (i + 1) & table->mask;
+    }
+
+    return i;
+}
+
+static void table_build(struct ignore *this, struct table *table, const uint8_t type)
+{
+    uint32_t nb_rules = 0;
+    uint32_t i = 0;
+
+    for (i = 0; i < this->nb_rules; i++) {
+        nb_rules += this->rules[i].type == type;
+    }
+    if (nb_rules == 0) {
+        return;
+    }
+
+    uint32_t nb_slots = 16;
+    while (nb_slots < 2 * nb_rules) {
+        nb_slots *= 2;
+    }
+    table->mask = nb_slots - 1;
+    table->slots = malloc(nb_slots * sizeof(int32_t));
+    memset(table->slots, 0xff, nb_slots * sizeof(int32_t));
+
+    for (i = 0; i < this->nb_rules; i++) {
+        struct rule *rule = &this->rules[i];
+        if (rule->type == type) {
+            uint32_t slot = table_find(this, table, rule->key, rule->key_length);
+            rule->previous = table->slots[slot];
+            table->slots[slot] = i;
+        }
+    }
+}
+
+/**
+ * Last rule of the table matching a key, NO_RULE if none.
+ */
+static int32_t table_match(const struct ignore *this, const struct table *table,
+                           const char *key, const size_t length, const uint8_t directory)
+{
+    if (table->slots == NULL) {
+        return NO_RULE;
+    }
+
+    int32_t rule = table->slots[table_find(this, table, key, length)];
+    while (rule != NO_RULE && this->rules[rule].directory && !directory) {
+        rule = this->rules[rule].previous;
+    }
+
+    return rule;
+}
+
+
+/* GLOBS **********************************************************************/
+static void add_element(struct ignore *this, const struct element element)
+{
+    if (this->nb_elements == this->max_elements) {
+        this->max_elements = this->max_elements ? 2 * this->max_elements : 64;
+        this->elements = realloc(this->elements, this->max_elements * sizeof(struct element));
+    }
+    this->elements[this->nb_elements++] = element;
+}
+
+/**
+ * Compile the class starting at *pattern, moving past it. Returns
+ * EXIT_FAILURE if it isn't closed, the bracket is then taken literally.
+ */
+static uint8_t compile_class(struct ignore *this, const char **pattern,
+                             struct element *element)
+{
+    const char *p = *pattern + 1;
+    uint8_t class[32] = {0};
+    uint8_t negate = *p == '!' || *p == '^';
+    p += negate;
+
+    /* a bracket first is part of the class */
+    const char *start = p;
+    while (*p && (*p != ']' || p == start)) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        }
+        unsigned int first = (uint8_t) *p++;
+        unsigned int last = first;
+
+        if (p[0] == '-' && p[1] && p[1] != ']') {
+            p++;
+            if (*p == '\\' && p[1]) {
+                p++;
+            }
+            last = (uint8_t) *p++;
+        }
+
+        unsigned int c = 0;
+        for (c = first; c <= last; c++) {
+            class[c / 8] |= 1 << (c % 8);
+        }
+    }
+
+    if (*p != ']' || this->nb_classes == MAX_CLASSES) {
+        return EXIT_FAILURE;
+    }
+
+    uint32_t i = 0;
+    for (i = 0; negate && i < sizeof(class); i++) {
+        class[i] = ~class[i];
+    }
+
+    this->classes = realloc(this->classes, (this->nb_classes + 1) * sizeof(*this->classes));
+    memcpy(this->classes[this->nb_classes], class, sizeof(class));
+    element->type = element_class;
+    element->class = this->nb_classes++;
+    *pattern = p + 1;
+
+    return EXIT_SUCCESS;
+}
+
+static uint8_t compile_glob(struct ignore *this, struct rule *rule, const char *pattern)
+{
+    const char *p = pattern;
+
+    rule->first_element = this->nb_elements;
+    while (*p) {
+        struct element element = {element_char, 0, 0};
+
+        if (*p == '*') {
+            const char *stars = p;
+            while (*p == '*') {
+                p++;
+            }
+
+            /* ** goes through directories between slashes, elsewhere it's a * */
+            element.type = element_star;
+            if (p - stars == 2 && (stars == pattern || stars[-1] == '/')) {
+                if (*p == '/') {
+                    element.type = element_directories;
+                    p++;
+                } else if (*p == '\0') {
+                    element.type = element_anything;
+                }
+            }
+        } else if (*p == '?') {
+            element.type = element_any;
+            p++;
+        } else if (*p != '[' || compile_class(this, &p, &element) == EXIT_FAILURE) {
+            if (*p == '\\' && p[1]) {
+                p++;
+            }
+            element.c = *p++;
+        }
+
+        if (this->nb_elements - rule->first_element == MAX_ELEMENTS) {
+            this->nb_elements = rule->first_element;
+            return EXIT_FAILURE;
+        }
+        add_element(this, element);
+    }
+    rule->nb_elements = this->nb_elements - rule->first_element;
+
+    return EXIT_SUCCESS;
+}
+
+#define STATE_SET(states, i)    ((states)[(i) / 64] |= 1ULL << ((i) % 64))
+#define STATE_TEST(states, i)   ((states)[(i) / 64] & (1ULL << ((i) % 64)))
+
+/**
+ * Follow the elements that can match nothing, the stars and the ones after
+ * them: states only move forward.
+ */
+static void close_states(const struct element *elements, const uint32_t nb_elements,
+                         uint64_t *states)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < nb_elements; i++) {
+        if (STATE_TEST(states, i) && elements[i].type >= element_star) {
+            STATE_SET(states, i + 1);
+        }
+    }
+}
+
+/**
+ * Run the automaton of a glob on a string, all its states at once: the time
+ * is linear in the length of the string whatever the stars. Directories
+ * elements go on to the next element only as they're entered, for no
+ * directories, or after a slash: the states they stay in aren't followed.
+ */
+static uint8_t glob_match(const struct ignore *this, const struct rule *rule,
+                          const char *string, const size_t length)
+{
+    const struct element *elements = &this->elements[rule->first_element];
+    uint32_t nb_elements = rule->nb_elements;
+    uint32_t nb_words = nb_elements / 64 + 1;
+    uint64_t states[2][STATE_WORDS];
+    uint64_t staying[STATE_WORDS];
+    uint64_t *current = states[0];
+    uint64_t *next = states[1];
+    size_t i = 0;
+
+    memset(current, 0, nb_words * sizeof(uint64_t));
+    STATE_SET(current, 0);
+    close_states(elements, nb_elements, current);
+
+    for (i = 0; i < length; i++) {
+        uint8_t c = string[i];
+        uint64_t active = 0;
+        uint32_t word = 0;
+
+        memset(next, 0, nb_words * sizeof(uint64_t));
+        memset(staying, 0, nb_words * sizeof(uint64_t));
+        for (word = 0; word < nb_words; word++) {
+            uint64_t bits = current[word];
+
+            while (bits) {
+                uint32_t state = word * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                if (state == nb_elements) {
+                    continue;
+                }
+
+                const struct element *element = &elements[state];
+                switch (element->type) {
+                case element_char:
+                    if (c == element->c) {
+                        STATE_SET(next, state + 1);
+                    }
+                    break;
+                case element_any:
+                    if (c != '/') {
+                        STATE_SET(next, state + 1);
+                    }
+                    break;
+                case element_class:
+                    if (c != '/' && (this->classes[element->class][c / 8] & (1 << (c % 8)))) {
+                        STATE_SET(next, state + 1);
+                    }
+                    break;
+                case element_star:
+                    if (c != '/') {
+                        STATE_SET(next, state);
+                    }
+                    break;
+                case element_directories:
+                    STATE_SET(staying, state);
+                    if (c == '/') {
+                        STATE_SET(next, state + 1);
+                    }
+                    break;
+                case element_anything:
+                    STATE_SET(next, state);
+                    break;
+                }
+            }
+        }
+
+        close_states(elements, nb_elements, next);
+        for (word = 0; word < nb_words; word++) {
+            next[word] |= staying[word];
+            active |= next[word];
+        }
+        if (active == 0) {
+            return 0;
+        }
+
+        uint64_t *swap = current;
+        current = next;
+        next = swap;
+    }
+
+    return STATE_TEST(current, nb_elements) != 0;
+}
+
+
+/* RULES **********************************************************************/
+static struct rule * add_rule(struct ignore *this)
+{
+    if (this->nb_rules == this->max_rules) {
+        this->max_rules = this->max_rules ? 2 * this->max_rules : 16;
+        this->rules = realloc(this->rules, this->max_rules * sizeof(struct rule));
+    }
+
+    struct rule *rule = &this->rules[this->nb_rules];
+    memset(rule, 0, sizeof(struct rule));
+    rule->previous = NO_RULE;
+
+    return rule;
+}
+
+/**
+ * Parse a line of an ignore file into a rule, in place, the gitignore way.
+ * Blank lines, comments and patterns too long are skipped.
+ */
+static void parse_rule(struct ignore *this, char *line, size_t length)
+{
+    struct rule *rule = add_rule(this);
+
+    if (length && line[length - 1] == '\r') {
+        length--;
+    }
+
+    /* trailing spaces are dropped unless escaped */
+    while (length && line[length - 1] == ' ' && !(length > 1 && line[length - 2] == '\\')) {
+        length--;
+    }
+
+    if (length == 0 || line[0] == '#') {
+        return;
+    }
+
+    if (line[0] == '!') {
+        rule->negate = 1;
+        line++;
+        length--;
+    }
+
+    if (length && line[length - 1] == '/') {
+        rule->directory = 1;
+        length--;
+    }
+
+    /* patterns with a slash match paths from the directory, but the ones
+       starting with a double star and having no other slash match names */
+    rule->anchored = memchr(line, '/', length) != NULL;
+    if (length && line[0] == '/') {
+        line++;
+        length--;
+    }
+    if (rule->anchored && length > 3 && strncmp(line, "**/", 3) == 0 &&
+        memchr(line + 3, '/', length - 3) == NULL) {
+        rule->anchored = 0;
+        line += 3;
+        length -= 3;
+    }
+
+    if (length == 0) {
+        return;
+    }
+    line[length] = '\0';
+
+    if (!has_wildcards(line)) {
+        rule->type = rule->anchored ? rule_path : rule_name;
+        rule->key = line;
+        rule->key_length = unescape(line);
+    } else if (!rule->anchored && line[0] == '*' && line[1] != '*' && !has_wildcards(line + 1)) {
+        rule->type = rule_suffix;
+        rule->key = line + 1;
+        rule->key_length = unescape(line + 1);
+    } else {
+        rule->type = rule_glob;
+        if (compile_glob(this, rule, line) == EXIT_FAILURE) {
+            return;
+        }
+    }
+
+    this->nb_rules++;
+}
+
+static void index_rules(struct ignore *this)
+{
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    table_build(this, &this->names, rule_name);
+    table_build(this, &this->paths, rule_path);
+    table_build(this, &this->suffixes, rule_suffix);
+
+    this->globs = malloc(this->nb_rules * sizeof(int32_t));
+    this->suffix_lengths = malloc(this->nb_rules * sizeof(uint32_t));
+
+    for (i = 0; i < this->nb_rules; i++) {
+        const struct rule *rule = &this->rules[i];
+
+        if (rule->type == rule_glob) {
+            this->globs[this->nb_globs++] = i;
+        } else if (rule->type == rule_suffix) {
+            for (j = 0; j < this->nb_suffix_lengths; j++) {
+                if (this->suffix_lengths[j] == rule->key_length) {
+                    break;
+                }
+            }
+            if (j == this->nb_suffix_lengths) {
+                this->suffix_lengths[this->nb_suffix_lengths++] = rule->key_length;
+            }
+        }
+    }
+}
+
+/**
+ * Last rule of the directory matching a path relative to it, NO_RULE if
+ * none. Rules without a slash match the name only.
+ */
+static int32_t find_rule(const struct ignore *this, const char *path, const size_t length,
+                         const char *name, const size_t name_length, const uint8_t directory)
+{
+    int32_t best = table_match(this, &this->names, name, name_length, directory);
+    int32_t rule = table_match(this, &this->paths, path, length, directory);
+    uint32_t i = 0;
+
+    best = rule > best ? rule : best;
+    for (i = 0; i < this->nb_suffix_lengths; i++) {
+        size_t suffix_length = this->suffix_lengths[i];
+        if (suffix_length <= name_length) {
+            rule = table_match(this, &this->suffixes, name + name_length - suffix_length,
+                               suffix_length, directory);
+            best = rule > best ? rule : best;
+        }
+    }
+
+    /* globs can only override the rules found if they come after them */
+    for (i = this->nb_globs; i-- > 0 && this->globs[i] > best;) {
+        const struct rule *glob = &this->rules[this->globs[i]];
+        if (glob->directory && !directory) {
+            continue;
+        }
+
+        if (glob->anchored ? glob_match(this, glob, path, length) :
+                             glob_match(this, glob, name, name_length)) {
+            return this->globs[i];
+        }
+    }
+
+    return best;
+}
+
+
+/* API ************************************************************************/
+/**
+ * Check if a file name is the one of an ignore file.
+ */
+uint8_t ignore_is_file(const char *name)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < sizeof(ignore_files) / sizeof(ignore_files[0]); i++) {
+        if (strcmp(name, ignore_files[i]) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Check if the ignore files of the directories holding a path ignore it. The
+ * path starts with the path of the directory the rules were read in, its
+ * parents were matched against the rules already.
+ */
+uint8_t ignore_match(const struct ignore *this, const char *path, const size_t length,
+                     const uint8_t directory)
+{
+    const char *name = memrchr(path, '/', length);
+    name = name ? name + 1 : path;
+    size_t name_length = path + length - name;
+
+    for (; this; this = this->parent) {
+        if (length <= this->base_length) {
+            continue;
+        }
+
+        int32_t rule = find_rule(this, path + this->base_length, length - this->base_length,
+                                 name, name_length, directory);
+        if (rule != NO_RULE) {
+            return !this->rules[rule].negate;
+        }
+    }
+
+    return 0;
+}
+
+
+/* CONSTRUCTOR ****************************************************************/
+/**
+ * Read the rules of the ignore files of a directory, of length length, on top
+ * of the rules of its parent. Returns NULL if it has none, its
+ * subdirectories are matched against the parent's only.
+ */
+struct ignore * ignore_new(const struct ignore *parent, const char *directory,
+                           const size_t length)
+{
+    char path[PATH_MAX];
+    size_t base_length = length && directory[length - 1] == '/' ? length : length + 1;
+    char *contents = NULL;
+    size_t size = 0;
+    uint32_t i = 0;
+
+    for (i = 0; i < sizeof(ignore_files) / sizeof(ignore_files[0]); i++) {
+        size_t name_length = strlen(ignore_files[i]);
+        if (base_length + name_length >= PATH_MAX) {
+            continue;
+        }
+
+        memcpy(path, directory, length);
+        path[base_length - 1] = '/';
+        memcpy(&path[base_length], ignore_files[i], name_length + 1);
+        read_ignore_file(path, &contents, &size);
+    }
+
+    if (contents == NULL) {
+        return NULL;
+    }
+
+    struct ignore *this = calloc(1, sizeof(struct ignore));
+    this->parent = parent;
+    this->base_length = base_length;
+    this->contents = contents;
+
+    char *line = contents;
+    while (line < contents + size) {
+        char *end = memchr(line, '\n', contents + size - line);
+        parse_rule(this, line, end - line);
+        line = end + 1;
+    }
+
+    if (this->nb_rules == 0) {
+        ignore_delete(this);
+        return NULL;
+    }
+    index_rules(this);
+
+    return this;
+}
+
+void ignore_delete(struct ignore *this)
+{
+    free(this->names.slots);
+    free(this->paths.slots);
+    free(this->suffixes.slots);
+    free(this->suffix_lengths);
+    free(this->globs);
+    free(this->elements);
+    free(this->classes);
+    free(this->rules);
+    free(this->contents);
+    free(this);
+}
@@ -0,0 +1,1683 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "index.h"
+#include "file_list.h"
+#include "file_utils.h"
+
+
+#define INDEX_MAGIC     "NGPIDX1"
+#define INDEX_VERSION   4
+#define NB_TRIGRAMS     (1 << 24)
+#define MAX_SEGMENTS    5       // segments are compacted past this
+#define NO_FILE_ID      UINT32_MAX
+
+/* trigrams are case folded so that case insensitive searches use them too */
+#define FOLD(c)         ((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+
+
+/**
+ * An index is a base segment followed by delta segments holding the files
+ * changed since, each refresh adds one. Segment files are made of this
+ * header, the table of the files, the table of the trigrams sorted by value,
+ * the table of the symbols sorted by name, the tombstones, the posting lists,
+ * the line lists and the strings. Posting lists hold the increasing ids of
+ * the files containing the trigram, as varint encoded deltas. Trigrams never
+ * span lines since matches don't. Line lists hold the lines a symbol appears
+ * on, so that whole word searches don't read files but for these lines.
+ */
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t segment;           // 0 for the base, then the number of the delta
+    uint64_t generation;        // of the base, deltas of another base are ignored
+    uint64_t filters;           // hash of the filters the files were listed with
+    uint32_t nb_files;
+    uint32_t nb_trigrams;
+    uint32_t nb_tombstones;
+    uint32_t nb_symbols;
+    uint64_t root;              // offset in the strings of the real path indexed
+    uint64_t files_offset;
+    uint64_t trigrams_offset;
+    uint64_t symbols_offset;
+    uint64_t tombstones_offset;
+    uint64_t postings_offset;
+    uint64_t postings_size;
+    uint64_t lines_offset;
+    uint64_t lines_size;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+/**
+ * Files are tokenized again only when their metadata changes.
+ */
+struct index_file {
+    uint64_t path;              // offset in the strings, relative to the root
+    uint64_t dev;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;              // in nanoseconds
+    uint32_t flags;             // enum file_list_flags
+    uint32_t reserved;
+};
+
+struct index_trigram {
+    uint32_t trigram;
+    uint32_t nb_files;
+    uint64_t offset;            // offset in the postings
+};
+
+/**
+ * Lines are varint encoded as the delta of their file + 1, 0 for the same
+ * file as the previous line, then the deltas of their number and of the
+ * offset of their start in the file, from the previous line of the file.
+ */
+struct index_symbol {
+    uint64_t name;              // offset in the strings
+    uint32_t nb_lines;
+    uint32_t reserved;
+    uint64_t offset;            // offset in the lines
+};
+
+/**
+ * File of a previous segment removed or replaced by a segment.
+ */
+struct index_tombstone {
+    uint32_t segment;
+    uint32_t file;
+};
+
+struct segment {
+    char *data;
+    size_t size;
+    const struct index_header *header;
+    const struct index_file *files;
+    const struct index_trigram *trigrams;
+    const struct index_symbol *symbols;
+    const struct index_tombstone *tombstones;
+    const uint8_t *postings;
+    const uint8_t *lines;
+    const char *strings;
+    uint64_t *dead;             // files removed or replaced by later segments
+    uint32_t first;             // id of its first file in the whole index
+};
+
+/**
+ * Live files of an index by path, to find the files searched in it.
+ */
+struct path_table {
+    uint32_t *slots;            // file + 1, 0 for an empty slot
+    uint32_t mask;
+};
+
+/**
+ * Index of a root mapped from the cache. Files are numbered across the
+ * segments, in order.
+ */
+struct index {
+    struct segment *segments;
+    uint32_t nb_segments;
+    uint32_t nb_files;
+    uint32_t nb_dead;
+    struct path_table paths;
+};
+
+/**
+ * Posting list of a trigram, or line list of a symbol, while a segment is
+ * built.
+ */
+struct posting {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t last;              // last file added + 1
+    uint32_t count;             // files, or lines of a symbol
+};
+
+struct symbol {
+    uint64_t name;              // offset in the names of the builder
+    struct posting lines;
+    uint32_t line;              // last line added
+    uint64_t offset;            // start of the last line added
+};
+
+struct builder {
+    uint32_t *slots;            // posting + 1 of each trigram, 0 if it wasn't seen
+    struct posting *postings;
+    uint32_t nb_postings;
+    uint32_t max_postings;
+
+    /* files of the segment, along with their metadata */
+    struct file_list *list;
+    struct index_file *files;
+    uint32_t max_files;
+
+    struct index_tombstone *tombstones;
+    uint32_t nb_tombstones;
+    uint32_t max_tombstones;
+
+    /* symbols by hash of their name */
+    uint32_t *symbol_slots;     // symbol + 1, 0 for an empty slot
+    uint32_t symbol_mask;
+    struct symbol *symbols;
+    uint32_t nb_symbols;
+    uint32_t max_symbols;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+};
+
+/**
+ * Trigrams that matches must all contain. A query is satisfied by any of its
+ * branches.
+ */
+struct branch {
+    uint32_t *trigrams;
+    uint32_t nb_trigrams;
+    uint32_t max_trigrams;
+};
+
+struct query {
+    struct branch *branches;
+    uint32_t nb_branches;
+};
+
+
+/* SEGMENTS *******************************************************************/
+static uint8_t segment_path(const char *real_root, const uint32_t number,
+                            char *path, const size_t size, const uint8_t create)
+{
+    char extension[32];
+
+    if (number == 0) {
+        snprintf(extension, sizeof(extension), "idx");
+    } else {
+        snprintf(extension, sizeof(extension), "%u.idx", number);
+    }
+
+    return file_utils_cache_path(real_root, extension, path, size, create);
+}
+
+static uint8_t segment_open(struct segment *this, const char *path, const char *real_root,
+                            const uint64_t filters)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || (size_t) sb.st_size < sizeof(struct index_header)) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    char *data = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return EXIT_FAILURE;
+    }
+
+    /* offsets in the tables are checked as they're used, not to read them all */
+    size_t size = sb.st_size;
+    const struct index_header *header = (const struct index_header *) data;
+    uint8_t valid =
+        memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) == 0 &&
+        header->version == INDEX_VERSION &&
+        header->filters == filters &&
+        header->files_offset % 8 == 0 &&
+        header->trigrams_offset >= header->files_offset + (uint64_t) header->nb_files * sizeof(struct index_file) &&
+        header->symbols_offset >= header->trigrams_offset + (uint64_t) header->nb_trigrams * sizeof(struct index_trigram) &&
+        header->tombstones_offset >= header->symbols_offset + (uint64_t) header->nb_symbols * sizeof(struct index_symbol) &&
+        header->postings_offset >= header->tombstones_offset + (uint64_t) header->nb_tombstones * sizeof(struct index_tombstone) &&
+        header->lines_offset >= header->postings_offset + header->postings_size &&
+        header->strings_offset >= header->lines_offset + header->lines_size &&
+        header->strings_offset <= size && header->strings_size > 0 &&
+        header->strings_size <= size - header->strings_offset &&
+        data[header->strings_offset + header->strings_size - 1] == 0 &&
+        header->root < header->strings_size &&
+        strcmp(data + header->strings_offset + header->root, real_root) == 0;
+
+    if (!valid) {
+        munmap(data, size);
+        return EXIT_FAILURE;
+    }
+
+    memset(this, 0, sizeof(struct segment));
+    this->data = data;
+    this->size = size;
+    this->header = header;
+    this->files = (const struct index_file *) (data + header->files_offset);
+    this->trigrams = (const struct index_trigram *) (data + header->trigrams_offset);
+    this->symbols = (const struct index_symbol *) (data + header->symbols_offset);
+    this->tombstones = (const struct index_tombstone *) (data + header->tombstones_offset);
+    this->postings = (const uint8_t *) (data + header->postings_offset);
+    this->lines = (const uint8_t *) (data + header->lines_offset);
+    this->strings = data + header->strings_offset;
+    this->dead = calloc(header->nb_files / 64 + 1, sizeof(uint64_t));
+
+    return EXIT_SUCCESS;
+}
+
+static void segment_close(struct segment *this)
+{
+    munmap(this->data, this->size);
+    free(this->dead);
+}
+
+static uint8_t segment_is_dead(const struct segment *this, const uint32_t file)
+{
+    return (this->dead[file / 64] >> (file % 64)) & 1;
+}
+
+static const char * segment_get_path(const struct segment *this, const uint32_t file)
+{
+    if (this->files[file].path >= this->header->strings_size) {
+        return "";
+    }
+
+    return this->strings + this->files[file].path;
+}
+
+/**
+ * Get the segment of a file of the index, and the file in the segment.
+ */
+static const struct segment * get_segment(const struct index *this, const uint32_t file,
+                                          uint32_t *segment_file)
+{
+    uint32_t i = this->nb_segments - 1;
+
+    while (i > 0 && this->segments[i].first > file) {
+        i--;
+    }
+    *segment_file = file - this->segments[i].first;
+
+    return &this->segments[i];
+}
+
+static const struct index_trigram * find_trigram(const struct segment *this, const uint32_t trigram)
+{
+    uint32_t low = 0;
+    uint32_t high = this->header->nb_trigrams;
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (this->trigrams[middle].trigram < trigram) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low < this->header->nb_trigrams && this->trigrams[low].trigram == trigram) {
+        return &this->trigrams[low];
+    }
+
+    return NULL;
+}
+
+static const char * segment_get_symbol(const struct segment *this, const struct index_symbol *symbol)
+{
+    if (symbol->name >= this->header->strings_size) {
+        return "";
+    }
+
+    return this->strings + symbol->name;
+}
+
+static const struct index_symbol * find_symbol(const struct segment *this, const char *name)
+{
+    uint32_t low = 0;
+    uint32_t high = this->header->nb_symbols;
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (strcmp(segment_get_symbol(this, &this->symbols[middle]), name) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low < this->header->nb_symbols &&
+        strcmp(segment_get_symbol(this, &this->symbols[low]), name) == 0) {
+        return &this->symbols[low];
+    }
+
+    return NULL;
+}
+
+static uint8_t read_varint(const uint8_t **p, const uint8_t *end, uint64_t *value)
+{
+    uint32_t shift = 0;
+
+    *value = 0;
+    while (*p < end && shift < 64) {
+        uint8_t byte = *(*p)++;
+        *value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return 1;
+        }
+        shift += 7;
+    }
+
+    return 0;
+}
+
+/**
+ * Decode the next file of a posting list, returns 0 at its end.
+ */
+static uint8_t next_file(const uint8_t **p, const uint8_t *end, uint32_t *last)
+{
+    uint64_t delta = 0;
+
+    if (!read_varint(p, end, &delta)) {
+        return 0;
+    }
+    *last += delta;
+
+    return 1;
+}
+
+/**
+ * Decode the lines of a symbol in lines, with the files of the segment.
+ * Returns their number.
+ */
+static uint32_t decode_lines(const struct segment *this, const struct index_symbol *symbol,
+                             struct index_line *lines)
+{
+    const uint8_t *end = this->lines + this->header->lines_size;
+    const uint8_t *p = symbol->offset < this->header->lines_size ?
+                       this->lines + symbol->offset : end;
+    uint64_t file = 0;
+    uint64_t line = 0;
+    uint64_t offset = 0;
+    uint32_t nb_lines = 0;
+
+    while (nb_lines < symbol->nb_lines) {
+        uint64_t file_delta = 0, line_delta = 0, offset_delta = 0;
+        if (!read_varint(&p, end, &file_delta) || !read_varint(&p, end, &line_delta) ||
+            !read_varint(&p, end, &offset_delta)) {
+            break;
+        }
+
+        if (file_delta) {
+            file += file_delta;
+            line = 0;
+            offset = 0;
+        }
+        line += line_delta;
+        offset += offset_delta;
+
+        if (file == 0 || file - 1 >= this->header->nb_files || line > UINT32_MAX) {
+            break;
+        }
+        lines[nb_lines].file = file - 1;
+        lines[nb_lines].line = line;
+        lines[nb_lines].offset = offset;
+        nb_lines++;
+    }
+
+    return nb_lines;
+}
+
+/**
+ * Decode the posting list of a trigram in files, returns its length.
+ */
+static uint32_t decode_postings(const struct segment *this, const struct index_trigram *trigram,
+                                uint32_t *files)
+{
+    const uint8_t *end = this->postings + this->header->postings_size;
+    const uint8_t *p = trigram->offset < this->header->postings_size ?
+                       this->postings + trigram->offset : end;
+    uint32_t last = 0;
+    uint32_t nb_files = 0;
+
+    while (nb_files < trigram->nb_files && next_file(&p, end, &last) &&
+           last - 1 < this->header->nb_files) {
+        files[nb_files++] = last - 1;
+    }
+
+    return nb_files;
+}
+
+/**
+ * Keep the files of files that are in the posting list of trigram, in place.
+ */
+static uint32_t intersect(const struct segment *this, const struct index_trigram *trigram,
+                          uint32_t *files, const uint32_t nb_files)
+{
+    const uint8_t *end = this->postings + this->header->postings_size;
+    const uint8_t *p = trigram->offset < this->header->postings_size ?
+                       this->postings + trigram->offset : end;
+    uint32_t last = 0;
+    uint32_t nb_kept = 0;
+    uint32_t decoded = 0;
+    uint32_t i = 0;
+
+    uint8_t more = decoded < trigram->nb_files && next_file(&p, end, &last);
+    for (i = 0; i < nb_files && more; i++) {
+        while (more && last - 1 < files[i]) {
+            decoded++;
+            more = decoded < trigram->nb_files && next_file(&p, end, &last);
+        }
+        if (more && last - 1 == files[i]) {
+            files[nb_kept++] = files[i];
+        }
+    }
+
+    return nb_kept;
+}
+
+static int compare_trigrams(const void *a, const void *b)
+{
+    const struct index_trigram *first = *(const struct index_trigram * const *) a;
+    const struct index_trigram *second = *(const struct index_trigram * const *) b;
+
+    return first->nb_files < second->nb_files ? -1 : first->nb_files > second->nb_files;
+}
+
+/**
+ * Get the files of a segment containing all the trigrams of a branch, from
+ * the shortest posting list on.
+ */
+static uint32_t branch_files(const struct segment *this, const struct branch *branch,
+                             uint32_t **files)
+{
+    const struct index_trigram **lists = malloc(branch->nb_trigrams * sizeof(struct index_trigram *));
+    uint32_t nb_files = 0;
+    uint32_t i = 0;
+
+    *files = NULL;
+    for (i = 0; i < branch->nb_trigrams; i++) {
+        lists[i] = find_trigram(this, branch->trigrams[i]);
+        if (lists[i] == NULL) {
+            free(lists);
+            return 0;
+        }
+    }
+    qsort(lists, branch->nb_trigrams, sizeof(struct index_trigram *), compare_trigrams);
+
+    *files = malloc((lists[0]->nb_files + 1) * sizeof(uint32_t));
+    nb_files = decode_postings(this, lists[0], *files);
+    for (i = 1; i < branch->nb_trigrams && nb_files; i++) {
+        if (lists[i] != lists[i - 1]) {
+            nb_files = intersect(this, lists[i], *files, nb_files);
+        }
+    }
+
+    free(lists);
+    return nb_files;
+}
+
+static uint32_t merge_files(const uint32_t *a, const uint32_t nb_a,
+                            const uint32_t *b, const uint32_t nb_b, uint32_t *merged)
+{
+    uint32_t i = 0, j = 0, nb = 0;
+
+    while (i < nb_a || j < nb_b) {
+        if (j == nb_b || (i < nb_a && a[i] < b[j])) {
+            merged[nb++] = a[i++];
+        } else if (i == nb_a || b[j] < a[i]) {
+            merged[nb++] = b[j++];
+        } else {
+            merged[nb++] = a[i++];
+            j++;
+        }
+    }
+
+    return nb;
+}
+
+/**
+ * Get the live files of a segment any branch of the query may match.
+ */
+static uint32_t segment_query(const struct segment *this, const struct query *query,
+                              const uint8_t all_files, uint32_t *files)
+{
+    uint32_t *candidates = NULL;
+    uint32_t nb_candidates = 0;
+    uint32_t nb_files = 0;
+    uint32_t i = 0;
+
+    if (all_files) {
+        nb_candidates = this->header->nb_files;
+        candidates = malloc((nb_candidates + 1) * sizeof(uint32_t));
+        for (i = 0; i < nb_candidates; i++) {
+            candidates[i] = i;
+        }
+    }
+
+    for (i = 0; !all_files && i < query->nb_branches; i++) {
+        uint32_t *branch = NULL;
+        uint32_t nb_branch = branch_files(this, &query->branches[i], &branch);
+
+        uint32_t *merged = malloc((nb_candidates + nb_branch + 1) * sizeof(uint32_t));
+        nb_candidates = merge_files(candidates, nb_candidates, branch, nb_branch, merged);
+        free(candidates);
+        free(branch);
+        candidates = merged;
+    }
+
+    for (i = 0; i < nb_candidates; i++) {
+        if (!segment_is_dead(this, candidates[i])) {
+            files[nb_files++] = this->first + candidates[i];
+        }
+    }
+
+    free(candidates);
+    return nb_files;
+}
+
+
+/* BUILD **********************************************************************/
+static void posting_put(struct posting *posting, uint64_t value)
+{
+    if (posting->size + 10 > posting->capacity) {
+        posting->capacity = posting->capacity ? 2 * posting->capacity : 16;
+        posting->data = realloc(posting->data, posting->capacity);
+    }
+
+    while (value >= 0x80) {
+        posting->data[posting->size++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    posting->data[posting->size++] = value;
+}
+
+static void posting_add(struct posting *posting, const uint32_t file)
+{
+    posting_put(posting, file + 1 - posting->last);
+    posting->last = file + 1;
+    posting->count++;
+}
+
+/**
+ * Add a file to the posting list of a trigram. Files are added in increasing
+ * order.
+ */
+static void builder_add(struct builder *this, const uint32_t trigram, const uint32_t file)
+{
+    uint32_t slot = this->slots[trigram];
+    if (slot == 0) {
+        if (this->nb_postings == this->max_postings) {
+            this->max_postings = this->max_postings ? 2 * this->max_postings : 4096;
+            this->postings = realloc(this->postings, this->max_postings * sizeof(struct posting));
+        }
+        memset(&this->postings[this->nb_postings], 0, sizeof(struct posting));
+        slot = this->slots[trigram] = ++this->nb_postings;
+    }
+
+    struct posting *posting = &this->postings[slot - 1];
+    if (posting->last != file + 1) {
+        posting_add(posting, file);
+    }
+}
+
+static void add_trigrams(struct builder *this, const uint8_t *data, const size_t size,
+                         const uint32_t file)
+{
+    uint32_t trigram = 0;
+    uint32_t run = 0;       // characters since the start of the line
+    size_t i = 0;
+
+    for (i = 0; i < size; i++) {
+        uint8_t c = data[i];
+        if (c == '\n') {
+            run = 0;
+            continue;
+        }
+
+        trigram = ((trigram << 8) | FOLD(c)) & (NB_TRIGRAMS - 1);
+        if (++run >= 3) {
+            builder_add(this, trigram, file);
+        }
+    }
+}
+
+static void symbols_grow(struct builder *this)
+{
+    uint32_t size = 2 * (this->symbol_mask + 1);
+    uint32_t i = 0;
+
+    free(this->symbol_slots);
+    this->symbol_slots = calloc(size, sizeof(uint32_t));
+    this->symbol_mask = size - 1;
+
+    for (i = 0; i < this->nb_symbols; i++) {
+        const char *name = this->names + this->symbols[i].name;
+        uint32_t slot = file_utils_hash(FILE_UTILS_HASH_SEED, name, strlen(name)) & this->symbol_mask;
+        while (this->symbol_slots[slot]) {
+            slot = (slot + 1) & this->symbol_mask;
+        }
+        this->symbol_slots[slot] = i + 1;
+    }
+}
+
+/**
+ * Get the symbol of a name, added if it wasn't seen. The name isn't nul
+ * terminated.
+ */
+static struct symbol * builder_get_symbol(struct builder *this, const char *name,
+                                          const size_t length)
+{
+    if (2 * (this->nb_symbols + 1) > this->symbol_mask + 1) {
+        symbols_grow(this);
+    }
+
+    uint32_t slot = file_utils_hash(FILE_UTILS_HASH_SEED, name, length) & this->symbol_mask;
+    while (this->symbol_slots[slot]) {
+        struct symbol *symbol = &this->symbols[this->symbol_slots[slot] - 1];
+        const char *symbol_name = this->names + symbol->name;
+
+        if (strncmp(symbol_name, name, length) == 0 && symbol_name[length] == 0) {
+            return symbol;
+        }
+        slot = (slot + 1) & this->symbol_mask;
+    }
+
+    if (this->nb_symbols == this->max_symbols) {
+        this->max_symbols = this->max_symbols ? 2 * this->max_symbols : 4096;
+        this->symbols = realloc(this->symbols, this->max_symbols * sizeof(struct symbol));
+    }
+    if (this->names_size + length + 1 > this->names_capacity) {
+        while (this->names_size + length + 1 > this->names_capacity) {
+            this->names_capacity = this->names_capacity ? 2 * this->names_capacity : 65536;
+        }
+        this->names = realloc(this->names, this->names_capacity);
+    }
+
+    struct symbol *symbol = &this->symbols[this->nb_symbols];
+    memset(symbol, 0, sizeof(struct symbol));
+    symbol->name = this->names_size;
+    memcpy(this->names + this->names_size, name, length);
+    this->names[this->names_size + length] = 0;
+    this->names_size += length + 1;
+    this->symbol_slots[slot] = ++this->nb_symbols;
+
+    return symbol;
+}
+
+/**
+ * Add a line to the lines of a symbol, lines are added in increasing order.
+ */
+static void symbol_add_line(struct symbol *this, const uint32_t file, const uint32_t line,
+                            const uint64_t offset)
+{
+    if (this->lines.last == file + 1 && this->line == line) {
+        return;
+    }
+
+    if (this->lines.last != file + 1) {
+        posting_put(&this->lines, file + 1 - this->lines.last);
+        this->lines.last = file + 1;
+        this->line = 0;
+        this->offset = 0;
+    } else {
+        posting_put(&this->lines, 0);
+    }
+    posting_put(&this->lines, line - this->line);
+    posting_put(&this->lines, offset - this->offset);
+
+    this->line = line;
+    this->offset = offset;
+    this->lines.count++;
+}
+
+static void add_symbols(struct builder *this, const uint8_t *data, const size_t size,
+                        const uint32_t file)
+{
+    uint32_t line = 1;
+    size_t start = 0;       // of the line
+    size_t i = 0;
+
+    while (i < size) {
+        if (data[i] == '\n') {
+            line++;
+            start = ++i;
+            continue;
+        }
+        if (!WORD_CHAR(data[i])) {
+            i++;
+            continue;
+        }
+
+        size_t name = i;
+        while (i < size && WORD_CHAR(data[i])) {
+            i++;
+        }
+        symbol_add_line(builder_get_symbol(this, (const char *) data + name, i - name),
+                        file, line, start);
+    }
+}
+
+static void index_file_contents(struct builder *this, const char *path, const uint32_t file)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || sb.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    uint8_t *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return;
+    }
+
+    madvise(data, sb.st_size, MADV_SEQUENTIAL);
+    add_trigrams(this, data, sb.st_size, file);
+    add_symbols(this, data, sb.st_size, file);
+    munmap(data, sb.st_size);
+}
+
+static void builder_add_file(struct builder *this, const char *path, const uint8_t flags,
+                             const struct index_file *file)
+{
+    if (this->list->nb_files == this->max_files) {
+        this->max_files = this->max_files ? 2 * this->max_files : 1024;
+        this->files = realloc(this->files, this->max_files * sizeof(struct index_file));
+    }
+
+    this->files[this->list->nb_files] = *file;
+    file_list_add(this->list, path, strlen(path), flags);
+}
+
+static void builder_add_tombstone(struct builder *this, const uint32_t segment,
+                                  const uint32_t file)
+{
+    if (this->nb_tombstones == this->max_tombstones) {
+        this->max_tombstones = this->max_tombstones ? 2 * this->max_tombstones : 1024;
+        this->tombstones = realloc(this->tombstones, this->max_tombstones * sizeof(struct index_tombstone));
+    }
+
+    this->tombstones[this->nb_tombstones].segment = segment;
+    this->tombstones[this->nb_tombstones].file = file;
+    this->nb_tombstones++;
+}
+
+static void builder_init(struct builder *this)
+{
+    memset(this, 0, sizeof(struct builder));
+    this->slots = calloc(NB_TRIGRAMS, sizeof(uint32_t));
+    this->list = file_list_new();
+    this->symbol_slots = calloc(1024, sizeof(uint32_t));
+    this->symbol_mask = 1023;
+}
+
+static void builder_free(struct builder *this)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < this->nb_postings; i++) {
+        free(this->postings[i].data);
+    }
+    free(this->postings);
+    free(this->slots);
+    for (i = 0; i < this->nb_symbols; i++) {
+        free(this->symbols[i].lines.data);
+    }
+    free(this->symbols);
+    free(this->symbol_slots);
+    free(this->names);
+    free(this->files);
+    free(this->tombstones);
+    file_list_delete(this->list);
+}
+
+struct sorted_symbol {
+    const char *name;
+    const struct symbol *symbol;
+};
+
+static int compare_symbols(const void *a, const void *b)
+{
+    return strcmp(((const struct sorted_symbol *) a)->name,
+                  ((const struct sorted_symbol *) b)->name);
+}
+
+/**
+ * Write a segment of the index of real_root to the cache, the base for
+ * number 0.
+ */
+static uint8_t write_segment(const struct builder *this, const char *real_root,
+                             const uint64_t generation, const uint32_t number,
+                             const uint64_t filters)
+{
+    const struct file_list *list = this->list;
+    char path[PATH_MAX];
+
+    if (segment_path(real_root, number, path, sizeof(path), 1) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    char tmp_path[PATH_MAX + 16];
+    FILE *output = file_utils_create_temporary(path, tmp_path, sizeof(tmp_path));
+    if (output == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    struct index_header header;
+    uint32_t i = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.segment = number;
+    header.generation = generation;
+    header.filters = filters;
+    header.nb_files = list->nb_files;
+    header.nb_trigrams = this->nb_postings;
+    header.nb_tombstones = this->nb_tombstones;
+    header.nb_symbols = this->nb_symbols;
+    for (i = 0; i < this->nb_postings; i++) {
+        header.postings_size += this->postings[i].size;
+    }
+
+    /* symbols are looked up by name */
+    struct sorted_symbol *sorted = malloc((this->nb_symbols + 1) * sizeof(struct sorted_symbol));
+    for (i = 0; i < this->nb_symbols; i++) {
+        sorted[i].name = this->names + this->symbols[i].name;
+        sorted[i].symbol = &this->symbols[i];
+        header.lines_size += this->symbols[i].lines.size;
+    }
+    qsort(sorted, this->nb_symbols, sizeof(struct sorted_symbol), compare_symbols);
+
+    size_t root_size = strlen(real_root) + 1;
+    header.root = 0;
+    header.files_offset = ROUND_UP(sizeof(header), 8);
+    header.trigrams_offset = header.files_offset + (uint64_t) list->nb_files * sizeof(struct index_file);
+    header.symbols_offset = header.trigrams_offset + (uint64_t) this->nb_postings * sizeof(struct index_trigram);
+    header.tombstones_offset = header.symbols_offset + (uint64_t) this->nb_symbols * sizeof(struct index_symbol);
+    header.postings_offset = header.tombstones_offset + (uint64_t) this->nb_tombstones * sizeof(struct index_tombstone);
+    header.lines_offset = header.postings_offset + header.postings_size;
+    header.strings_offset = header.lines_offset + header.lines_size;
+    header.strings_size = root_size + list->size + this->names_size;
+
+    uint8_t status = fwrite(&header, sizeof(header), 1, output) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (status == EXIT_SUCCESS) {
+        status = file_utils_write_padding(output, header.files_offset - sizeof(header));
+    }
+
+    for (i = 0; status == EXIT_SUCCESS && i < list->nb_files; i++) {
+        struct index_file file = this->files[i];
+        file.path = root_size + list->offsets[i];
+        file.flags = list->flags[i];
+        if (fwrite(&file, sizeof(file), 1, output) != 1) {
+            status = EXIT_FAILURE;
+        }
+    }
+
+    /* slots are walked in order of the trigrams */
+    uint64_t offset = 0;
+    uint32_t trigram = 0;
+    for (trigram = 0; status == EXIT_SUCCESS && trigram < NB_TRIGRAMS; trigram++) {
+        if (this->slots[trigram] == 0) {
+            continue;
+        }
+
+        const struct posting *posting = &this->postings[this->slots[trigram] - 1];
+        struct index_trigram entry = {trigram, posting->count, offset};
+        if (fwrite(&entry, sizeof(entry), 1, output) != 1) {
+            status = EXIT_FAILURE;
+        }
+        offset += posting->size;
+    }
+
+    offset = 0;
+    for (i = 0; status == EXIT_SUCCESS && i < this->nb_symbols; i++) {
+        const struct symbol *symbol = sorted[i].symbol;
+        struct index_symbol entry;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.name = root_size + list->size + symbol->name;
+        entry.nb_lines = symbol->lines.count;
+        entry.offset = offset;
+        if (fwrite(&entry, sizeof(entry), 1, output) != 1) {
+            status = EXIT_FAILURE;
+        }
+        offset += symbol->lines.size;
+    }
+
+    if (status == EXIT_SUCCESS && this->nb_tombstones &&
+        fwrite(this->tombstones, sizeof(struct index_tombstone), this->nb_tombstones,
+               output) != this->nb_tombstones) {
+        status = EXIT_FAILURE;
+    }
+
+    for (trigram = 0; status == EXIT_SUCCESS && trigram < NB_TRIGRAMS; trigram++) {
+        if (this->slots[trigram] == 0) {
+            continue;
+        }
+
+        const struct posting *posting = &this->postings[this->slots[trigram] - 1];
+        if (fwrite(posting->data, 1, posting->size, output) != posting->size) {
+            status = EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0; status == EXIT_SUCCESS && i < this->nb_symbols; i++) {
+        const struct posting *lines = &sorted[i].symbol->lines;
+        if (fwrite(lines->data, 1, lines->size, output) != lines->size) {
+            status = EXIT_FAILURE;
+        }
+    }
+    free(sorted);
+
+    if (status == EXIT_SUCCESS &&
+        (fwrite(real_root, 1, root_size, output) != root_size ||
+         fwrite(list->paths, 1, list->size, output) != list->size ||
+         fwrite(this->names, 1, this->names_size, output) != this->names_size)) {
+        status = EXIT_FAILURE;
+    }
+
+    return file_utils_commit_temporary(output, tmp_path, path, status);
+}
+
+
+/* PATHS **********************************************************************/
+static uint64_t hash_path(const char *path)
+{
+    return file_utils_hash(FILE_UTILS_HASH_SEED, path, strlen(path));
+}
+
+static void path_table_init(struct path_table *this, const struct index *index)
+{
+    uint32_t size = 1024;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    while (size < 2 * (index->nb_files - index->nb_dead)) {
+        size *= 2;
+    }
+    this->slots = calloc(size, sizeof(uint32_t));
+    this->mask = size - 1;
+
+    for (i = 0; i < index->nb_segments; i++) {
+        const struct segment *segment = &index->segments[i];
+
+        for (j = 0; j < segment->header->nb_files; j++) {
+            if (segment_is_dead(segment, j)) {
+                continue;
+            }
+
+            uint32_t slot = hash_path(segment_get_path(segment, j)) & this->mask;
+            while (this->slots[slot]) {
+                slot = (slot + 1) & this->mask;
+            }
+            this->slots[slot] = segment->first + j + 1;
+        }
+    }
+}
+
+static uint32_t path_table_find(const struct path_table *this, const struct index *index,
+                                const char *path)
+{
+    uint32_t slot = hash_path(path) & this->mask;
+
+    while (this->slots[slot]) {
+        uint32_t file = this->slots[slot] - 1;
+        uint32_t segment_file = 0;
+        const struct segment *segment = get_segment(index, file, &segment_file);
+
+        if (strcmp(segment_get_path(segment, segment_file), path) == 0) {
+            return file;
+        }
+        slot = (slot + 1) & this->mask;
+    }
+
+    return NO_FILE_ID;
+}
+
+
+/* REFRESH ********************************************************************/
+static void stat_file(const struct stat *sb, struct index_file *file)
+{
+    memset(file, 0, sizeof(struct index_file));
+    file->dev = sb->st_dev;
+    file->inode = sb->st_ino;
+    file->size = sb->st_size;
+    file->mtime = (int64_t) sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+}
+
+static uint8_t same_file(const struct index_file *a, const struct index_file *b)
+{
+    return a->dev == b->dev && a->inode == b->inode &&
+           a->size == b->size && a->mtime == b->mtime;
+}
+
+static uint64_t new_generation(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return ((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec) ^ ((uint64_t) getpid() << 48);
+}
+
+/**
+ * Merge the segments of an index in a new base without the dead files. The
+ * posting lists are merged, files are not read again.
+ */
+static uint8_t compact(const char *root, const char *real_root, const uint64_t filters)
+{
+    struct index *index = index_new(root, filters);
+    if (index == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    struct builder builder;
+    builder_init(&builder);
+
+    uint32_t *files = malloc((index->nb_files + 1) * sizeof(uint32_t));
+    uint32_t *new_ids = malloc((index->nb_files + 1) * sizeof(uint32_t));
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+
+    /* live files keep their order */
+    for (i = 0; i < index->nb_segments; i++) {
+        const struct segment *segment = &index->segments[i];
+
+        for (j = 0; j < segment->header->nb_files; j++) {
+            if (segment_is_dead(segment, j)) {
+                new_ids[segment->first + j] = NO_FILE_ID;
+                continue;
+            }
+
+            new_ids[segment->first + j] = builder.list->nb_files;
+            builder_add_file(&builder, segment_get_path(segment, j),
+                             segment->files[j].flags, &segment->files[j]);
+        }
+    }
+
+    for (i = 0; i < index->nb_segments; i++) {
+        const struct segment *segment = &index->segments[i];
+
+        for (j = 0; j < segment->header->nb_trigrams; j++) {
+            const struct index_trigram *trigram = &segment->trigrams[j];
+            uint32_t nb_files = decode_postings(segment, trigram, files);
+
+            for (k = 0; k < nb_files; k++) {
+                uint32_t new_id = new_ids[segment->first + files[k]];
+                if (new_id != NO_FILE_ID) {
+                    builder_add(&builder, trigram->trigram, new_id);
+                }
+            }
+        }
+    }
+
+    /* segments hold increasing ids, their lines are added in order too */
+    struct index_line *lines = NULL;
+    uint32_t max_lines = 0;
+    for (i = 0; i < index->nb_segments; i++) {
+        const struct segment *segment = &index->segments[i];
+
+        for (j = 0; j < segment->header->nb_symbols; j++) {
+            const struct index_symbol *symbol = &segment->symbols[j];
+            if (symbol->nb_lines > segment->header->lines_size) {
+                continue;
+            }
+            if (symbol->nb_lines > max_lines) {
+                max_lines = symbol->nb_lines;
+                lines = realloc(lines, max_lines * sizeof(struct index_line));
+            }
+
+            const char *name = segment_get_symbol(segment, symbol);
+            struct symbol *merged = NULL;
+            uint32_t nb_lines = decode_lines(segment, symbol, lines);
+
+            for (k = 0; k < nb_lines; k++) {
+                uint32_t new_id = new_ids[segment->first + lines[k].file];
+                if (new_id == NO_FILE_ID) {
+                    continue;
+                }
+
+                if (merged == NULL) {
+                    merged = builder_get_symbol(&builder, name, strlen(name));
+                }
+                symbol_add_line(merged, new_id, lines[k].line, lines[k].offset);
+            }
+        }
+    }
+    free(lines);
+
+    uint32_t nb_segments = index->nb_segments;
+    uint8_t status = write_segment(&builder, real_root, new_generation(), 0, filters);
+
+    /* deltas of the previous base are ignored from now on */
+    if (status == EXIT_SUCCESS) {
+        char path[PATH_MAX];
+        for (i = 1; i < nb_segments; i++) {
+            if (segment_path(real_root, i, path, sizeof(path), 0) == EXIT_SUCCESS) {
+                unlink(path);
+            }
+        }
+    }
+
+    free(new_ids);
+    free(files);
+    builder_free(&builder);
+    index_delete(index);
+
+    return status;
+}
+
+/**
+ * Compact in a child process holding the lock of the index, so that the
+ * refresh returns right away and other refreshes wait for the compaction.
+ */
+static void compact_in_background(const char *root, const char *real_root,
+                                  const uint64_t filters)
+{
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(compact(root, real_root, filters));
+    } else if (pid < 0) {
+        compact(root, real_root, filters);
+    }
+}
+
+
+/* QUERY **********************************************************************/
+static void branch_add(struct branch *this, const char *run, const size_t length)
+{
+    size_t i = 0;
+
+    for (i = 0; i + 3 <= length; i++) {
+        if (this->nb_trigrams == this->max_trigrams) {
+            this->max_trigrams = this->max_trigrams ? 2 * this->max_trigrams : 16;
+            this->trigrams = realloc(this->trigrams, this->max_trigrams * sizeof(uint32_t));
+        }
+
+        uint8_t a = run[i], b = run[i + 1], c = run[i + 2];
+        this->trigrams[this->nb_trigrams++] = (FOLD(a) << 16) | (FOLD(b) << 8) | FOLD(c);
+    }
+}
+
+static struct branch * query_add_branch(struct query *this)
+{
+    this->branches = realloc(this->branches, (this->nb_branches + 1) * sizeof(struct branch));
+    memset(&this->branches[this->nb_branches], 0, sizeof(struct branch));
+
+    return &this->branches[this->nb_branches++];
+}
+
+static const char * skip_bracket(const char *p)
+{
+    if (*p == '^') {
+        p++;
+    }
+    if (*p == ']') {
+        p++;
+    }
+
+    while (*p && *p != ']') {
+        /* character classes, collating symbols and equivalence classes */
+        if (p[0] == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+            char end = p[1];
+            p += 2;
+            while (*p && !(p[0] == end && p[1] == ']')) {
+                p++;
+            }
+            if (*p) {
+                p += 2;
+            }
+            continue;
+        }
+        p++;
+    }
+
+    return *p ? p + 1 : p;
+}
+
+static const char * skip_group(const char *p)
+{
+    uint32_t depth = 1;
+
+    while (*p && depth) {
+        if (p[0] == '\\' && p[1]) {
+            if (p[1] == '(') {
+                depth++;
+            } else if (p[1] == ')') {
+                depth--;
+            }
+            p += 2;
+        } else if (*p == '[') {
+            p = skip_bracket(p + 1);
+        } else {
+            p++;
+        }
+    }
+
+    return p;
+}
+
+/**
+ * Get the literal runs a basic regular expression can't match without, by
+ * branch of its top level alternatives. Anything that isn't a plain
+ * character ends a run, and repeated characters that may not appear are
+ * dropped from it: the trigrams are a superset filter, the matcher decides.
+ */
+static void parse_regex(struct query *this, const char *pattern)
+{
+    char *run = calloc(strlen(pattern) + 1, sizeof(char));
+    size_t length = 0;
+    struct branch *branch = query_add_branch(this);
+    const char *p = pattern;
+
+    while (*p) {
+        char c = *p++;
+
+        if (c == '\\' && *p) {
+            char next = *p++;
+
+            if (next == '(') {
+                branch_add(branch, run, length);
+                length = 0;
+                p = skip_group(p);
+            } else if (next == '|') {
+                branch_add(branch, run, length);
+                length = 0;
+                branch = query_add_branch(this);
+            } else if (next == '{' || next == '?') {
+                /* the previous character may not be there */
+                if (length) {
+                    length--;
+                }
+                branch_add(branch, run, length);
+                length = 0;
+                while (next == '{' && *p && !(p[0] == '\\' && p[1] == '}')) {
+                    p++;
+                }
+                if (next == '{' && *p) {
+                    p += 2;
+                }
+            } else if (next == '+') {
+                branch_add(branch, run, length);
+                length = 0;
+            } else if ((next >= '0' && next <= '9') || (next >= 'a' && next <= 'z') ||
+                       (next >= 'A' && next <= 'Z') || strchr("<>`'", next)) {
+                /* classes, anchors and back references */
+                branch_add(branch, run, length);
+                length = 0;
+            } else {
+                run[length++] = next;
+            }
+            continue;
+        }
+
+        switch (c) {
+        case '*':
+            if (length) {
+                length--;
+            }
+            /* fall through */
+        case '.':
+        case '^':
+        case '$':
+            branch_add(branch, run, length);
+            length = 0;
+            break;
+
+        case '[':
+            branch_add(branch, run, length);
+            length = 0;
+            p = skip_bracket(p);
+            break;
+
+        default:
+            run[length++] = c;
+            break;
+        }
+    }
+
+    branch_add(branch, run, length);
+    free(run);
+}
+
+
+/* API ************************************************************************/
+/**
+ * Index the files a search of root would look into, in the cache. If root is
+ * indexed already with the same filters, only the files whose metadata
+ * changed are read again and saved in a new segment.
+ */
+uint8_t index_build(const char *root, const struct config *config)
+{
+    char real_root[PATH_MAX];
+    char path[PATH_MAX];
+
+    if (realpath(root, real_root) == NULL ||
+        file_utils_cache_path(real_root, "lock", path, sizeof(path), 1) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    /* one refresh or compaction of an index at a time */
+    int lock = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock < 0 || flock(lock, LOCK_EX) < 0) {
+        if (lock >= 0) {
+            close(lock);
+        }
+        return EXIT_FAILURE;
+    }
+
+    struct file_list *list = file_list_new();
+    if (file_list_crawl(list, root, config) == EXIT_FAILURE) {
+        file_list_delete(list);
+        close(lock);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t filters = config_hash_filters(config);
+    struct index *previous = index_new(root, filters);
+    uint8_t *seen = NULL;
+    if (previous) {
+        seen = calloc(previous->nb_files + 1, sizeof(uint8_t));
+    }
+
+    struct builder builder;
+    builder_init(&builder);
+
+    char file_path[PATH_MAX];
+    size_t root_length = strlen(root);
+    memcpy(file_path, root, root_length);
+    if (root[root_length - 1] != '/') {
+        file_path[root_length++] = '/';
+    }
+
+    uint32_t nb_changed = 0;
+    uint32_t nb_removed = 0;
+    uint32_t i = 0;
+    for (i = 0; i < list->nb_files; i++) {
+        const char *file = file_list_get_path(list, i);
+        size_t length = strlen(file);
+        if (root_length + length >= PATH_MAX) {
+            continue;
+        }
+        memcpy(&file_path[root_length], file, length + 1);
+
+        struct stat sb;
+        struct index_file metadata;
+        if (stat(file_path, &sb) < 0) {
+            continue;
+        }
+        stat_file(&sb, &metadata);
+
+        uint32_t id = previous ? index_find_file(previous, file) : NO_FILE_ID;
+        if (id != NO_FILE_ID) {
+            uint32_t segment_file = 0;
+            const struct segment *segment = get_segment(previous, id, &segment_file);
+
+            seen[id] = 1;
+            if (same_file(&segment->files[segment_file], &metadata)) {
+                continue;
+            }
+            builder_add_tombstone(&builder, segment - previous->segments, segment_file);
+        }
+
+        index_file_contents(&builder, file_path, builder.list->nb_files);
+        builder_add_file(&builder, file, file_list_get_flags(list, i), &metadata);
+        nb_changed++;
+    }
+
+    /* files gone since the last refresh */
+    uint32_t j = 0;
+    for (i = 0; previous && i < previous->nb_segments; i++) {
+        const struct segment *segment = &previous->segments[i];
+
+        for (j = 0; j < segment->header->nb_files; j++) {
+            if (!segment_is_dead(segment, j) && !seen[segment->first + j]) {
+                builder_add_tombstone(&builder, i, j);
+                nb_removed++;
+            }
+        }
+    }
+
+    uint8_t status = EXIT_SUCCESS;
+    uint8_t compaction = 0;
+    if (previous == NULL) {
+        status = write_segment(&builder, real_root, new_generation(), 0, filters);
+    } else if (nb_changed || nb_removed) {
+        status = write_segment(&builder, real_root, previous->segments[0].header->generation,
+                               previous->nb_segments, filters);
+
+        uint32_t nb_dead = previous->nb_dead + builder.nb_tombstones;
+        compaction = previous->nb_segments + 1 > MAX_SEGMENTS ||
+                     4 * nb_dead > previous->nb_files + nb_changed;
+    }
+
+    if (status == EXIT_SUCCESS) {
+        printf("Indexed %u files, %u changed, %u removed\n", list->nb_files, nb_changed, nb_removed);
+    }
+
+    builder_free(&builder);
+    free(seen);
+    if (previous) {
+        index_delete(previous);
+    }
+    file_list_delete(list);
+
+    if (status == EXIT_SUCCESS && compaction) {
+        compact_in_background(root, real_root, filters);
+    }
+    close(lock);
+
+    return status;
+}
+
+uint32_t index_get_nb_files(const struct index *this)
+{
+    return this->nb_files;
+}
+
+/**
+ * Path of a file relative to the root.
+ */
+const char * index_get_path(const struct index *this, const uint32_t file)
+{
+    uint32_t segment_file = 0;
+    const struct segment *segment = get_segment(this, file, &segment_file);
+
+    return segment_get_path(segment, segment_file);
+}
+
+uint8_t index_get_flags(const struct index *this, const uint32_t file)
+{
+    uint32_t segment_file = 0;
+    const struct segment *segment = get_segment(this, file, &segment_file);
+
+    return segment->files[segment_file].flags;
+}
+
+/**
+ * Get the id of the live file of the index at path, relative to the root.
+ * Returns UINT32_MAX if it isn't indexed.
+ */
+uint32_t index_find_file(const struct index *this, const char *path)
+{
+    return path_table_find(&this->paths, this, path);
+}
+
+/**
+ * Check that a file didn't change since it was indexed, for its trigrams and
+ * lines to be trusted.
+ */
+uint8_t index_is_current(const struct index *this, const uint32_t file, const struct stat *sb)
+{
+    uint32_t segment_file = 0;
+    const struct segment *segment = get_segment(this, file, &segment_file);
+    struct index_file metadata;
+
+    stat_file(sb, &metadata);
+
+    return same_file(&segment->files[segment_file], &metadata);
+}
+
+/**
+ * Get the lines of the live files of the index a symbol appears on, by
+ * increasing file and line. Lines is allocated, to be freed by the caller.
+ */
+uint32_t index_find_symbol(const struct index *this, const char *name,
+                           struct index_line **lines)
+{
+    uint32_t nb_lines = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    *lines = NULL;
+    for (i = 0; i < this->nb_segments; i++) {
+        const struct segment *segment = &this->segments[i];
+        const struct index_symbol *symbol = find_symbol(segment, name);
+        if (symbol == NULL || symbol->nb_lines > segment->header->lines_size) {
+            continue;
+        }
+
+        *lines = realloc(*lines, (nb_lines + symbol->nb_lines) * sizeof(struct index_line));
+        struct index_line *decoded = *lines + nb_lines;
+        uint32_t nb_decoded = decode_lines(segment, symbol, decoded);
+
+        for (j = 0; j < nb_decoded; j++) {
+            struct index_line line = decoded[j];
+            if (!segment_is_dead(segment, line.file)) {
+                line.file += segment->first;
+                (*lines)[nb_lines++] = line;
+            }
+        }
+    }
+
+    return nb_lines;
+}
+
+/**
+ * Get the increasing ids of the files that may contain matches of pattern,
+ * literal or a basic regular expression. Files is allocated, to be freed by
+ * the caller.
+ */
+uint32_t index_query(const struct index *this, const char *pattern,
+                     const uint8_t regex, uint32_t **files)
+{
+    struct query query = {0};
+    uint32_t nb_files = 0;
+    uint32_t i = 0;
+
+    if (regex) {
+        parse_regex(&query, pattern);
+    } else {
+        branch_add(query_add_branch(&query), pattern, strlen(pattern));
+    }
+
+    /* a branch without trigrams can match anything */
+    uint8_t all_files = 0;
+    for (i = 0; i < query.nb_branches; i++) {
+        all_files |= query.branches[i].nb_trigrams == 0;
+    }
+
+    *files = malloc((this->nb_files + 1) * sizeof(uint32_t));
+    for (i = 0; i < this->nb_segments; i++) {
+        nb_files += segment_query(&this->segments[i], &query, all_files, *files + nb_files);
+    }
+
+    for (i = 0; i < query.nb_branches; i++) {
+        free(query.branches[i].trigrams);
+    }
+    free(query.branches);
+
+    return nb_files;
+}
+
+
+/* CONSTRUCTOR ****************************************************************/
+/**
+ * Map the segments of the index of root from the cache. Returns NULL if
+ * there is none, or if its files were listed with other filters than the
+ * ones hashed by config_hash_filters.
+ */
+struct index * index_new(const char *root, const uint64_t filters)
+{
+    char real_root[PATH_MAX];
+    char path[PATH_MAX];
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    if (realpath(root, real_root) == NULL) {
+        return NULL;
+    }
+
+    struct index *this = calloc(1, sizeof(struct index));
+    for (i = 0; segment_path(real_root, i, path, sizeof(path), 0) == EXIT_SUCCESS; i++) {
+        struct segment segment;
+        if (segment_open(&segment, path, real_root, filters) == EXIT_FAILURE) {
+            break;
+        }
+
+        /* deltas left by a base compacted since */
+        if (segment.header->segment != i ||
+            (i > 0 && segment.header->generation != this->segments[0].header->generation)) {
+            segment_close(&segment);
+            break;
+        }
+
+        segment.first = this->nb_files;
+        this->segments = realloc(this->segments, (i + 1) * sizeof(struct segment));
+        this->segments[i] = segment;
+        this->nb_segments++;
+        this->nb_files += segment.header->nb_files;
+    }
+
+    if (this->nb_segments == 0) {
+        free(this);
+        return NULL;
+    }
+
+    /* files replaced or removed by later segments */
+    for (i = 0; i < this->nb_segments; i++) {
+        const struct segment *segment = &this->segments[i];
+
+        for (j = 0; j < segment->header->nb_tombstones; j++) {
+            const struct index_tombstone *tombstone = &segment->tombstones[j];
+            if (tombstone->segment >= i ||
+                tombstone->file >= this->segments[tombstone->segment].header->nb_files) {
+                continue;
+            }
+
+            struct segment *dead = &this->segments[tombstone->segment];
+            if (!segment_is_dead(dead, tombstone->file)) {
+                dead->dead[tombstone->file / 64] |= 1ULL << (tombstone->file % 64);
+                this->nb_dead++;
+            }
+        }
+    }
+
+    path_table_init(&this->paths, this);
+
+    return this;
+}
+
+void index_delete(struct index *this)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < this->nb_segments; i++) {
+        segment_close(&this->segments[i]);
+    }
+    free(this->paths.slots);
+    free(this->segments);
+    free(this);
+}
@@ -1,16 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "search.h"
 #include "entries.h"
 #include "display.h"
+#include "export.h"
 #include "failure.h"
+#include "git.h"
+#include "index.h"
+#include "pool.h"
+#include "server.h"
+#include "snapshot.h"
+#include "stream.h"
 
 
 struct search *current_search = NULL;
+struct pool *pool = NULL;
 
 
 /* USAGE **********************************************************************/
@@ -22,14 +32,35 @@ static void usage(void)
     printf(" -e : regex search\n");
     printf(" -r : raw search, ignores extensions restrictions\n");
     printf(" -f : follow symlinks\n");
+    printf(" -w : match whole words only, identifiers are looked up in the index\n");
     printf(" -o <ext> : only look in files withs this extension\n");
     printf(" -t <ext> : add extension to default extension list\n");
     printf(" -x <dirname> : exclude directories\n");
+    printf(" -W <size> : keep a window of size characters around the match of long lines (default 512)\n");
+    printf(" -L : keep full lines instead of a window around the match\n");
+    printf(" -A <num> : show num lines of context after matches\n");
+    printf(" -B <num> : show num lines of context before matches\n");
+    printf(" -C <num> : show num lines of context around matches\n");
+    printf(" --max-mem <size>[K|M|G] : spill results to a temporary file past this memory budget\n");
+    printf(" --index [directory] : build or refresh the trigram index of a directory, used by its next searches\n");
+    printf(" --no-index : search all the files even if the directory is indexed\n");
+    printf(" --serve [directory] : answer the searches of a directory and its subdirectories from a server knowing its files\n");
+    printf(" --no-server : search locally even if a server answers for the directory\n");
+    printf(" --watch : keep the results up to date as the files searched change\n");
+    printf(" --snapshot : list the files from a snapshot of the directory, reading only the directories changed since\n");
+    printf(" --no-ignore : search the files ignored by the .gitignore and .ignore files too\n");
+    printf(" --git : search only the files tracked by git, listed from the index of the checkout\n");
+    printf(" --files-from <file> : search the files listed in file (- for stdin), separated by newlines or nul characters\n");
+    printf(" --load <file> : browse results saved with P instead of searching\n");
+    printf(" --stream[=text|json] : write results to stdout as they're found instead of browsing them\n");
     printf("\n");
     printf("subsearch options (use when inside ngp):\n");
     printf("/ : search results for this new pattern\n");
     printf("\\ : exclude this pattern from the results\n");
-    printf("p : dump current search results in ngp.out\n");
+    printf("p : save current search results in ngp.out (ngp.1.out... if it exists)\n");
+    printf("P : save current search results in ngp.res, to be reopened with --load\n");
+    printf("v : toggle a preview of the lines around the selected entry\n");
+    printf("r : replace the main pattern, searching the same files again\n");
 }
 
 
@@ -47,33 +78,117 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    struct entries *entries = entries_new();
+    if (config->build_index) {
+        uint8_t status = index_build(config->directory, config);
+        if (status == EXIT_FAILURE) {
+            fprintf(stderr, "Failed indexing %s\n", config->directory);
+        }
+        config_delete(config);
+        return status;
+    }
+
+    if (config->serve) {
+        uint8_t status = server_serve(config->directory, config);
+        if (status == EXIT_FAILURE) {
+            fprintf(stderr, "Failed serving %s\n", config->directory);
+        }
+        config_delete(config);
+        return status;
+    }
+
+    entries_set_max_memory(config->max_memory);
+    pool = pool_new(0);
+
+    struct entries *entries = NULL;
+    if (config->load_path) {
+        entries = export_load(config->load_path, config);
+        if (entries == NULL) {
+            fprintf(stderr, "Failed loading results from %s\n", config->load_path);
+            return EXIT_FAILURE;
+        }
+    } else {
+        entries = entries_new();
+    }
+
     struct search *search = search_new(config->directory, config->pattern, entries, config);
     if (search == NULL) {
         return EXIT_FAILURE;
     }
     current_search = search;
 
-    pthread_t search_thread;
-    pthread_create(&search_thread, NULL, search_thread_start, (void *) search);
+    /* a server of the directory, or of a parent, searches its files instead */
+    if (!config->load_path && !config->no_server && !config->watch) {
+        search->server = server_search(config->directory, argc, argv);
+    }
+
+    /* files listed from the git index or from a snapshot, the directory is
+       crawled if there's none, watched searches crawl to know their directories */
+    struct file_list *files = NULL;
+    if (!config->load_path && !config->watch && search->server < 0) {
+        if (config->git) {
+            files = git_list(config->directory);
+        }
+        if (files == NULL && config->snapshot) {
+            files = snapshot_list(config->directory, config);
+        }
+        search->files = files;
+        search->files_prefix = "";
+    }
+
+    /* loaded results are complete already, their search is started only if
+       its pattern is replaced in the display */
+    if (config->load_path) {
+        search->status = 0;
+    } else {
+        search_start(search);
+    }
 
 #ifndef _PERFORMANCE_TEST
-    struct display *display = display_new(NULL, search_get_pattern(search));
-    display_loop(display, search);
-    display_delete(display);
-    search_stop(search);
+    struct display *display = NULL;
+#endif
+    if (config->stream_format) {
+        stream_loop(search, config->stream_format);
+    }
+#ifndef _PERFORMANCE_TEST
+    else {
+        /* the keys are read from the terminal when the files are listed on stdin */
+        if (config->files_from && strcmp(config->files_from, "-") == 0) {
+            int tty = open("/dev/tty", O_RDONLY | O_CLOEXEC);
+            if (tty >= 0) {
+                dup2(tty, STDIN_FILENO);
+                close(tty);
+            }
+        }
+
+        display = display_new(NULL, search_get_pattern(search));
+        display_loop(display, search);
+        search_stop(search);
+    }
 #endif
 
-    pthread_join(search_thread, NULL);
+    search_join(search);
+
+    /* the entries of a pattern replaced in the display are the search's */
+    entries = search->entries;
 
 #ifdef _PERFORMANCE_TEST
     uint32_t nb_lines = entries_get_nb_lines(entries);
-    uint32_t nb_files = entries_get_nb_entries(entries) - nb_lines;
+    uint32_t nb_files = entries_get_nb_files(entries);
     printf("Found %d files, %d lines\n", nb_files, nb_lines);
 #endif
 
+    pool_delete(pool);
+#ifndef _PERFORMANCE_TEST
+    /* the threads signaling updates to the display are done */
+    if (display) {
+        display_delete(display);
+    }
+#endif
     entries_delete(entries);
     search_delete(search);
+    if (files) {
+        file_list_delete(files);
+    }
     config_delete(config);
     failure_display();
 
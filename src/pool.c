@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+
+/**
+ * A batch of jobs run by the workers of the pool.
+ * Jobs of a batch are started in order of their index, batches in order of
+ * submission. Jobs signal their own completion to whoever submitted them.
+ */
+struct batch {
+    void (*job)(void *context, const uint32_t index);
+    void *context;
+    uint32_t nb_jobs;
+    uint32_t next;          // index of the next job to start
+    struct batch *next_batch;
+};
+
+struct pool {
+    pthread_t *threads;
+    uint32_t nb_threads;
+    uint8_t stop;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct batch *first;
+    struct batch *last;
+};
+
+
+/* WORKERS ********************************************************************/
+static void * pool_thread_start(void *context)
+{
+    struct pool *this = context;
+
+    pthread_mutex_lock(&this->mutex);
+    while (1) {
+        while (!this->stop && this->first == NULL) {
+            pthread_cond_wait(&this->cond, &this->mutex);
+        }
+
+        if (this->stop) {
+            break;
+        }
+
+        /* claim the next job, the batch is forgotten once all are claimed */
+        struct batch *batch = this->first;
+        uint32_t index = batch->next++;
+        void (*job)(void *, const uint32_t) = batch->job;
+        void *job_context = batch->context;
+
+        if (batch->next == batch->nb_jobs) {
+            this->first = batch->next_batch;
+            if (this->first == NULL) {
+                this->last = NULL;
+            }
+            free(batch);
+        }
+
+        pthread_mutex_unlock(&this->mutex);
+        job(job_context, index);
+        pthread_mutex_lock(&this->mutex);
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    return NULL;
+}
+
+
+/* API ************************************************************************/
+void pool_submit(struct pool *this,
+                 void (*job)(void *context, const uint32_t index),
+                 void *context, const uint32_t nb_jobs)
+{
+    if (nb_jobs == 0) {
+        return;
+    }
+
+    struct batch *batch = calloc(1, sizeof(struct batch));
+    batch->job = job;
+    batch->context = context;
+    batch->nb_jobs = nb_jobs;
+
+    pthread_mutex_lock(&this->mutex);
+    if (this->last) {
+        this->last->next_batch = batch;
+    } else {
+        this->first = batch;
+    }
+    this->last = batch;
+    pthread_cond_broadcast(&this->cond);
+    pthread_mutex_unlock(&this->mutex);
+}
+
+
+/* CONSTRUCTOR ****************************************************************/
+/**
+ * Start a pool of nb_threads workers, or one per CPU if nb_threads is 0.
+ */
+struct pool * pool_new(uint32_t nb_threads)
+{
+    if (nb_threads == 0) {
+        long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nb_threads = nb_cpus > 0 ? nb_cpus : 1;
+    }
+
+    struct pool *this = calloc(1, sizeof(struct pool));
+    this->threads = calloc(nb_threads, sizeof(pthread_t));
+    this->nb_threads = nb_threads;
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_cond_init(&this->cond, NULL);
+
+    uint32_t i = 0;
+    for (i = 0; i < nb_threads; i++) {
+        pthread_create(&this->threads[i], NULL, pool_thread_start, (void *) this);
+    }
+
+    return this;
+}
+
+/**
+ * Stop the workers. Jobs that weren't started are dropped.
+ */
+void pool_delete(struct pool *this)
+{
+    pthread_mutex_lock(&this->mutex);
+    this->stop = 1;
+    pthread_cond_broadcast(&this->cond);
+    pthread_mutex_unlock(&this->mutex);
+
+    uint32_t i = 0;
+    for (i = 0; i < this->nb_threads; i++) {
+        pthread_join(this->threads[i], NULL);
+    }
+
+    while (this->first) {
+        struct batch *batch = this->first;
+        this->first = batch->next_batch;
+        free(batch);
+    }
+
+    pthread_cond_destroy(&this->cond);
+    pthread_mutex_destroy(&this->mutex);
+    free(this->threads);
+    free(this);
+}
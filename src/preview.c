@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "preview.h"
+
+
+#define PREVIEW_CACHE_SIZE  8   // files kept mapped
+
+
+/**
+ * A file mapped for previews. Offsets of its lines are indexed lazily, up to
+ * the last line asked for.
+ */
+struct mapped_file {
+    char *path;
+    char *data;
+    size_t size;
+    uint64_t last_use;
+
+    /* the file is mapped again once it changed */
+    dev_t dev;
+    ino_t inode;
+    struct timespec mtime;
+
+    size_t *lines;          // offset of the start of each line
+    uint32_t nb_lines;      // lines indexed so far
+    uint32_t max_lines;
+    uint8_t indexed;        // if all the lines were indexed
+};
+
+/**
+ * Least recently used files mapped to preview the lines around entries,
+ * without reading the files again as the cursor moves.
+ */
+struct preview {
+    struct mapped_file files[PREVIEW_CACHE_SIZE];
+    uint64_t clock;
+};
+
+
+/* MAPPED FILES ***************************************************************/
+static void mapped_file_close(struct mapped_file *file)
+{
+    if (file->data) {
+        munmap(file->data, file->size);
+    }
+    free(file->lines);
+    free(file->path);
+    memset(file, 0, sizeof(struct mapped_file));
+}
+
+static uint8_t mapped_file_open(struct mapped_file *file, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    /* empty files are kept without a mapping, they don't have lines */
+    char *data = NULL;
+    if (sb.st_size > 0) {
+        data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return EXIT_FAILURE;
+        }
+    }
+    close(fd);
+
+    file->path = strdup(path);
+    file->data = data;
+    file->size = sb.st_size;
+    file->dev = sb.st_dev;
+    file->inode = sb.st_ino;
+    file->mtime = sb.st_mtim;
+    file->indexed = sb.st_size == 0;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Check that a mapped file is still the one at its path, with the same
+ * contents: files edited from the display or watched change meanwhile, and
+ * reading past the end of a truncated file faults.
+ */
+static uint8_t mapped_file_is_current(const struct mapped_file *file)
+{
+    struct stat sb;
+
+    return stat(file->path, &sb) == 0 &&
+           sb.st_dev == file->dev && sb.st_ino == file->inode &&
+           (size_t) sb.st_size == file->size &&
+           sb.st_mtim.tv_sec == file->mtime.tv_sec && sb.st_mtim.tv_nsec == file->mtime.tv_nsec;
+}
+
+/**
+ * Index the lines of a file up to line (1-based), or to its end.
+ */
+static void mapped_file_index(struct mapped_file *file, const uint32_t line)
+{
+    size_t offset = 0;
+    if (file->nb_lines) {
+        char *end = memchr(file->data + file->lines[file->nb_lines - 1], '\n',
+                           file->size - file->lines[file->nb_lines - 1]);
+        offset = end ? (size_t) (end - file->data) + 1 : file->size;
+    }
+
+    while (!file->indexed && file->nb_lines < line) {
+        if (offset >= file->size) {
+            file->indexed = 1;
+            break;
+        }
+
+        if (file->nb_lines == file->max_lines) {
+            file->max_lines = file->max_lines ? 2 * file->max_lines : 1024;
+            file->lines = realloc(file->lines, file->max_lines * sizeof(size_t));
+        }
+        file->lines[file->nb_lines++] = offset;
+
+        char *end = memchr(file->data + offset, '\n', file->size - offset);
+        offset = end ? (size_t) (end - file->data) + 1 : file->size;
+    }
+}
+
+/**
+ * Get a file from the cache, mapping it in place of the least recently used
+ * one if it isn't there. A file changed since it was mapped is mapped again.
+ */
+static struct mapped_file * get_file(struct preview *this, const char *path)
+{
+    struct mapped_file *lru = &this->files[0];
+    uint32_t i = 0;
+
+    this->clock++;
+    for (i = 0; i < PREVIEW_CACHE_SIZE; i++) {
+        struct mapped_file *file = &this->files[i];
+
+        if (file->path && strcmp(file->path, path) == 0) {
+            if (!mapped_file_is_current(file)) {
+                lru = file;
+                break;
+            }
+            file->last_use = this->clock;
+            return file;
+        }
+
+        if (file->last_use < lru->last_use) {
+            lru = file;
+        }
+    }
+
+    mapped_file_close(lru);
+    if (mapped_file_open(lru, path) == EXIT_FAILURE) {
+        return NULL;
+    }
+    lru->last_use = this->clock;
+
+    return lru;
+}
+
+
+/* API ************************************************************************/
+/**
+ * Get line number line (1-based) of a file, and its length without the
+ * newline. The line is not nul terminated. Returns NULL if there is no such
+ * line or if the file can't be read.
+ */
+const char * preview_get_line(struct preview *this, const char *path,
+                              const uint32_t line, size_t *length)
+{
+    struct mapped_file *file = get_file(this, path);
+    if (file == NULL || line == 0) {
+        return NULL;
+    }
+
+    mapped_file_index(file, line);
+    if (line > file->nb_lines) {
+        return NULL;
+    }
+
+    const char *start = file->data + file->lines[line - 1];
+    const char *end = memchr(start, '\n', file->size - file->lines[line - 1]);
+    *length = end ? (size_t) (end - start) : file->size - file->lines[line - 1];
+
+    return start;
+}
+
+
+/**
+ * Forget the files mapped, after they may have been edited.
+ */
+void preview_clear(struct preview *this)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < PREVIEW_CACHE_SIZE; i++) {
+        mapped_file_close(&this->files[i]);
+    }
+}
+
+
+/* CONSTRUCTOR ****************************************************************/
+struct preview * preview_new(void)
+{
+    return calloc(1, sizeof(struct preview));
+}
+
+void preview_delete(struct preview *this)
+{
+    preview_clear(this);
+    free(this);
+}
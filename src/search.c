@@ -2,7 +2,9 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 
+#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
@@ -11,47 +13,222 @@
 #include <sys/mman.h>
 
 #include <regex.h>
+#include <pthread.h>
 
 #include "search.h"
 #include "entries.h"
 #include "config.h"
 #include "failure.h"
 #include "file_utils.h"
+#include "ignore.h"
+#include "index.h"
+#include "file_list.h"
 #include "search_algorithm.h"
+#include "server.h"
+#include "snapshot.h"
 #include "tree.h"
+#include "watch.h"
 
 
 extern struct search *current_search;
 
 
+#define UTF8_CONTINUATION(c)    (((uint8_t) (c) & 0xc0) == 0x80)
+#define LIST_BUFFER_SIZE        65536   // longer than any path listed
+#define LIST_POLL_DELAY         100     // time between checks that the search was stopped (ms)
+
+
+/* ENTRIES ********************************************************************/
+/**
+ * Wake up the display and the subsearches once entries were added. A watched
+ * search shows them through its view.
+ */
+static void notify_entries(struct search *this)
+{
+    if (this->watched) {
+        entries_follow(this->watched);
+        entries_notify(this->watched);
+    } else {
+        entries_notify(this->entries);
+    }
+}
+
+/**
+ * Add a matching line to the entries along with the spans of all its matches.
+ * Long lines are truncated to a window centered on the first match since only
+ * a few columns will ever be displayed.
+ */
+static void add_line(struct search *this, const uint32_t line_number,
+                     const char *line, const size_t line_len, const char *match)
+{
+    size_t offset = 0;
+    size_t size = line_len;
+
+    if (!this->full_lines && line_len > this->window_size) {
+        size_t match_offset = match - line;
+        size = this->window_size;
+
+        if (match_offset > size / 2) {
+            offset = match_offset - size / 2;
+        }
+        if (offset + size > line_len) {
+            offset = line_len - size;
+        }
+
+        /* don't cut multibyte characters in half */
+        while (offset > 0 && UTF8_CONTINUATION(line[offset])) {
+            offset--;
+            size++;
+        }
+        while (offset + size < line_len && UTF8_CONTINUATION(line[offset + size])) {
+            size--;
+        }
+    }
+
+    /* record the matches now so that the display never has to search again */
+    struct span spans[MAX_SPANS];
+    uint16_t nb_spans = search_algorithm_spans(this, line + offset, size,
+                                               offset ? REG_NOTBOL : 0,
+                                               spans, MAX_SPANS);
+
+    /* clip the last match to the window */
+    if (nb_spans && spans[nb_spans - 1].start + spans[nb_spans - 1].length > size) {
+        spans[nb_spans - 1].length = size - spans[nb_spans - 1].start;
+    }
+
+    entries_add_window(this->entries, line_number, line + offset, size,
+                       line_len, offset, spans, nb_spans);
+}
+
+
+/* CONTEXT ********************************************************************/
+/**
+ * State of the scan of a file. Lines around matches are added as context:
+ * the last lines seen are kept in a ring, as spans of the mapped file, so
+ * that lines before a match can be added once it's found, and lines after a
+ * match are added in a single batch.
+ */
+struct scan {
+    const char *file;
+    uint8_t first;              // file not added yet
+    uint32_t last_added;        // last line added to the entries
+    uint32_t after_left;        // lines to add after the last match
+    uint32_t nb_pending;        // lines after the last match not added yet
+};
+
+static void ring_store(struct search *this, const uint32_t line_number,
+                       const char *line, const size_t line_len)
+{
+    if (this->context_ring_size == 0) {
+        return;
+    }
+
+    struct context_line *context = &this->context_ring[line_number % this->context_ring_size];
+    context->data = line;
+    context->length = line_len;
+    context->size = line_len;
+
+    /* context lines are kept from their start */
+    if (!this->full_lines && line_len > this->window_size) {
+        context->size = this->window_size;
+        while (context->size > 0 && UTF8_CONTINUATION(line[context->size])) {
+            context->size--;
+        }
+    }
+}
+
+/**
+ * Add nb_lines lines of context from the ring, starting at line first.
+ */
+static void add_context(struct search *this, const uint32_t first, const uint32_t nb_lines)
+{
+    uint32_t start = first % this->context_ring_size;
+    uint32_t nb_contiguous = this->context_ring_size - start;
+
+    if (nb_contiguous >= nb_lines) {
+        entries_add_context(this->entries, first, &this->context_ring[start], nb_lines);
+    } else {
+        entries_add_context(this->entries, first, &this->context_ring[start], nb_contiguous);
+        entries_add_context(this->entries, first + nb_contiguous, this->context_ring,
+                            nb_lines - nb_contiguous);
+    }
+}
+
+static void flush_context(struct search *this, struct scan *scan)
+{
+    if (scan->nb_pending) {
+        add_context(this, scan->last_added - scan->nb_pending + 1, scan->nb_pending);
+        scan->nb_pending = 0;
+    }
+}
+
+
 /* FILE PARSING ***************************************************************/
+static void parse_line(struct search *this, struct scan *scan,
+                       const uint32_t line_number, char *line, const size_t line_len)
+{
+    ring_store(this, line_number, line, line_len);
+
+    char *match = this->parser(this, line, line_len);
+    if (match != NULL) {
+
+        if (scan->first) {
+            /* add file */
+            entries_add(this->entries, 0, scan->file);
+            scan->first = 0;
+        }
+
+        /* context before the match that wasn't added after a previous one */
+        flush_context(this, scan);
+        uint32_t first = 1;
+        if (line_number > this->context_before) {
+            first = line_number - this->context_before;
+        }
+        if (first <= scan->last_added) {
+            first = scan->last_added + 1;
+        }
+        if (first < line_number) {
+            add_context(this, first, line_number - first);
+        }
+
+        add_line(this, line_number, line, line_len, match);
+        scan->last_added = line_number;
+        scan->after_left = this->context_after;
+
+    } else if (scan->after_left) {
+        scan->after_left--;
+        scan->nb_pending++;
+        scan->last_added = line_number;
+
+        if (scan->after_left == 0) {
+            flush_context(this, scan);
+        }
+    }
+}
+
 static void parse_file_contents(struct search *this, const char *file, char *p,
                                 const size_t p_len)
 {
     char *endline;
-    uint8_t first = 1;
     uint32_t line_number = 1;
     char *orig_p = p;
+    struct scan scan = {.file = file, .first = 1};
 
     size_t remaining_size = p_len;
 
     while ((endline = memchr(p, '\n', remaining_size))) {
+        /* big files are given up in the middle when the search is cancelled */
+        if (this->stop) {
+            return;
+        }
         *endline = '\0';
 
-        if (this->parser(this, p, endline - p) != NULL) {
-
-            if (first) {
-                /* add file */
-                entries_add(this->entries, 0, file);
-                first = 0;
-            }
-
-            entries_add(this->entries, line_number, p);
-        }
+        parse_line(this, &scan, line_number, p, endline - p);
 
         remaining_size -= (endline - p) + 1;
         p = endline + 1;
         if (p == orig_p + p_len) {
+            flush_context(this, &scan);
             return;
         }
 
@@ -69,15 +246,8 @@ static void parse_file_contents(struct search *this, const char *file, char *p,
         memcpy(buffer, p, remaining_size);
         buffer[remaining_size] = '\0';
 
-        if (this->parser(this, buffer, remaining_size) != NULL) {
-            if (first) {
-                /* add file */
-                entries_add(this->entries, 0, file);
-                first = 0;
-            }
-
-            entries_add(this->entries, line_number, buffer);
-        }
+        parse_line(this, &scan, line_number, buffer, remaining_size);
+        flush_context(this, &scan);
         free(buffer);
     }
 }
@@ -90,7 +260,8 @@ static uint8_t lookup_file(struct search *this, const char *file)
         return EXIT_FAILURE;
     }
 
-    int f = open(file, O_RDONLY);
+    /* symlinks are searched only when followed, listed files may be some */
+    int f = open(file, O_RDONLY | (this->follow_symlinks ? 0 : O_NOFOLLOW));
     if (f == -1) {
         return EXIT_FAILURE;
     }
@@ -102,6 +273,12 @@ static uint8_t lookup_file(struct search *this, const char *file)
         return EXIT_FAILURE;
     }
 
+    /* listed paths may be of directories or devices */
+    if (!S_ISREG(sb.st_mode)) {
+        close(f);
+        return EXIT_FAILURE;
+    }
+
     /* return if file is empty */
     if (sb.st_size == 0) {
         close(f);
@@ -116,8 +293,14 @@ static uint8_t lookup_file(struct search *this, const char *file)
     }
 
     char *pp = p;
+    uint32_t nb_entries = this->entries->nb_entries;
     parse_file_contents(this, file, p, sb.st_size);
 
+    /* wake up subsearches */
+    if (this->entries->nb_entries != nb_entries) {
+        notify_entries(this);
+    }
+
     if (munmap(pp, sb.st_size) < 0) {
         close(f);
         return EXIT_FAILURE;
@@ -129,13 +312,45 @@ static uint8_t lookup_file(struct search *this, const char *file)
 
 
 /* DIRECTORY PARSING **********************************************************/
-static uint32_t lookup_directory(struct search *this, const char *directory)
+/**
+ * Keep the path of a file found by the crawl relative to the directory, for
+ * the next patterns to search the same files without crawling again.
+ */
+static void record_file(struct search *this, const char *path, const uint8_t flags)
+{
+    if (this->crawled == NULL) {
+        return;
+    }
+
+    size_t directory_length = strlen(this->directory);
+    if (this->directory[directory_length - 1] != '/') {
+        directory_length++;
+    }
+
+    file_list_add(this->crawled, path + directory_length,
+                  strlen(path + directory_length), flags);
+}
+
+/**
+ * Search the files under a directory, but the ones the rules of its ignore
+ * files and of its parents' ignore: ignored subdirectories aren't opened.
+ */
+static uint32_t lookup_directory(struct search *this, const char *directory,
+                                 const struct ignore *parent)
 {
     DIR *dir_stream = opendir(directory);
     if (dir_stream == NULL) {
         return EXIT_FAILURE;
     }
 
+    if (this->directories) {
+        file_list_add(this->directories, directory, strlen(directory), 0);
+    }
+
+    struct ignore *rules = this->ignore_files ?
+                           ignore_new(parent, directory, strlen(directory)) : NULL;
+    const struct ignore *ignore = rules ? rules : parent;
+
     /* reusing the same buffer nets a considerable speedup in source searches */
     char dir_entry_path[PATH_MAX];
     size_t base_directory_name_len = strlen(directory);
@@ -157,46 +372,616 @@ static uint32_t lookup_directory(struct search *this, const char *directory)
         /* build subdirectory path */
         memcpy(&dir_entry_path[base_directory_name_len], directory_name, directory_name_len);
         dir_entry_path[base_directory_name_len + directory_name_len] = 0;
+        size_t dir_entry_path_len = base_directory_name_len + directory_name_len;
 
         if (dir_entry->d_type == DT_REG) {              // regular file
+            if (ignore && ignore_match(ignore, dir_entry_path, dir_entry_path_len, 0)) {
+                continue;
+            }
+            record_file(this, dir_entry_path, 0);
             lookup_file(this, dir_entry_path);
         } else if (dir_entry->d_type == DT_DIR) {       // folder
             /* exclude special directories */
-            if (is_string_in_tree_size(this->dir_exclusion_tree, directory_name, directory_name_len)) {
+            if (is_string_in_tree_size(this->dir_exclusion_tree, directory_name, directory_name_len) ||
+                (ignore && ignore_match(ignore, dir_entry_path, dir_entry_path_len, 1))) {
                 continue;
             }
-            lookup_directory(this, dir_entry_path);
+            lookup_directory(this, dir_entry_path, ignore);
         } else if (dir_entry->d_type&DT_LNK) {          // symlink
             /* default : ignore symlinks */
-            if (this->follow_symlinks) {
+            if (this->follow_symlinks &&
+                !(ignore && ignore_match(ignore, dir_entry_path, dir_entry_path_len, 0))) {
+                record_file(this, dir_entry_path, file_list_symlink);
                 lookup_file(this, dir_entry_path);
             }
         }
     }
 
     closedir(dir_stream);
+    if (rules) {
+        ignore_delete(rules);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Search a path under the directory again, matched against the rules of the
+ * ignore files of the directories down to it. The rules of the first length
+ * characters of the path are read already.
+ */
+static void rescan_path(struct search *this, const char *path, const size_t length,
+                        const struct ignore *ignore)
+{
+    const char *slash = path[length] ? strchr(path + length + 1, '/') : NULL;
+    if (slash && this->ignore_files) {
+        struct ignore *rules = ignore_new(ignore, path, slash - path);
+        rescan_path(this, path, slash - path, rules ? rules : ignore);
+        if (rules) {
+            ignore_delete(rules);
+        }
+        return;
+    }
+
+    struct stat sb;
+    if (lstat(path, &sb) < 0) {
+        return;
+    }
+
+    size_t path_length = strlen(path);
+    if (S_ISDIR(sb.st_mode)) {
+        const char *name = strrchr(path, '/');
+        name = name ? name + 1 : path;
+        if (!is_string_in_tree_size(this->dir_exclusion_tree, name, strlen(name)) &&
+            !(ignore && ignore_match(ignore, path, path_length, 1))) {
+            lookup_directory(this, path, ignore);
+        }
+    } else if ((S_ISREG(sb.st_mode) || (S_ISLNK(sb.st_mode) && this->follow_symlinks)) &&
+               !(ignore && ignore_match(ignore, path, path_length, 0))) {
+        lookup_file(this, path);
+    }
+}
+
+
+/* INDEX PARSING **************************************************************/
+/**
+ * Check if a path relative to the root is under an excluded directory.
+ */
+static uint8_t is_excluded(const struct search *this, const char *path)
+{
+    const char *slash = NULL;
+
+    while ((slash = strchr(path, '/')) != NULL) {
+        size_t length = slash - path;
+
+        /* listed paths may go through the current or parent directory */
+        if ((length > 2 || strncmp(path, "..", length) != 0) &&
+            is_string_in_tree_size(this->dir_exclusion_tree, path, length)) {
+            return 1;
+        }
+        path = slash + 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Build the path of a file relative to the directory in path, of size
+ * PATH_MAX, absolute paths of listed files are kept. Returns EXIT_FAILURE if
+ * the search skips it.
+ */
+static uint8_t get_path(const struct search *this, const char *relative,
+                        const uint8_t flags, char *path)
+{
+    size_t length = strlen(relative);
+    size_t directory_length = relative[0] == '/' ? 0 : strlen(this->directory);
+
+    if (length == 0 || directory_length + length + 1 >= PATH_MAX ||
+        ((flags & file_list_symlink) && !this->follow_symlinks) ||
+        is_excluded(this, relative)) {
+        return EXIT_FAILURE;
+    }
+
+    memcpy(path, this->directory, directory_length);
+    if (directory_length && this->directory[directory_length - 1] != '/') {
+        path[directory_length++] = '/';
+    }
+    memcpy(&path[directory_length], relative, length + 1);
 
     return EXIT_SUCCESS;
 }
 
+/**
+ * Get the id in the index of a listed file at path, relative to the
+ * directory, if it didn't change since it was indexed. Returns UINT32_MAX if
+ * the file has to be searched whole.
+ */
+static uint32_t get_current_file(const struct index *index, const char *relative,
+                                 const char *path)
+{
+    uint32_t file = index_find_file(index, relative);
+    struct stat sb;
+
+    if (file != UINT32_MAX && (stat(path, &sb) < 0 || !index_is_current(index, file, &sb))) {
+        return UINT32_MAX;
+    }
+
+    return file;
+}
+
+/**
+ * Search the files of the directory, listed by a snapshot, that the index
+ * tells may contain matches. Files changed or added since they were indexed
+ * are searched whole.
+ */
+static void lookup_index(struct search *this, const struct index *index,
+                         const struct file_list *listed)
+{
+    uint32_t *files = NULL;
+    uint32_t nb_files = index_query(index, this->pattern, this->regex != NULL, &files);
+    uint64_t *candidates = calloc(index_get_nb_files(index) / 64 + 1, sizeof(uint64_t));
+    char path[PATH_MAX];
+
+    uint32_t i = 0;
+    for (i = 0; i < nb_files; i++) {
+        candidates[files[i] / 64] |= 1ULL << (files[i] % 64);
+    }
+    free(files);
+
+    for (i = 0; i < file_list_get_nb_files(listed) && !this->stop; i++) {
+        const char *relative = file_list_get_path(listed, i);
+        if (get_path(this, relative, file_list_get_flags(listed, i), path) == EXIT_FAILURE) {
+            continue;
+        }
+
+        uint32_t file = get_current_file(index, relative, path);
+        if (file == UINT32_MAX || (candidates[file / 64] >> (file % 64)) & 1) {
+            lookup_file(this, path);
+        }
+    }
+
+    free(candidates);
+}
+
+/**
+ * Add the lines of a file the symbol index points to, reading only these
+ * lines. Files changed since they were indexed are searched whole.
+ */
+static void lookup_lines(struct search *this, const struct index *index, const char *file,
+                         const struct index_line *lines, const uint32_t nb_lines)
+{
+    if (!this->raw_search &&
+        !file_utils_check_extension(file, this->file_extensions_tree)) {
+        return;
+    }
+
+    /* symlinks are searched only when followed, like lookup_file does */
+    int f = open(file, O_RDONLY | (this->follow_symlinks ? 0 : O_NOFOLLOW));
+    if (f == -1) {
+        return;
+    }
+
+    struct stat sb;
+    if (fstat(f, &sb) < 0) {
+        failure_add(file, STAT);
+        close(f);
+        return;
+    }
+
+    if (!S_ISREG(sb.st_mode) || sb.st_size == 0) {
+        close(f);
+        return;
+    }
+
+    if (!index_is_current(index, lines[0].file, &sb)) {
+        close(f);
+        lookup_file(this, file);
+        return;
+    }
+
+    char *p = mmap(0, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, f, 0);
+    close(f);
+    if (p == MAP_FAILED) {
+        failure_add(file, MMAP);
+        return;
+    }
+
+    uint8_t first = 1;
+    uint32_t i = 0;
+    for (i = 0; i < nb_lines; i++) {
+        if (lines[i].offset >= (uint64_t) sb.st_size) {
+            break;
+        }
+
+        /* lines are nul terminated in place like scans do, but the last */
+        char *line = p + lines[i].offset;
+        size_t remaining_size = sb.st_size - lines[i].offset;
+        char *endline = memchr(line, '\n', remaining_size);
+        char *buffer = NULL;
+        size_t line_len = 0;
+        if (endline) {
+            *endline = '\0';
+            line_len = endline - line;
+        } else {
+            buffer = malloc(remaining_size + 1);
+            if (buffer == NULL) {
+                break;
+            }
+            memcpy(buffer, line, remaining_size);
+            buffer[remaining_size] = '\0';
+            line = buffer;
+            line_len = remaining_size;
+        }
+
+        char *match = this->parser(this, line, line_len);
+        if (match != NULL) {
+            if (first) {
+                entries_add(this->entries, 0, file);
+                first = 0;
+            }
+            add_line(this, lines[i].line, line, line_len, match);
+        }
+        free(buffer);
+    }
+
+    /* wake up subsearches */
+    if (!first) {
+        notify_entries(this);
+    }
+
+    munmap(p, sb.st_size);
+}
+
+/**
+ * Get the first of the lines, by increasing file, of a file.
+ */
+static uint32_t find_lines(const struct index_line *lines, const uint32_t nb_lines,
+                           const uint32_t file)
+{
+    uint32_t low = 0;
+    uint32_t high = nb_lines;
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (lines[middle].file < file) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * Look up a whole word search of an identifier in the symbols of the index,
+ * without reading the files of the directory, listed by a snapshot, but for
+ * the matching lines. Files changed or added since they were indexed are
+ * searched whole.
+ */
+static void lookup_symbols(struct search *this, const struct index *index,
+                           const struct file_list *listed)
+{
+    struct index_line *lines = NULL;
+    uint32_t nb_lines = index_find_symbol(index, this->pattern, &lines);
+    char path[PATH_MAX];
+
+    uint32_t i = 0;
+    for (i = 0; i < file_list_get_nb_files(listed) && !this->stop; i++) {
+        const char *relative = file_list_get_path(listed, i);
+        if (get_path(this, relative, file_list_get_flags(listed, i), path) == EXIT_FAILURE) {
+            continue;
+        }
+
+        uint32_t file = get_current_file(index, relative, path);
+        if (file == UINT32_MAX) {
+            lookup_file(this, path);
+            continue;
+        }
+
+        uint32_t first = find_lines(lines, nb_lines, file);
+        uint32_t last = first;
+        while (last < nb_lines && lines[last].file == file) {
+            last++;
+        }
+        if (last > first) {
+            lookup_lines(this, index, path, &lines[first], last - first);
+        }
+    }
+
+    free(lines);
+}
+
+/**
+ * Symbols answer case sensitive whole word searches of an identifier. Lines
+ * of context need the files read anyway.
+ */
+static uint8_t is_symbol_search(const struct search *this)
+{
+    return this->whole_word && !this->case_insensitive && this->regex == NULL &&
+           this->context_before == 0 && this->context_after == 0 &&
+           search_algorithm_is_word(this->pattern);
+}
+
+
+/* FILE LIST PARSING **********************************************************/
+/**
+ * Search the files of the list under the directory, the list being of a root
+ * holding it.
+ */
+static void lookup_list(struct search *this)
+{
+    size_t prefix_length = strlen(this->files_prefix);
+    char path[PATH_MAX];
+
+    uint32_t i = 0;
+    for (i = 0; i < file_list_get_nb_files(this->files) && !this->stop; i++) {
+        const char *relative = file_list_get_path(this->files, i);
+
+        if (prefix_length) {
+            if (strncmp(relative, this->files_prefix, prefix_length) != 0 ||
+                relative[prefix_length] != '/') {
+                continue;
+            }
+            relative += prefix_length + 1;
+        }
+
+        if (get_path(this, relative, file_list_get_flags(this->files, i), path) == EXIT_SUCCESS) {
+            lookup_file(this, path);
+        }
+    }
+}
+
+/**
+ * Next path of the list of files, separated from the others by nul characters
+ * or by newlines: the first separator found tells which. Blocks until one is
+ * read whole, returns NULL at the end of the list or once the search is
+ * stopped. What's left of the list is read by the next search.
+ */
+static char * read_listed_path(struct search *this)
+{
+    while (!this->stop) {
+        char *start = this->list_buffer + this->list_start;
+        size_t size = this->list_end - this->list_start;
+        char *separator = NULL;
+
+        if (this->list_separator < 0) {
+            char *nul = memchr(start, '\0', size);
+            char *newline = memchr(start, '\n', size);
+            if (nul || newline) {
+                this->list_separator = nul && (newline == NULL || nul < newline) ? '\0' : '\n';
+            }
+        }
+        if (this->list_separator >= 0) {
+            separator = memchr(start, this->list_separator, size);
+        }
+
+        /* the last path may not be followed by a separator */
+        if (separator || (this->list_read && size)) {
+            size_t length = separator ? (size_t) (separator - start) : size;
+            start[length] = '\0';
+            this->list_start += separator ? length + 1 : length;
+            return start;
+        }
+        if (this->list_read) {
+            return NULL;
+        }
+
+        /* keep the beginning of the next path, dropped if it can't be one */
+        memmove(this->list_buffer, start, size);
+        this->list_start = 0;
+        this->list_end = size < LIST_BUFFER_SIZE ? size : 0;
+
+        struct pollfd fd = {this->list, POLLIN, 0};
+        if (poll(&fd, 1, LIST_POLL_DELAY) <= 0) {
+            continue;
+        }
+
+        ssize_t nb_read = read(this->list, this->list_buffer + this->list_end,
+                               LIST_BUFFER_SIZE - this->list_end);
+        if (nb_read > 0) {
+            this->list_end += nb_read;
+        } else if (nb_read == 0 || (errno != EINTR && errno != EAGAIN)) {
+            this->list_read = 1;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Search the files of the list as their paths are read, relative to the
+ * directory unless they're absolute. They're kept like the files found by a
+ * crawl, the search of the next pattern goes through them first.
+ */
+static void lookup_listed_files(struct search *this)
+{
+    char path[PATH_MAX];
+    char *listed = NULL;
+
+    while ((listed = read_listed_path(this)) != NULL) {
+        while (listed[0] == '.' && listed[1] == '/') {
+            listed += 2;
+        }
+
+        if (get_path(this, listed, 0, path) == EXIT_FAILURE) {
+            continue;
+        }
+        if (this->crawled) {
+            file_list_add(this->crawled, listed, strlen(listed), 0);
+        }
+        lookup_file(this, path);
+    }
+}
+
+
+/* PATTERN ********************************************************************/
+/**
+ * Compile the regex of a pattern if the search is a regex one, NULL if it
+ * isn't or if the pattern is invalid.
+ */
+static regex_t * compile_pattern(const struct search *this, const char *pattern)
+{
+    if (this->case_insensitive || !this->regex_search) {
+        return NULL;
+    }
+
+    return this->whole_word ? search_algorithm_compile_word_regex(pattern) :
+                              search_algorithm_compile_regex(pattern);
+}
+
+static void set_parser(struct search *this)
+{
+    if (this->case_insensitive) {
+        this->parser = search_algorithm_insensitive_search;
+    } else if (this->regex) {
+        this->parser = search_algorithm_regex_search;
+    } else {
+        this->parser = search_algorithm_normal_search;
+#ifdef _BMH
+        search_algorithm_pre_bmh(this->pattern);
+        this->parser = search_algorithm_bmh;
+#endif /* _BMH */
+    }
+
+    if (this->whole_word && this->regex == NULL) {
+        this->parser = search_algorithm_word_search;
+    }
+}
+
 
 /* API ************************************************************************/
+/**
+ * Run the search in a thread of its own.
+ */
+void search_start(struct search *this)
+{
+    if (pthread_create(&this->thread, NULL, search_thread_start, (void *) this) == 0) {
+        this->started = 1;
+    } else {
+        this->status = 0;
+    }
+}
+
+/**
+ * Wait for the thread of the search to be done, if it was started.
+ */
+void search_join(struct search *this)
+{
+    if (this->started) {
+        pthread_join(this->thread, NULL);
+        this->started = 0;
+    }
+}
+
 void search_stop(struct search *this)
 {
     this->stop = 1;
 }
 
+/**
+ * Search another pattern in place of the current one, with its own case and
+ * regex options. The running search is stopped and its entries are replaced,
+ * their subsearches must be deleted first. The files found by a complete
+ * crawl of the directory are searched again without crawling it. Returns
+ * EXIT_FAILURE, leaving the search untouched, if the regex is invalid.
+ */
+uint8_t search_restart(struct search *this, const char *pattern,
+                       const uint8_t case_insensitive, const uint8_t regex_search)
+{
+    struct search options = *this;
+    options.case_insensitive = case_insensitive;
+    options.regex_search = regex_search;
+
+    regex_t *regex = compile_pattern(&options, pattern);
+    if (regex_search && !case_insensitive && regex == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    uint8_t crawl_done = !this->status;
+    this->stop = 1;
+    search_join(this);
+
+    if (this->regex) {
+        regfree(this->regex);
+        free(this->regex);
+    }
+    free(this->pattern);
+    this->pattern = strdup(pattern);
+    this->regex = regex;
+    this->case_insensitive = case_insensitive;
+    this->regex_search = regex_search;
+    set_parser(this);
+
+    entries_delete(this->entries);
+    this->entries = entries_new();
+    if (this->watched) {
+        entries_delete(this->watched);
+        this->watched = entries_new_view(this->entries);
+        file_list_delete(this->directories);
+        this->directories = file_list_new();
+    }
+
+    /* the server only answers the pattern it was asked */
+    if (this->server >= 0) {
+        close(this->server);
+        this->server = -1;
+    }
+
+    /* a crawl cut short is done again, listing the files anew, the files of a
+       list are searched again before the rest of it is read */
+    if (this->crawled && this->files != this->crawled) {
+        if ((crawl_done || this->list >= 0) && file_list_get_nb_files(this->crawled)) {
+            this->files = this->crawled;
+            this->files_prefix = "";
+        } else {
+            file_list_delete(this->crawled);
+            this->crawled = file_list_new();
+        }
+    }
+
+    this->stop = 0;
+    this->status = 1;
+    search_start(this);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Search a file or a directory again, its entries are added after all the
+ * others.
+ */
+void search_rescan(struct search *this, const char *path)
+{
+    /* paths are built from the directory, up to the separator after it */
+    size_t length = strlen(this->directory);
+    length -= this->directory[length - 1] == '/';
+
+    struct ignore *rules = this->ignore_files ? ignore_new(NULL, path, length) : NULL;
+    rescan_path(this, path, length, rules);
+    if (rules) {
+        ignore_delete(rules);
+    }
+}
+
 
 /* GETTERS ********************************************************************/
-char * search_get_pattern(const struct search *this)
+/**
+ * Get the search whose pattern the lines matched: the closest one neither
+ * excluding lines nor matching file names.
+ */
+static const struct search * get_line_search(const struct search *this)
 {
-    /* getting the pattern is tricky because search could exclude patterns */
-    const struct search *no_excl = this;
-    while (no_excl->invert_search) {
-        no_excl = search_get_parent(no_excl);
+    while (this->invert_search || this->path_search) {
+        this = search_get_parent(this);
     }
 
-    return no_excl->pattern;
+    return this;
+}
+
+char * search_get_pattern(const struct search *this)
+{
+    return get_line_search(this)->pattern;
 }
 
 uint8_t search_get_status(const struct search *this)
@@ -206,18 +991,12 @@ uint8_t search_get_status(const struct search *this)
 
 regex_t * search_get_regex(const struct search *this)
 {
-    /* getting the pattern is tricky because search could exclude patterns */
-    const struct search *no_excl = this;
-    while (no_excl->invert_search) {
-        no_excl = search_get_parent(no_excl);
-    }
-
-    return no_excl->regex;
+    return get_line_search(this)->regex;
 }
 
 struct entries * search_get_entries(const struct search *this)
 {
-    return this->entries;
+    return this->watched ? this->watched : this->entries;
 }
 
 struct search * search_get_parent(const struct search *this)
@@ -230,15 +1009,14 @@ uint8_t search_get_invert(const struct search *this)
     return this->invert_search;
 }
 
-uint8_t search_get_sensitive(const struct search *this)
+uint8_t search_get_path(const struct search *this)
 {
-    /* ignore parent exclusions */
-    const struct search *no_excl = this;
-    while (no_excl->invert_search) {
-        no_excl = search_get_parent(no_excl);
-    }
+    return this->path_search;
+}
 
-    return no_excl->case_insensitive;
+uint8_t search_get_sensitive(const struct search *this)
+{
+    return get_line_search(this)->case_insensitive;
 }
 
 
@@ -251,15 +1029,47 @@ void * search_thread_start(void *context)
         return NULL;
     }
 
-    if (file_utils_is_file(this->directory)) {
+    if (this->server >= 0) {
+        server_receive(this);
+    } else if (this->list >= 0) {
+        if (this->files) {
+            lookup_list(this);
+        }
+        lookup_listed_files(this);
+    } else if (file_utils_is_file(this->directory)) {
         this->raw_search = 1;
         lookup_file(this, this->directory);
     } else if (file_utils_is_dir(this->directory)) {
-        lookup_directory(this, this->directory);
+        /* the files are listed anew, the index may be of files changed since */
+        struct index *index = this->use_index && this->files == NULL ?
+                              index_new(this->directory, config_hash_filters(this->config)) : NULL;
+        struct file_list *listed = index ? snapshot_list(this->directory, this->config) : NULL;
+
+        if (this->files) {
+            lookup_list(this);
+        } else if (listed && is_symbol_search(this)) {
+            lookup_symbols(this, index, listed);
+        } else if (listed) {
+            lookup_index(this, index, listed);
+        } else {
+            lookup_directory(this, this->directory, NULL);
+        }
+
+        if (listed) {
+            file_list_delete(listed);
+        }
+        if (index) {
+            index_delete(index);
+        }
     }
 
     /* search is done */
     this->status = 0;
+    notify_entries(this);
+
+    if (this->watched) {
+        watch_run(this);
+    }
 
     return NULL;
 }
@@ -278,27 +1088,65 @@ struct search * search_new(const char *directory, const char *pattern,
     this->regex_search = config->regex_search;
     this->file_extensions_tree = config->file_extensions_tree;
     this->dir_exclusion_tree = config->dir_exclusion_tree;
+    this->config = config;
     this->follow_symlinks = config->follow_symlinks;
+    this->window_size = config->window_size;
+    this->full_lines = config->full_lines;
+    this->context_before = config->context_before;
+    this->context_after = config->context_after;
+    this->use_index = !config->no_index;
+    this->whole_word = config->word_search;
+    this->ignore_files = !config->no_ignore;
+    this->server = -1;
+    this->list = -1;
 
-    if (config->insensitive_search) {
-        this->parser = search_algorithm_insensitive_search;
-    } else if (config->regex_search) {
-        this->regex = search_algorithm_compile_regex(this->pattern);
-        if (this->regex) {
-            this->parser = search_algorithm_regex_search;
-        } else {
-            printf("Failed validating regex\n");
-            free(this->pattern);
-            free(this->directory);
-            free(this);
+    /* the ring keeps lines after matches until they're added too, and the
+       current line along with the lines before it */
+    if (this->context_before || this->context_after) {
+        this->context_ring_size = 1 + (this->context_before > this->context_after ?
+                                       this->context_before : this->context_after);
+        this->context_ring = calloc(this->context_ring_size, sizeof(struct context_line));
+    }
+
+    this->regex = compile_pattern(this, this->pattern);
+    if (this->regex_search && !this->case_insensitive && this->regex == NULL) {
+        printf("Failed validating regex\n");
+        free(this->context_ring);
+        free(this->pattern);
+        free(this->directory);
+        free(this);
+        return NULL;
+    }
+    set_parser(this);
+
+    /* the index doesn't tell which directories to watch */
+    if (config->watch) {
+        this->watched = entries_new_view(entries);
+        this->directories = file_list_new();
+        this->use_index = 0;
+    }
+
+    /* files are listed for the patterns replacing this one in the display,
+       watched files may change meanwhile */
+    if (!config->stream_format && !config->watch) {
+        this->crawled = file_list_new();
+    }
+
+    pthread_mutex_init(&this->chain_mutex, NULL);
+
+    /* the list read on stdin is read through a descriptor of its own, the
+       display reads the keys from the terminal */
+    if (config->files_from) {
+        this->list = strcmp(config->files_from, "-") == 0 ?
+                     fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0) :
+                     open(config->files_from, O_RDONLY | O_CLOEXEC);
+        if (this->list < 0) {
+            printf("Failed opening %s\n", config->files_from);
+            search_delete(this);
             return NULL;
         }
-    } else {
-        this->parser = search_algorithm_normal_search;
-#ifdef _BMH
-        search_algorithm_pre_bmh(this->pattern);
-        this->parser = search_algorithm_bmh;
-#endif /* _BMH */
+        this->list_separator = -1;
+        this->list_buffer = malloc(LIST_BUFFER_SIZE + 1);
     }
 
     this->status = 1;   // signal we're running
@@ -308,6 +1156,25 @@ struct search * search_new(const char *directory, const char *pattern,
 
 void search_delete(struct search *this)
 {
+    if (this->server >= 0) {
+        close(this->server);
+    }
+    if (this->watched) {
+        entries_delete(this->watched);
+        file_list_delete(this->directories);
+    }
+    if (this->crawled) {
+        file_list_delete(this->crawled);
+    }
+    if (this->list >= 0) {
+        close(this->list);
+        free(this->list_buffer);
+    }
+    pthread_mutex_destroy(&this->chain_mutex);
+    free(this->context_ring);
+    if (this->regex) {
+        regfree(this->regex);
+    }
     free(this->regex);
     free(this->pattern);
     free(this->directory);
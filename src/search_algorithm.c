@@ -1,11 +1,14 @@
 #define _GNU_SOURCE
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 
 #include <regex.h>
+#include <fnmatch.h>
 
 #include "search.h"
+#include "index.h"
 #include "search_algorithm.h"
 
 
@@ -30,6 +33,45 @@ char * search_algorithm_insensitive_search(const struct search *this,
 }
 
 
+/* WHOLE WORD SEARCH **********************************************************/
+/**
+ * Check if a pattern is made of word characters only, like identifiers.
+ */
+uint8_t search_algorithm_is_word(const char *pattern)
+{
+    for (; *pattern; pattern++) {
+        if (!WORD_CHAR(*pattern)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Find the first match of the pattern that isn't preceded or followed by a
+ * letter, a digit or an underscore.
+ */
+char * search_algorithm_word_search(const struct search *this,
+                                    const char *line, const int size)
+{
+    (void) size;
+
+    size_t length = strlen(this->pattern);
+    char *match = (char *) line;
+
+    while ((match = this->case_insensitive ? strcasestr(match, this->pattern) :
+                                             strstr(match, this->pattern)) != NULL) {
+        if ((match == line || !WORD_CHAR(match[-1])) && !WORD_CHAR(match[length])) {
+            return match;
+        }
+        match++;
+    }
+
+    return NULL;
+}
+
+
 /* BOYER-MOORE-HORSPOOL *******************************************************/
 #define ASCII_ALPHABET  256
 unsigned long int skipt[ASCII_ALPHABET];
@@ -100,16 +142,124 @@ regex_t * search_algorithm_compile_regex(const char *pattern)
     return reg;
 }
 
+/**
+ * Compile a regex whose matches are whole words.
+ */
+regex_t * search_algorithm_compile_word_regex(const char *pattern)
+{
+    size_t size = strlen(pattern) + 16;
+    char *word_pattern = malloc(size);
+    snprintf(word_pattern, size, "\\<\\(%s\\)\\>", pattern);
+
+    regex_t *reg = search_algorithm_compile_regex(word_pattern);
+    free(word_pattern);
+
+    return reg;
+}
+
 char * search_algorithm_regex_search(const struct search *this,
                                      const char *line, const int size)
 {
     (void) size;
 
-    int ret = regexec(this->regex, line, 0, NULL, 0);
+    regmatch_t pmatch[1];
 
-    if (ret != REG_NOMATCH) {
-        return "1";
+    if (regexec(this->regex, line, 1, pmatch, 0) != REG_NOMATCH) {
+        return (char *) line + pmatch[0].rm_so;
     } else {
         return NULL;
     }
 }
+
+
+/* PATH SEARCH ****************************************************************/
+/**
+ * Match a glob against a path or any of its trailing components, so that
+ * "src/main.?" matches "./src/main.c".
+ */
+char * search_algorithm_glob_search(const struct search *this,
+                                    const char *path, const int size)
+{
+    (void) size;
+
+    const char *suffix = path;
+    while (suffix) {
+        if (fnmatch(this->pattern, suffix, 0) == 0) {
+            return (char *) suffix;
+        }
+
+        suffix = strchr(suffix, '/');
+        if (suffix) {
+            suffix++;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* MATCH SPANS ****************************************************************/
+/**
+ * Find all the matches of the search pattern starting in the first size
+ * characters of line and store them in spans.
+ * Flags are regexec flags, REG_NOTBOL when line doesn't start a line.
+ * Returns the number of spans found.
+ */
+uint16_t search_algorithm_spans(const struct search *this, const char *line,
+                                const int size, const int flags,
+                                struct span *spans, const uint16_t max_spans)
+{
+    uint16_t nb_spans = 0;
+    const char *ptr = line;
+
+    if (this->regex) {
+        regmatch_t pmatch[1];
+        int eflags = flags;
+
+        while (nb_spans < max_spans && ptr - line < size &&
+               regexec(this->regex, ptr, 1, pmatch, eflags) == 0) {
+
+            if (ptr - line + pmatch[0].rm_so >= size) {
+                break;
+            }
+
+            /* don't loop forever on empty matches */
+            if (pmatch[0].rm_eo == pmatch[0].rm_so) {
+                if (ptr[pmatch[0].rm_eo] == '\0') {
+                    break;
+                }
+                ptr += pmatch[0].rm_eo + 1;
+                eflags |= REG_NOTBOL;
+                continue;
+            }
+
+            spans[nb_spans].start = ptr - line + pmatch[0].rm_so;
+            spans[nb_spans].length = pmatch[0].rm_eo - pmatch[0].rm_so;
+            nb_spans++;
+
+            ptr += pmatch[0].rm_eo;
+            eflags |= REG_NOTBOL;
+        }
+
+        return nb_spans;
+    }
+
+    size_t pattern_len = strlen(this->pattern);
+    char *match;
+
+    while (nb_spans < max_spans && ptr - line < size &&
+           (match = this->parser(this, ptr, size - (ptr - line))) != NULL) {
+
+        if (match - line >= size) {
+            break;
+        }
+
+        spans[nb_spans].start = match - line;
+        spans[nb_spans].length = pattern_len;
+        nb_spans++;
+
+        ptr = match + pattern_len;
+    }
+
+    return nb_spans;
+}
@@ -0,0 +1,790 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
+
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "entries.h"
+#include "file_list.h"
+#include "file_utils.h"
+#include "ignore.h"
+
+
+#define SERVER_MAGIC        "NGPSRV1"
+#define BUFFER_SIZE         (256 * 1024)
+#define MAX_REQUEST_SIZE    (1024 * 1024)
+#define QUIET_DELAY         100     // time without changes before crawling again (ms)
+#define ANSWER_TIMEOUT      1000    // time a busy server has to take a search (ms)
+#define POLL_DELAY          50      // time between checks that a search was stopped (ms)
+#define FLUSH_DELAY         5       // maximum time results wait in the buffer (ms)
+
+#define WATCH_EVENTS    (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                         IN_DELETE_SELF | IN_MOVE_SELF | IN_CLOSE_WRITE | IN_ONLYDIR)
+
+
+/**
+ * A search is asked with the working directory of the client followed by its
+ * arguments, as nul terminated strings. The server answers with a status,
+ * then streams the entries it finds.
+ */
+struct request_header {
+    char magic[8];
+    uint32_t nb_strings;
+    uint32_t size;
+};
+
+/**
+ * Entries are sent as this header followed by their spans and their data.
+ */
+struct reply_entry {
+    uint32_t line;
+    uint32_t length;
+    uint32_t offset;
+    uint32_t size;          // of the data
+    uint16_t nb_spans;
+    uint8_t context;
+    uint8_t last;           // the search is done, nothing follows
+};
+
+/**
+ * Daemon keeping the files of a root known, crawled again once it changes.
+ */
+struct server {
+    char real_root[PATH_MAX];
+    const struct config *config;
+    struct file_list *files;
+    int socket;
+    int inotify;            // -1 if the directories couldn't all be watched
+    uint8_t stale;
+};
+
+/**
+ * Entries are sent in large writes, and read in large reads.
+ */
+struct buffer {
+    int fd;
+    char *data;
+    size_t capacity;
+    size_t start;
+    size_t end;
+};
+
+
+static volatile sig_atomic_t running = 1;
+
+
+/* SOCKETS ********************************************************************/
+static uint8_t socket_address(const char *real_root, struct sockaddr_un *address,
+                              const uint8_t create)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+
+    return file_utils_cache_path(real_root, "sock", address->sun_path,
+                                 sizeof(address->sun_path), create);
+}
+
+static int socket_connect(const char *real_root)
+{
+    struct sockaddr_un address;
+    if (socket_address(real_root, &address, 0) == EXIT_FAILURE) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static uint8_t write_all(const int fd, const void *data, size_t size)
+{
+    const char *p = data;
+
+    while (size > 0) {
+        ssize_t written = send(fd, p, size, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return EXIT_FAILURE;
+        }
+        p += written;
+        size -= written;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Read size bytes, waiting at most timeout ms for each part of them.
+ */
+static uint8_t read_all(const int fd, void *data, size_t size, const int timeout)
+{
+    char *p = data;
+
+    while (size > 0) {
+        struct pollfd pollfd = {fd, POLLIN, 0};
+        if (poll(&pollfd, 1, timeout) <= 0) {
+            return EXIT_FAILURE;
+        }
+
+        ssize_t nb_read = read(fd, p, size);
+        if (nb_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nb_read <= 0) {
+            return EXIT_FAILURE;
+        }
+        p += nb_read;
+        size -= nb_read;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/* BUFFERS ********************************************************************/
+static void buffer_init(struct buffer *this, const int fd)
+{
+    memset(this, 0, sizeof(struct buffer));
+    this->fd = fd;
+    this->capacity = BUFFER_SIZE;
+    this->data = malloc(this->capacity);
+}
+
+static uint8_t buffer_flush(struct buffer *this)
+{
+    uint8_t status = write_all(this->fd, this->data, this->end);
+    this->end = 0;
+
+    return status;
+}
+
+static uint8_t buffer_write(struct buffer *this, const void *data, const size_t size)
+{
+    if (this->end + size > this->capacity && buffer_flush(this) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+
+    /* too large to be buffered */
+    if (size > this->capacity) {
+        return write_all(this->fd, data, size);
+    }
+
+    memcpy(this->data + this->end, data, size);
+    this->end += size;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Read until size bytes are buffered, or the search is stopped.
+ */
+static uint8_t buffer_fill(struct buffer *this, const size_t size, const struct search *search)
+{
+    if (this->start + size > this->capacity) {
+        memmove(this->data, this->data + this->start, this->end - this->start);
+        this->end -= this->start;
+        this->start = 0;
+    }
+    if (size > this->capacity) {
+        this->capacity = size;
+        this->data = realloc(this->data, this->capacity);
+    }
+
+    while (this->end - this->start < size) {
+        if (search->stop) {
+            return EXIT_FAILURE;
+        }
+
+        struct pollfd pollfd = {this->fd, POLLIN, 0};
+        if (poll(&pollfd, 1, POLL_DELAY) <= 0) {
+            continue;
+        }
+
+        ssize_t nb_read = read(this->fd, this->data + this->end, this->capacity - this->end);
+        if (nb_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nb_read <= 0) {
+            return EXIT_FAILURE;
+        }
+        this->end += nb_read;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/* CRAWL **********************************************************************/
+/**
+ * Watch the directories of the files for files added, removed or renamed.
+ * Changes of contents only matter for ignore files, files are read by each
+ * search.
+ */
+static void server_watch(struct server *this)
+{
+    const struct file_list *directories = this->files->directories;
+    char path[PATH_MAX];
+    size_t root_length = strlen(this->real_root);
+    uint32_t i = 0;
+
+    memcpy(path, this->real_root, root_length);
+    path[root_length++] = '/';
+
+    this->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    for (i = 0; this->inotify >= 0 && i < file_list_get_nb_files(directories); i++) {
+        const char *directory = file_list_get_path(directories, i);
+        size_t length = strlen(directory);
+        if (root_length + length >= PATH_MAX) {
+            continue;
+        }
+
+        memcpy(&path[root_length], directory, length + 1);
+        if (inotify_add_watch(this->inotify, path, WATCH_EVENTS) < 0) {
+            /* out of watches, the files are crawled again for each search */
+            close(this->inotify);
+            this->inotify = -1;
+        }
+    }
+}
+
+/**
+ * Crawl all the files of the root, the searches filter them by extension and
+ * by the directories they exclude. Searches not following the ignore files
+ * don't ask servers.
+ */
+static uint8_t server_crawl(struct server *this)
+{
+    struct config config = *this->config;
+    config.raw_search = 1;
+    config.follow_symlinks = 1;
+    config.no_ignore = 0;
+    config.dir_exclusion_tree = tree_new();
+    config_add_default_exclusions(config.dir_exclusion_tree);
+
+    struct file_list *files = file_list_new();
+    uint8_t status = file_list_crawl(files, this->real_root, &config);
+    tree_delete(config.dir_exclusion_tree);
+    if (status == EXIT_FAILURE) {
+        file_list_delete(files);
+        return EXIT_FAILURE;
+    }
+
+    if (this->files) {
+        file_list_delete(this->files);
+    }
+    if (this->inotify >= 0) {
+        close(this->inotify);
+    }
+    this->files = files;
+    this->stale = 0;
+    server_watch(this);
+
+    return EXIT_SUCCESS;
+}
+
+static void server_read_events(struct server *this)
+{
+    char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    ssize_t size = 0;
+
+    while ((size = read(this->inotify, events, sizeof(events))) > 0) {
+        const char *event = events;
+        while (event < events + size) {
+            const struct inotify_event *inotify_event = (const struct inotify_event *) event;
+            if (!(inotify_event->mask & IN_CLOSE_WRITE) ||
+                (inotify_event->len && ignore_is_file(inotify_event->name))) {
+                this->stale = 1;
+            }
+            event += sizeof(struct inotify_event) + inotify_event->len;
+        }
+    }
+}
+
+
+/* SEARCHES *******************************************************************/
+static uint8_t send_entry(struct buffer *output, const struct entry *entry)
+{
+    struct reply_entry reply;
+
+    memset(&reply, 0, sizeof(reply));
+    reply.line = entry->line;
+    reply.length = entry->length;
+    reply.offset = entry->offset;
+    reply.size = strlen(entry->data);
+    reply.nb_spans = entry->nb_spans;
+    reply.context = entry->context;
+
+    if (buffer_write(output, &reply, sizeof(reply)) == EXIT_FAILURE ||
+        (entry->nb_spans &&
+         buffer_write(output, entry_get_spans(entry), entry->nb_spans * sizeof(struct span)) == EXIT_FAILURE)) {
+        return EXIT_FAILURE;
+    }
+
+    return buffer_write(output, entry->data, reply.size);
+}
+
+/**
+ * Send the entries of the search as they're found, until it's done.
+ */
+static uint8_t send_results(const int fd, struct search *search)
+{
+    struct entries *entries = search_get_entries(search);
+    struct buffer output;
+    uint8_t status = EXIT_SUCCESS;
+    uint32_t index = 0;
+    uint8_t done = 0;
+
+    buffer_init(&output, fd);
+    while (!done && status == EXIT_SUCCESS) {
+        pthread_mutex_lock(&entries_mutex);
+        while (entries->end == index && search_get_status(search)) {
+            if (output.end == 0) {
+                pthread_cond_wait(&entries->updated, &entries_mutex);
+                continue;
+            }
+
+            /* send results in large writes, but don't keep them long */
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += FLUSH_DELAY * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+
+            if (pthread_cond_timedwait(&entries->updated, &entries_mutex, &deadline) == ETIMEDOUT) {
+                pthread_mutex_unlock(&entries_mutex);
+                status = buffer_flush(&output);
+                pthread_mutex_lock(&entries_mutex);
+            }
+        }
+        done = !search_get_status(search);
+        uint32_t end = entries->end;
+        pthread_mutex_unlock(&entries_mutex);
+
+        while (index < end && status == EXIT_SUCCESS) {
+            struct entry *run = NULL;
+            uint32_t nb_run = entries_get_run(entries, index, end - index, &run);
+            uint32_t i = 0;
+
+            for (i = 0; i < nb_run && status == EXIT_SUCCESS; i++) {
+                status = send_entry(&output, &run[i]);
+            }
+            index += nb_run;
+        }
+
+        if (status == EXIT_SUCCESS && done) {
+            status = buffer_flush(&output);
+        }
+    }
+
+    if (status == EXIT_SUCCESS) {
+        struct reply_entry last;
+        memset(&last, 0, sizeof(last));
+        last.last = 1;
+        status = write_all(fd, &last, sizeof(last));
+    }
+
+    free(output.data);
+    return status;
+}
+
+/**
+ * Read the strings of a request, the working directory then the arguments.
+ */
+static char ** read_request(const int fd, uint32_t *nb_strings)
+{
+    struct request_header header;
+    if (read_all(fd, &header, sizeof(header), ANSWER_TIMEOUT) == EXIT_FAILURE ||
+        memcmp(header.magic, SERVER_MAGIC, sizeof(header.magic)) != 0 ||
+        header.nb_strings < 2 || header.size == 0 || header.size > MAX_REQUEST_SIZE) {
+        return NULL;
+    }
+
+    char *data = malloc(header.size);
+    if (read_all(fd, data, header.size, ANSWER_TIMEOUT) == EXIT_FAILURE ||
+        data[header.size - 1] != 0) {
+        free(data);
+        return NULL;
+    }
+
+    /* strings point in the data, freed along with the first one */
+    char **strings = calloc(header.nb_strings + 1, sizeof(char *));
+    char *p = data;
+    uint32_t i = 0;
+    for (i = 0; i < header.nb_strings && p < data + header.size; i++) {
+        strings[i] = p;
+        p += strlen(p) + 1;
+    }
+
+    if (i < header.nb_strings) {
+        free(data);
+        free(strings);
+        return NULL;
+    }
+
+    *nb_strings = header.nb_strings;
+    return strings;
+}
+
+/**
+ * Get the path of a directory in the root, NULL if it isn't in it.
+ */
+static const char * root_prefix(const struct server *this, const char *real_directory)
+{
+    size_t root_length = strlen(this->real_root);
+
+    if (strncmp(real_directory, this->real_root, root_length) != 0 ||
+        (real_directory[root_length] != '/' && real_directory[root_length] != '\0' &&
+         this->real_root[root_length - 1] != '/')) {
+        return NULL;
+    }
+
+    const char *prefix = real_directory + root_length;
+    while (*prefix == '/') {
+        prefix++;
+    }
+
+    return prefix;
+}
+
+/**
+ * Search the files of the root as asked by a client, from its working
+ * directory.
+ */
+static void server_answer(struct server *this, const int fd)
+{
+    uint32_t nb_strings = 0;
+    char **strings = read_request(fd, &nb_strings);
+    if (strings == NULL) {
+        return;
+    }
+
+    uint32_t status = EXIT_FAILURE;
+    struct config *config = NULL;
+    struct search *search = NULL;
+    char real_directory[PATH_MAX];
+    const char *prefix = NULL;
+
+    /* arguments are parsed again from the start */
+    optind = 0;
+    if (chdir(strings[0]) == 0 &&
+        (config = config_new(nb_strings - 1, &strings[1])) != NULL &&
+        config->pattern && !config->load_path && !config->build_index && !config->serve &&
+        realpath(config->directory, real_directory) != NULL &&
+        (prefix = root_prefix(this, real_directory)) != NULL) {
+
+        search = search_new(config->directory, config->pattern, entries_new(), config);
+    }
+
+    /* the files known by the server are kept up to date, unlike an index */
+    if (search) {
+        status = EXIT_SUCCESS;
+        search->files = this->files;
+        search->files_prefix = prefix;
+        search->use_index = 0;
+    }
+
+    if (write_all(fd, &status, sizeof(status)) == EXIT_SUCCESS && search) {
+        pthread_t search_thread;
+        pthread_create(&search_thread, NULL, search_thread_start, (void *) search);
+
+        /* the client is gone */
+        if (send_results(fd, search) == EXIT_FAILURE) {
+            search_stop(search);
+        }
+        pthread_join(search_thread, NULL);
+    }
+
+    if (search) {
+        entries_delete(search_get_entries(search));
+        search_delete(search);
+    }
+    if (config) {
+        config_delete(config);
+    }
+    free(strings[0]);
+    free(strings);
+}
+
+
+/* SERVER *********************************************************************/
+static void stop_serving(int signal)
+{
+    (void) signal;
+    running = 0;
+}
+
+static int server_listen(const char *real_root)
+{
+    struct sockaddr_un address;
+    if (socket_address(real_root, &address, 1) == EXIT_FAILURE) {
+        return -1;
+    }
+
+    /* a socket left by a server that didn't stop cleanly */
+    int other = socket_connect(real_root);
+    if (other >= 0) {
+        close(other);
+        fprintf(stderr, "%s is served already\n", real_root);
+        return -1;
+    }
+    unlink(address.sun_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+        listen(fd, 16) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Answer the searches of root and of its subdirectories until stopped, with
+ * the files of root crawled once and kept as it changes.
+ */
+uint8_t server_serve(const char *root, const struct config *config)
+{
+    struct server this;
+
+    memset(&this, 0, sizeof(this));
+    this.config = config;
+    this.inotify = -1;
+    if (realpath(root, this.real_root) == NULL ||
+        server_crawl(&this) == EXIT_FAILURE) {
+        if (this.files) {
+            file_list_delete(this.files);
+        }
+        return EXIT_FAILURE;
+    }
+
+    this.socket = server_listen(this.real_root);
+    if (this.socket < 0) {
+        file_list_delete(this.files);
+        if (this.inotify >= 0) {
+            close(this.inotify);
+        }
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_serving;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("Serving %s, %u files\n", this.real_root, file_list_get_nb_files(this.files));
+    fflush(stdout);
+
+    while (running) {
+        struct pollfd fds[2] = {{this.socket, POLLIN, 0}, {this.inotify, POLLIN, 0}};
+        int timeout = this.stale && this.inotify >= 0 ? QUIET_DELAY : -1;
+
+        int nb_ready = poll(fds, this.inotify >= 0 ? 2 : 1, timeout);
+        if (nb_ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        /* crawl again once the changes are over */
+        if (nb_ready == 0) {
+            server_crawl(&this);
+            continue;
+        }
+
+        if (this.inotify >= 0 && (fds[1].revents & POLLIN)) {
+            server_read_events(&this);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int client = accept4(this.socket, NULL, NULL, SOCK_CLOEXEC);
+            if (client < 0) {
+                continue;
+            }
+
+            if (this.stale || this.inotify < 0) {
+                server_crawl(&this);
+            }
+            server_answer(&this, client);
+            close(client);
+        }
+    }
+
+    struct sockaddr_un address;
+    if (socket_address(this.real_root, &address, 0) == EXIT_SUCCESS) {
+        unlink(address.sun_path);
+    }
+    close(this.socket);
+    if (this.inotify >= 0) {
+        close(this.inotify);
+    }
+    file_list_delete(this.files);
+
+    return EXIT_SUCCESS;
+}
+
+
+/* CLIENT *********************************************************************/
+static uint8_t send_request(const int fd, int argc, char *argv[])
+{
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    struct request_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SERVER_MAGIC, sizeof(header.magic));
+    header.nb_strings = argc + 1;
+    header.size = strlen(cwd) + 1;
+
+    int i = 0;
+    for (i = 0; i < argc; i++) {
+        header.size += strlen(argv[i]) + 1;
+    }
+    if (header.size > MAX_REQUEST_SIZE) {
+        return EXIT_FAILURE;
+    }
+
+    char *data = malloc(header.size);
+    char *p = data;
+    size_t length = strlen(cwd) + 1;
+    memcpy(p, cwd, length);
+    p += length;
+    for (i = 0; i < argc; i++) {
+        length = strlen(argv[i]) + 1;
+        memcpy(p, argv[i], length);
+        p += length;
+    }
+
+    uint8_t status = write_all(fd, &header, sizeof(header));
+    if (status == EXIT_SUCCESS) {
+        status = write_all(fd, data, header.size);
+    }
+
+    free(data);
+    return status;
+}
+
+/**
+ * Ask the server of directory, or of one of its parents, for the search of
+ * the arguments. Returns the socket the results come from, -1 if no server
+ * took the search.
+ */
+int server_search(const char *directory, int argc, char *argv[])
+{
+    char path[PATH_MAX];
+    int fd = -1;
+
+    if (!file_utils_is_dir(directory) || realpath(directory, path) == NULL) {
+        return -1;
+    }
+
+    while ((fd = socket_connect(path)) < 0 && strcmp(path, "/") != 0) {
+        char *slash = strrchr(path, '/');
+        if (slash == path) {
+            slash[1] = '\0';
+        } else {
+            *slash = '\0';
+        }
+    }
+
+    uint32_t status = EXIT_FAILURE;
+    if (fd >= 0 && (send_request(fd, argc, argv) == EXIT_FAILURE ||
+                    read_all(fd, &status, sizeof(status), ANSWER_TIMEOUT) == EXIT_FAILURE ||
+                    status != EXIT_SUCCESS)) {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Add the entries sent by the server to those of the search, until the
+ * search is done or stopped.
+ */
+void server_receive(struct search *search)
+{
+    struct entries *entries = search_get_entries(search);
+    struct span spans[MAX_SPANS];
+    struct buffer input;
+    uint32_t nb_added = 0;
+
+    buffer_init(&input, search->server);
+    while (1) {
+        /* wake up the display before waiting for more */
+        if (nb_added && input.end - input.start < sizeof(struct reply_entry)) {
+            entries_notify(entries);
+            nb_added = 0;
+        }
+
+        struct reply_entry reply;
+        if (buffer_fill(&input, sizeof(reply), search) == EXIT_FAILURE) {
+            break;
+        }
+        memcpy(&reply, input.data + input.start, sizeof(reply));
+        if (reply.last || reply.nb_spans > MAX_SPANS) {
+            break;
+        }
+
+        size_t spans_size = reply.nb_spans * sizeof(struct span);
+        size_t size = sizeof(reply) + spans_size + reply.size;
+        if (nb_added && input.end - input.start < size) {
+            entries_notify(entries);
+            nb_added = 0;
+        }
+        if (buffer_fill(&input, size, search) == EXIT_FAILURE) {
+            break;
+        }
+
+        const char *p = input.data + input.start + sizeof(reply);
+        memcpy(spans, p, spans_size);
+        const char *data = p + spans_size;
+
+        if (reply.context) {
+            struct context_line line = {data, reply.size, reply.length};
+            entries_add_context(entries, reply.line, &line, 1);
+        } else if (reply.line == 0) {
+            entries_add_window(entries, 0, data, reply.size, reply.size, 0, NULL, 0);
+        } else {
+            entries_add_window(entries, reply.line, data, reply.size, reply.length,
+                               reply.offset, spans, reply.nb_spans);
+        }
+        input.start += size;
+        nb_added++;
+    }
+
+    free(input.data);
+}
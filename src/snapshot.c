@@ -0,0 +1,481 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "file_utils.h"
+#include "ignore.h"
+#include "tree.h"
+
+
+#define SNAPSHOT_MAGIC      "NGPLST2"
+#define NO_DIRECTORY        UINT32_MAX
+#define RACY_DELAY          1000000000LL    // directories changed since are listed again (ns)
+
+
+/**
+ * Snapshot of the files under a root, as the files a search would look into
+ * once extensions, exclusions and symlinks are filtered. Each directory keeps
+ * its mtime along with its files and subdirectories in the order they were
+ * read, so that a directory whose mtime didn't change is not read again. Its
+ * ignore files are kept too, their rules are read on each listing since
+ * they can change without the directory changing.
+ * Layout: header, directories, children, then nul terminated strings: the
+ * root and the names of the children.
+ */
+struct snapshot_header {
+    char magic[8];
+    uint64_t filters;           // hash of the filters the files were listed with
+    uint32_t nb_directories;    // the root first
+    uint32_t nb_children;
+    uint64_t directories_offset;
+    uint64_t children_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+struct snapshot_directory {
+    int64_t mtime;              // ns, 0 to read the directory again
+    uint32_t first_child;
+    uint32_t nb_children;
+};
+
+enum child_type {
+    child_file,
+    child_symlink,
+    child_directory,
+    child_ignore,
+};
+
+struct snapshot_child {
+    uint32_t name;              // offset in the strings
+    uint32_t directory;         // index of a subdirectory, NO_DIRECTORY if unknown
+    uint8_t type;               // enum child_type
+    uint8_t reserved[7];
+};
+
+/**
+ * Mapped snapshot of the previous run.
+ */
+struct snapshot {
+    char *data;
+    size_t size;
+    const struct snapshot_header *header;
+    const struct snapshot_directory *directories;
+    const struct snapshot_child *children;
+    const char *strings;
+};
+
+/**
+ * Listing of the files under a root, reusing the snapshot of the previous
+ * run where directories didn't change, and building the next one.
+ */
+struct walk {
+    const struct config *config;
+    const struct snapshot *old;     // NULL if there's none
+    struct file_list *list;
+    size_t root_length;             // part of the paths left out of the list
+    int64_t racy_time;              // directories changed after this are read again next time
+    uint8_t changed;                // the snapshot must be written again
+
+    struct snapshot_directory *directories;
+    uint32_t nb_directories;
+    uint32_t max_directories;
+
+    struct snapshot_child *children;
+    uint32_t nb_children;
+    uint32_t max_children;
+
+    char *strings;
+    size_t strings_size;
+    size_t strings_capacity;
+};
+
+
+/* SNAPSHOT FILE **************************************************************/
+static uint8_t snapshot_open(struct snapshot *this, const char *path,
+                             const char *real_root, const uint64_t filters)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || (size_t) sb.st_size < sizeof(struct snapshot_header)) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    char *data = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return EXIT_FAILURE;
+    }
+
+    /* indexes in the tables are checked as they're used */
+    size_t size = sb.st_size;
+    const struct snapshot_header *header = (const struct snapshot_header *) data;
+    uint8_t valid =
+        memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+        header->filters == filters &&
+        header->nb_directories > 0 &&
+        header->directories_offset % 8 == 0 && header->children_offset % 8 == 0 &&
+        header->children_offset >= header->directories_offset +
+            (uint64_t) header->nb_directories * sizeof(struct snapshot_directory) &&
+        header->strings_offset >= header->children_offset +
+            (uint64_t) header->nb_children * sizeof(struct snapshot_child) &&
+        header->strings_offset <= size && header->strings_size > 0 &&
+        header->strings_size <= size - header->strings_offset &&
+        data[header->strings_offset + header->strings_size - 1] == 0 &&
+        strcmp(data + header->strings_offset, real_root) == 0;
+
+    if (!valid) {
+        munmap(data, size);
+        return EXIT_FAILURE;
+    }
+
+    this->data = data;
+    this->size = size;
+    this->header = header;
+    this->directories = (const struct snapshot_directory *) (data + header->directories_offset);
+    this->children = (const struct snapshot_child *) (data + header->children_offset);
+    this->strings = data + header->strings_offset;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Write the snapshot of the walk over the one of the previous run.
+ */
+static uint8_t snapshot_write(const struct walk *this, const char *path, const uint64_t filters)
+{
+    char tmp_path[PATH_MAX + 16];
+    FILE *output = file_utils_create_temporary(path, tmp_path, sizeof(tmp_path));
+    if (output == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.filters = filters;
+    header.nb_directories = this->nb_directories;
+    header.nb_children = this->nb_children;
+    header.directories_offset = ROUND_UP(sizeof(header), 8);
+    header.children_offset = header.directories_offset +
+        (uint64_t) this->nb_directories * sizeof(struct snapshot_directory);
+    header.strings_offset = header.children_offset +
+        (uint64_t) this->nb_children * sizeof(struct snapshot_child);
+    header.strings_size = this->strings_size;
+
+    uint8_t status = fwrite(&header, sizeof(header), 1, output) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (status == EXIT_SUCCESS) {
+        status = file_utils_write_padding(output, header.directories_offset - sizeof(header));
+    }
+
+    if (status == EXIT_SUCCESS &&
+        (fwrite(this->directories, sizeof(struct snapshot_directory), this->nb_directories,
+                output) != this->nb_directories ||
+         fwrite(this->children, sizeof(struct snapshot_child), this->nb_children,
+                output) != this->nb_children ||
+         fwrite(this->strings, 1, this->strings_size, output) != this->strings_size)) {
+        status = EXIT_FAILURE;
+    }
+
+    return file_utils_commit_temporary(output, tmp_path, path, status);
+}
+
+
+/* WALK ***********************************************************************/
+static uint32_t add_string(struct walk *this, const char *string, const size_t length)
+{
+    if (this->strings_size + length + 1 > this->strings_capacity) {
+        while (this->strings_size + length + 1 > this->strings_capacity) {
+            this->strings_capacity = this->strings_capacity ? 2 * this->strings_capacity : 64 * 1024;
+        }
+        this->strings = realloc(this->strings, this->strings_capacity);
+    }
+
+    uint32_t offset = this->strings_size;
+    memcpy(this->strings + offset, string, length);
+    this->strings[offset + length] = 0;
+    this->strings_size += length + 1;
+
+    return offset;
+}
+
+static void add_child(struct walk *this, const char *name, const size_t length,
+                      const uint8_t type, const uint32_t directory)
+{
+    if (this->nb_children == this->max_children) {
+        this->max_children = this->max_children ? 2 * this->max_children : 1024;
+        this->children = realloc(this->children, this->max_children * sizeof(struct snapshot_child));
+    }
+
+    struct snapshot_child *child = &this->children[this->nb_children++];
+    memset(child, 0, sizeof(struct snapshot_child));
+    child->name = add_string(this, name, length);
+    child->type = type;
+    child->directory = directory;
+}
+
+/**
+ * Get a directory of the previous snapshot, NULL if it's not a valid one.
+ */
+static const struct snapshot_directory * old_directory(const struct walk *this,
+                                                       const uint32_t index)
+{
+    if (this->old == NULL || index >= this->old->header->nb_directories) {
+        return NULL;
+    }
+
+    const struct snapshot_directory *directory = &this->old->directories[index];
+    if (directory->first_child > this->old->header->nb_children ||
+        directory->nb_children > this->old->header->nb_children - directory->first_child) {
+        return NULL;
+    }
+
+    return directory;
+}
+
+static const char * old_name(const struct walk *this, const struct snapshot_child *child)
+{
+    return child->name < this->old->header->strings_size ? this->old->strings + child->name : "";
+}
+
+/**
+ * Find a subdirectory in a directory of the previous snapshot.
+ */
+static uint32_t find_old_directory(const struct walk *this, const struct snapshot_directory *old,
+                                   const char *name)
+{
+    uint32_t i = 0;
+
+    for (i = 0; old && i < old->nb_children; i++) {
+        const struct snapshot_child *child = &this->old->children[old->first_child + i];
+        if (child->type == child_directory && strcmp(old_name(this, child), name) == 0) {
+            return child->directory;
+        }
+    }
+
+    return NO_DIRECTORY;
+}
+
+/**
+ * Read the children of a directory that a search would look into, the
+ * subdirectories are matched with the ones of its previous snapshot.
+ */
+static void read_directory(struct walk *this, const char *path,
+                           const struct snapshot_directory *old)
+{
+    DIR *dir_stream = opendir(path);
+    if (dir_stream == NULL) {
+        return;
+    }
+
+    struct dirent *dir_entry = NULL;
+    while ((dir_entry = readdir(dir_stream)) != NULL) {
+        const char *name = dir_entry->d_name;
+        size_t name_length = strlen(name);
+
+        if (dir_entry->d_type == DT_REG &&
+            ignore_is_file(name)) {
+            add_child(this, name, name_length, child_ignore, NO_DIRECTORY);
+            continue;
+        }
+
+        if (dir_entry->d_type == DT_DIR) {
+            if (!is_string_in_tree_size(this->config->dir_exclusion_tree, name, name_length)) {
+                add_child(this, name, name_length, child_directory,
+                          find_old_directory(this, old, name));
+            }
+            continue;
+        }
+
+        uint8_t type = child_file;
+        if (dir_entry->d_type == DT_REG) {
+            type = child_file;
+        } else if ((dir_entry->d_type & DT_LNK) && this->config->follow_symlinks) {
+            type = child_symlink;
+        } else {
+            continue;
+        }
+
+        if (!this->config->raw_search &&
+            !file_utils_check_extension(name, this->config->file_extensions_tree)) {
+            continue;
+        }
+
+        add_child(this, name, name_length, type, NO_DIRECTORY);
+    }
+
+    closedir(dir_stream);
+}
+
+/**
+ * List the files under directory, in path of length length, but the ones
+ * its ignore files and its parents' ignore. The directory is read again only
+ * if it changed since the directory old_index of the previous snapshot.
+ * Returns its index in the new snapshot.
+ */
+static uint32_t walk_directory(struct walk *this, char *path, size_t length,
+                               const uint32_t old_index, const struct ignore *parent)
+{
+    struct stat sb;
+    if (stat(path, &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+        this->changed = 1;
+        return NO_DIRECTORY;
+    }
+
+    int64_t mtime = (int64_t) sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+    const struct snapshot_directory *old = old_directory(this, old_index);
+
+    if (this->nb_directories == this->max_directories) {
+        this->max_directories = this->max_directories ? 2 * this->max_directories : 256;
+        this->directories = realloc(this->directories,
+                                    this->max_directories * sizeof(struct snapshot_directory));
+    }
+    uint32_t index = this->nb_directories++;
+    uint32_t first_child = this->nb_children;
+
+    size_t relative_length = length > this->root_length ? length - this->root_length : 0;
+    file_list_add(this->list->directories, &path[length - relative_length], relative_length, 0);
+
+    /* a change in the same tick as the listing could go unnoticed */
+    if (old && old->mtime == mtime && mtime != 0) {
+        uint32_t i = 0;
+        for (i = 0; i < old->nb_children; i++) {
+            const struct snapshot_child *child = &this->old->children[old->first_child + i];
+            const char *name = old_name(this, child);
+            add_child(this, name, strlen(name), child->type, child->directory);
+        }
+    } else {
+        read_directory(this, path, old);
+        this->changed = 1;
+    }
+
+    struct snapshot_directory *directory = &this->directories[index];
+    directory->mtime = mtime < this->racy_time ? mtime : 0;
+    directory->first_child = first_child;
+    directory->nb_children = this->nb_children - first_child;
+    if (directory->mtime == 0) {
+        this->changed = 1;
+    }
+
+    uint32_t nb_children = directory->nb_children;
+    uint32_t i = 0;
+    struct ignore *rules = NULL;
+    for (i = first_child; i < first_child + nb_children && !this->config->no_ignore; i++) {
+        if (this->children[i].type == child_ignore) {
+            rules = ignore_new(parent, path, length);
+            break;
+        }
+    }
+    const struct ignore *ignore = rules ? rules : parent;
+
+    if (path[length - 1] != '/') {
+        path[length++] = '/';
+    }
+
+    /* files and subdirectories in the order they were read, like a crawl */
+    for (i = first_child; i < first_child + nb_children; i++) {
+        const char *name = this->strings + this->children[i].name;
+        size_t name_length = strlen(name);
+
+        if (length + name_length >= PATH_MAX || this->children[i].type == child_ignore) {
+            continue;
+        }
+        memcpy(&path[length], name, name_length + 1);
+
+        uint8_t is_directory = this->children[i].type == child_directory;
+        if (ignore && ignore_match(ignore, path, length + name_length, is_directory)) {
+            /* ignored directories are left out of the snapshot */
+            if (is_directory && this->children[i].directory != NO_DIRECTORY) {
+                this->children[i].directory = NO_DIRECTORY;
+                this->changed = 1;
+            }
+            continue;
+        }
+
+        if (is_directory) {
+            uint32_t subdirectory = walk_directory(this, path, length + name_length,
+                                                   this->children[i].directory, ignore);
+            this->children[i].directory = subdirectory;
+        } else {
+            file_list_add(this->list, &path[this->root_length],
+                          length + name_length - this->root_length,
+                          this->children[i].type == child_symlink ? file_list_symlink : 0);
+        }
+    }
+
+    if (rules) {
+        ignore_delete(rules);
+    }
+
+    return index;
+}
+
+
+/* API ************************************************************************/
+/**
+ * List the files under root a search would look into, as paths relative to
+ * it. Only the directories changed since the snapshot of the previous run
+ * are read, the others are taken from the snapshot, which is then updated.
+ * Returns NULL if root can't be listed.
+ */
+struct file_list * snapshot_list(const char *root, const struct config *config)
+{
+    char real_root[PATH_MAX];
+    char snapshot_path[PATH_MAX];
+    char path[PATH_MAX];
+    size_t length = strlen(root);
+
+    if (length == 0 || length >= PATH_MAX - 1 || !file_utils_is_dir(root) ||
+        realpath(root, real_root) == NULL ||
+        file_utils_cache_path(real_root, "list", snapshot_path, sizeof(snapshot_path), 1) == EXIT_FAILURE) {
+        return NULL;
+    }
+    memcpy(path, root, length + 1);
+
+    uint64_t filters = config_hash_filters(config);
+    struct snapshot old;
+    uint8_t has_old = snapshot_open(&old, snapshot_path, real_root, filters) == EXIT_SUCCESS;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    struct walk walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.config = config;
+    walk.old = has_old ? &old : NULL;
+    walk.list = file_list_new();
+    walk.list->directories = file_list_new();
+    walk.root_length = root[length - 1] == '/' ? length : length + 1;
+    walk.racy_time = (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec - RACY_DELAY;
+    walk.changed = !has_old;
+
+    add_string(&walk, real_root, strlen(real_root));
+    walk_directory(&walk, path, length, has_old ? 0 : NO_DIRECTORY, NULL);
+
+    if (walk.changed) {
+        snapshot_write(&walk, snapshot_path, filters);
+    }
+
+    if (has_old) {
+        munmap(old.data, old.size);
+    }
+    free(walk.directories);
+    free(walk.children);
+    free(walk.strings);
+
+    return walk.list;
+}
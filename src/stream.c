@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "stream.h"
+#include "entries.h"
+#include "search.h"
+
+
+#define OUTPUT_BUFFER_SIZE  (256 * 1024)
+#define OUTPUT_NB_BUFFERS   16      // buffers written together by a single writev
+#define FLUSH_DELAY         20      // maximum time results wait in the buffers (ms)
+
+
+/**
+ * Results are formatted in a few large buffers, all written to stdout with a
+ * single writev once they're full or when the search is idle.
+ */
+struct output {
+    char *buffers[OUTPUT_NB_BUFFERS];
+    uint32_t current;       // buffer being filled
+    size_t used;            // bytes used in the current buffer
+};
+
+/**
+ * State of the formatting, results are written in order of the entries.
+ */
+struct stream {
+    struct output output;
+    enum stream_format format;
+    uint8_t separators;     // groups of context lines are separated like grep does
+    uint8_t written;        // a line was written already
+    uint8_t new_file;       // no line of the file was written yet
+    const char *file;
+    uint32_t previous_line;
+};
+
+
+/* OUTPUT *********************************************************************/
+static uint8_t output_pending(const struct output *this)
+{
+    return this->current > 0 || this->used > 0;
+}
+
+static void output_flush(struct output *this)
+{
+    struct iovec iov[OUTPUT_NB_BUFFERS];
+    int nb_iov = 0;
+    uint32_t i = 0;
+
+    for (i = 0; i <= this->current; i++) {
+        iov[i].iov_base = this->buffers[i];
+        iov[i].iov_len = i < this->current ? OUTPUT_BUFFER_SIZE : this->used;
+    }
+    nb_iov = this->current + 1;
+
+    struct iovec *next = iov;
+    while (nb_iov > 0) {
+        ssize_t written = writev(STDOUT_FILENO, next, nb_iov);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        /* writes may be partial */
+        while (nb_iov > 0 && (size_t) written >= next->iov_len) {
+            written -= next->iov_len;
+            next++;
+            nb_iov--;
+        }
+        if (nb_iov > 0) {
+            next->iov_base = (char *) next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+
+    this->current = 0;
+    this->used = 0;
+}
+
+static void output_write(struct output *this, const char *data, size_t size)
+{
+    while (size > 0) {
+        if (this->used == OUTPUT_BUFFER_SIZE) {
+            if (this->current == OUTPUT_NB_BUFFERS - 1) {
+                output_flush(this);
+            } else {
+                this->current++;
+                this->used = 0;
+            }
+        }
+
+        if (this->buffers[this->current] == NULL) {
+            this->buffers[this->current] = malloc(OUTPUT_BUFFER_SIZE);
+        }
+
+        size_t copied = OUTPUT_BUFFER_SIZE - this->used;
+        if (copied > size) {
+            copied = size;
+        }
+
+        memcpy(this->buffers[this->current] + this->used, data, copied);
+        this->used += copied;
+        data += copied;
+        size -= copied;
+    }
+}
+
+static void output_string(struct output *this, const char *string)
+{
+    output_write(this, string, strlen(string));
+}
+
+static void output_number(struct output *this, const uint32_t number)
+{
+    char buffer[16];
+    int length = snprintf(buffer, sizeof(buffer), "%u", number);
+
+    output_write(this, buffer, length);
+}
+
+/**
+ * Length of the valid UTF-8 sequence at p, 0 if it isn't one: overlong
+ * forms, surrogates and code points past U+10FFFF are invalid too.
+ */
+static uint32_t utf8_length(const unsigned char *p)
+{
+    if (p[0] < 0x80) {
+        return 1;
+    }
+
+    uint32_t length = 0;
+    unsigned char min = 0x80;
+    unsigned char max = 0xbf;
+    if (p[0] >= 0xc2 && p[0] <= 0xdf) {
+        length = 2;
+    } else if (p[0] >= 0xe0 && p[0] <= 0xef) {
+        length = 3;
+        min = p[0] == 0xe0 ? 0xa0 : 0x80;
+        max = p[0] == 0xed ? 0x9f : 0xbf;
+    } else if (p[0] >= 0xf0 && p[0] <= 0xf4) {
+        length = 4;
+        min = p[0] == 0xf0 ? 0x90 : 0x80;
+        max = p[0] == 0xf4 ? 0x8f : 0xbf;
+    } else {
+        return 0;
+    }
+
+    /* the bounds only apply to the second byte */
+    uint32_t i = 0;
+    for (i = 1; i < length; i++) {
+        if (p[i] < (i == 1 ? min : 0x80) || p[i] > (i == 1 ? max : 0xbf)) {
+            return 0;
+        }
+    }
+
+    return length;
+}
+
+static uint8_t is_utf8(const char *string)
+{
+    const unsigned char *p = (const unsigned char *) string;
+
+    while (*p) {
+        uint32_t length = utf8_length(p);
+        if (length == 0) {
+            return 0;
+        }
+        p += length;
+    }
+
+    return 1;
+}
+
+/**
+ * Write a string that isn't valid UTF-8 as {"bytes":"<base64>"}, like
+ * ripgrep does.
+ */
+static void output_json_bytes(struct output *this, const char *string)
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const unsigned char *p = (const unsigned char *) string;
+    size_t length = strlen(string);
+    size_t i = 0;
+
+    output_string(this, "{\"bytes\":\"");
+    for (i = 0; i + 2 < length; i += 3) {
+        char encoded[4] = {
+            digits[p[i] >> 2],
+            digits[(p[i] & 0x03) << 4 | p[i + 1] >> 4],
+            digits[(p[i + 1] & 0x0f) << 2 | p[i + 2] >> 6],
+            digits[p[i + 2] & 0x3f],
+        };
+        output_write(this, encoded, 4);
+    }
+
+    if (i < length) {
+        unsigned char last = i + 1 < length ? p[i + 1] : 0;
+        char encoded[4] = {
+            digits[p[i] >> 2],
+            digits[(p[i] & 0x03) << 4 | last >> 4],
+            i + 1 < length ? digits[(last & 0x0f) << 2] : '=',
+            '=',
+        };
+        output_write(this, encoded, 4);
+    }
+    output_string(this, "\"}");
+}
+
+/**
+ * Write a JSON string, escaping quotes, backslashes and control characters.
+ * Strings that aren't valid UTF-8 are written as their bytes.
+ */
+static void output_json_string(struct output *this, const char *string)
+{
+    if (!is_utf8(string)) {
+        output_json_bytes(this, string);
+        return;
+    }
+
+    output_write(this, "\"", 1);
+
+    const char *start = string;
+    const char *p = string;
+    for (p = string; *p; p++) {
+        unsigned char c = *p;
+        if (c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+
+        output_write(this, start, p - start);
+        start = p + 1;
+
+        char escaped[8];
+        if (c == '"' || c == '\\') {
+            snprintf(escaped, sizeof(escaped), "\\%c", c);
+        } else if (c == '\t') {
+            snprintf(escaped, sizeof(escaped), "\\t");
+        } else {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        }
+        output_string(this, escaped);
+    }
+    output_write(this, start, p - start);
+
+    output_write(this, "\"", 1);
+}
+
+
+/* FORMATS ********************************************************************/
+/**
+ * file:line:contents for matches and file-line-contents for context lines.
+ */
+static void write_text(struct stream *this, const struct entry *entry)
+{
+    char separator = entry->context ? '-' : ':';
+
+    /* consecutive lines are printed as a group, groups of different files
+       are always separated */
+    if (this->separators && this->written &&
+        (this->new_file || entry->line != this->previous_line + 1)) {
+        output_write(&this->output, "--\n", 3);
+    }
+    this->previous_line = entry->line;
+    this->written = 1;
+    this->new_file = 0;
+
+    output_string(&this->output, this->file);
+    output_write(&this->output, &separator, 1);
+    output_number(&this->output, entry->line);
+    output_write(&this->output, &separator, 1);
+    output_string(&this->output, entry->data);
+    output_write(&this->output, "\n", 1);
+}
+
+/**
+ * Positions are in bytes in the whole line, columns start at 1. The text is
+ * only a window of the line when its offset is given. Paths and texts that
+ * aren't valid UTF-8 are given as {"bytes":"<base64>"}.
+ */
+static void write_json(struct stream *this, const struct entry *entry)
+{
+    struct output *output = &this->output;
+    const struct span *spans = entry_get_spans(entry);
+    uint16_t i = 0;
+
+    output_string(output, entry->context ? "{\"type\":\"context\"" : "{\"type\":\"match\"");
+    output_string(output, ",\"file\":");
+    output_json_string(output, this->file);
+    output_string(output, ",\"line\":");
+    output_number(output, entry->line);
+
+    if (entry->nb_spans) {
+        output_string(output, ",\"column\":");
+        output_number(output, entry->offset + spans[0].start + 1);
+    }
+
+    if (!entry->context) {
+        output_string(output, ",\"spans\":[");
+        for (i = 0; i < entry->nb_spans; i++) {
+            output_string(output, i ? ",[" : "[");
+            output_number(output, entry->offset + spans[i].start);
+            output_write(output, ",", 1);
+            output_number(output, spans[i].length);
+            output_write(output, "]", 1);
+        }
+        output_write(output, "]", 1);
+    }
+
+    if (entry->offset || strlen(entry->data) != entry->length) {
+        output_string(output, ",\"offset\":");
+        output_number(output, entry->offset);
+    }
+
+    output_string(output, ",\"text\":");
+    output_json_string(output, entry->data);
+    output_write(output, "}\n", 2);
+}
+
+static void write_entry(struct stream *this, const struct entry *entry)
+{
+    if (entry->line == 0) {
+        this->file = entry->data;
+        this->new_file = 1;
+        return;
+    }
+
+    if (this->format == stream_format_json) {
+        write_json(this, entry);
+    } else {
+        write_text(this, entry);
+    }
+}
+
+
+/* API ************************************************************************/
+/**
+ * Write the results of the search to stdout as they're found, until the
+ * search is done.
+ */
+void stream_loop(const struct search *search, const enum stream_format format)
+{
+    struct entries *entries = search_get_entries(search);
+    struct stream this = {0};
+    this.format = format;
+    this.separators = search->context_before || search->context_after;
+
+    uint32_t index = 0;
+    uint8_t done = 0;
+
+    while (!done) {
+        pthread_mutex_lock(&entries_mutex);
+        while (entries->end == index && search_get_status(search)) {
+            if (!output_pending(&this.output)) {
+                pthread_cond_wait(&entries->updated, &entries_mutex);
+                continue;
+            }
+
+            /* don't keep results for long if the search is slow */
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += FLUSH_DELAY * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+
+            if (pthread_cond_timedwait(&entries->updated, &entries_mutex, &deadline) == ETIMEDOUT) {
+                pthread_mutex_unlock(&entries_mutex);
+                output_flush(&this.output);
+                pthread_mutex_lock(&entries_mutex);
+            }
+        }
+        done = !search_get_status(search);
+        uint32_t end = entries->end;
+        pthread_mutex_unlock(&entries_mutex);
+
+        while (index < end) {
+            struct entry *run = NULL;
+            uint32_t nb_run = entries_get_run(entries, index, end - index, &run);
+            uint32_t i = 0;
+
+            for (i = 0; i < nb_run; i++) {
+                write_entry(&this, &run[i]);
+            }
+            index += nb_run;
+        }
+
+        if (done || this.output.current > 0) {
+            output_flush(&this.output);
+        }
+    }
+
+    uint32_t i = 0;
+    for (i = 0; i < OUTPUT_NB_BUFFERS; i++) {
+        free(this.output.buffers[i]);
+    }
+}
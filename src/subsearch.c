@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -6,6 +7,16 @@
 #include "subsearch.h"
 #include "entries.h"
 #include "search.h"
+#include "pool.h"
+
+
+#define SUBSEARCH_INTERVAL  50000   // minimum time between two updates (us)
+#define FIRST_CHUNK_SIZE    4096    // root entries filtered first, to fill the screen
+#define CHUNK_SIZE          65536   // root entries filtered by each job
+#define MAX_PASS_SIZE       (16 * CHUNK_SIZE)   // root entries filtered by each pass
+
+
+extern struct pool *pool;
 
 
 /* UTILS **********************************************************************/
@@ -16,66 +27,406 @@ uint8_t matches(const struct search *this, char *data)
     return res ^ this->invert_search;
 }
 
+static struct search * get_root(struct search *this)
+{
+    while (this->parent) {
+        this = this->parent;
+    }
+
+    return this;
+}
+
 
-/* SUBSEARCH THREAD ***********************************************************/
-static void subsearch_search(struct search *this)
+/* FILTER PROGRAM *************************************************************/
+/**
+ * The stack of subsearches is compiled into a single filter: a conjunction of
+ * the matchers of consecutive levels, evaluated in one pass over the entries
+ * selected by the parent of the first level. A line rejected by a level is
+ * never looked at by the deeper ones.
+ * Filters are run in chunks aligned on words of the selections so that each
+ * thread only writes its own bits.
+ */
+struct chunk {
+    uint32_t start;
+    uint32_t end;
+    uint32_t *nb_lines;     // per level
+    uint32_t *file_index;   // per level, file of a matching line found before the chunk
+    uint8_t done;
+};
+
+struct filter {
+    struct search **levels;
+    uint32_t nb_levels;
+    struct chunk *chunks;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+/**
+ * Check if the filter was cancelled: levels are always removed from the
+ * deepest one.
+ */
+static uint8_t filter_stopped(const struct filter *this)
+{
+    return this->levels[this->nb_levels - 1]->stop;
+}
+
+/**
+ * Get the next entry to filter. Entries below the end of the results refined
+ * by the first level are taken from them instead of the parent.
+ */
+static uint32_t filter_next(const struct filter *this, uint32_t index, const uint32_t end)
 {
-    struct entries *parent_entries = search_get_entries(this->parent);
+    const struct entries *refined = this->levels[0]->refined;
 
-    uint32_t parent_nb_entries = entries_get_nb_entries(parent_entries);
+    if (refined && index < refined->end) {
+        uint32_t refined_end = refined->end < end ? refined->end : end;
+        uint32_t next = entries_next(refined, index, refined_end);
 
-    /* check if there's new data */
-    if (parent_nb_entries == this->parent_previous_nb_entries) {
-        return;
+        if (next < refined_end) {
+            return next;
+        }
+        index = refined_end;
     }
 
-    uint32_t i = 0;
+    return entries_next(search_get_entries(this->levels[0]->parent), index, end);
+}
+
+static void filter_chunk(struct filter *this, struct chunk *chunk)
+{
+    struct entries *root_entries = this->levels[0]->entries->root;
+    uint32_t file_index = entries_find_file_index(root_entries, chunk->start);
 
-    for (i = this->parent_previous_nb_entries; i < parent_nb_entries; i++) {
-        uint32_t parent_entries_line = entries_get_line(parent_entries, i);
+    uint8_t *first_line_of_file = malloc(this->nb_levels);
+    memset(first_line_of_file, 1, this->nb_levels);
+
+    /* levels filtering file names decide once per file */
+    uint8_t *file_matches = malloc(this->nb_levels);
+
+    /* regexec serializes threads sharing a regex, give each chunk its own */
+    struct search *searches = malloc(this->nb_levels * sizeof(struct search));
+
+    uint32_t k = 0;
+    for (k = 0; k < this->nb_levels; k++) {
+        searches[k] = *this->levels[k];
+        chunk->file_index[k] = NO_FILE;
+
+        if (searches[k].regex_search) {
+            searches[k].regex = search_algorithm_compile_regex(searches[k].pattern);
+            if (searches[k].regex == NULL) {
+                searches[k].regex = this->levels[k]->regex;
+            }
+        }
+    }
+
+    for (k = 0; k < this->nb_levels; k++) {
+        if (searches[k].path_search) {
+            file_matches[k] = matches(&searches[k], entries_get_entry(root_entries, file_index)->data);
+        }
+    }
+
+    uint32_t i = 0;
+    for (i = filter_next(this, chunk->start, chunk->end);
+         i < chunk->end && !filter_stopped(this);
+         i = filter_next(this, i + 1, chunk->end)) {
+        struct entry *entry = entries_get_entry(root_entries, i);
 
         /* if it's a file, store its index in case there's a line match later */
-        if (parent_entries_line == 0) {
-            this->first_line_of_file = 1;
-            this->previous_file_index = i;
+        if (entry->line == 0) {
+            memset(first_line_of_file, 1, this->nb_levels);
+            file_index = i;
+
+            for (k = 0; k < this->nb_levels; k++) {
+                if (searches[k].path_search) {
+                    file_matches[k] = matches(&searches[k], entry->data);
+                }
+            }
+
+            /* skip all the lines of a file rejected by the first level */
+            if (searches[0].path_search && !file_matches[0]) {
+                i += entry->length;
+            }
             continue;
         }
 
-        char *parent_entry_data = entries_get_data(parent_entries, i);
-        if (matches(this, parent_entry_data)) {
-            /* check if file has been added yet */
-            if (this->first_line_of_file) {
-                entries_copy(this->entries, entries_get_entry(parent_entries, this->previous_file_index));
-                this->first_line_of_file = 0;
+        for (k = 0; k < this->nb_levels; k++) {
+            if (searches[k].path_search) {
+                if (!file_matches[k]) {
+                    break;
+                }
+            } else if ((entry->context && !searches[k].match_context) ||
+                       !matches(&searches[k], entry->data)) {
+                break;
             }
 
-            /* add line */
-            entries_copy(this->entries, entries_get_entry(parent_entries, i));
+            struct entries *entries = this->levels[k]->entries;
+
+            if (first_line_of_file[k]) {
+                if (file_index >= chunk->start) {
+                    entries_select(entries, file_index);
+                } else {
+                    chunk->file_index[k] = file_index;
+                }
+                first_line_of_file[k] = 0;
+            }
+
+            /* context lines only count when they're matched */
+            entries_select(entries, i);
+            chunk->nb_lines[k] += !entry->context || searches[k].match_context;
+        }
+    }
+
+    for (k = 0; k < this->nb_levels; k++) {
+        if (searches[k].regex != this->levels[k]->regex) {
+            regfree(searches[k].regex);
+            free(searches[k].regex);
+        }
+    }
+    free(searches);
+    free(file_matches);
+    free(first_line_of_file);
+}
+
+static void filter_job(void *context, const uint32_t index)
+{
+    struct filter *filter = context;
+    struct chunk *chunk = &filter->chunks[index + 1];
+
+    filter_chunk(filter, chunk);
+
+    pthread_mutex_lock(&filter->mutex);
+    chunk->done = 1;
+    pthread_cond_broadcast(&filter->cond);
+    pthread_mutex_unlock(&filter->mutex);
+}
+
+static void publish_chunk(struct filter *this, const struct chunk *chunk)
+{
+    uint32_t k = 0;
+
+    for (k = 0; k < this->nb_levels; k++) {
+        struct entries *entries = this->levels[k]->entries;
+        uint32_t nb_entries = entries_get_nb_entries(entries);
+
+        entries_publish(entries, chunk->end, chunk->nb_lines[k], chunk->file_index[k]);
+
+        /* wake up whoever displays this level */
+        if (entries_get_nb_entries(entries) != nb_entries) {
+            entries_notify(entries);
+        }
+    }
+}
+
+/**
+ * Run the filter on [start, end). Big ranges are split in chunks filtered by
+ * the pool while this thread filters the first one, so that the first screen
+ * shows up right away, then chunks are published in order.
+ */
+static void filter_run(struct filter *this, uint32_t start, const uint32_t end)
+{
+    uint32_t i = 0;
+    uint32_t k = 0;
+
+    for (k = 0; k < this->nb_levels; k++) {
+        entries_reserve(this->levels[k]->entries, end);
+    }
+
+    /* the first chunk ends on a word of the selections, the others are aligned */
+    uint32_t first_end = (start + FIRST_CHUNK_SIZE + 63) & ~63;
+    uint32_t nb_chunks = 1;
+    if (end > first_end) {
+        nb_chunks += (end - first_end + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    }
+
+    this->chunks = calloc(nb_chunks, sizeof(struct chunk));
+    uint32_t *counters = calloc(2 * nb_chunks * this->nb_levels, sizeof(uint32_t));
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_cond_init(&this->cond, NULL);
+
+    for (i = 0; i < nb_chunks; i++) {
+        struct chunk *chunk = &this->chunks[i];
+
+        chunk->nb_lines = &counters[2 * i * this->nb_levels];
+        chunk->file_index = &counters[(2 * i + 1) * this->nb_levels];
+        chunk->start = start;
+        chunk->end = i == 0 ? first_end : start + CHUNK_SIZE;
+        if (chunk->end > end) {
+            chunk->end = end;
+        }
+        start = chunk->end;
+    }
+
+    pool_submit(pool, filter_job, this, nb_chunks - 1);
+
+    filter_chunk(this, &this->chunks[0]);
+    if (!filter_stopped(this)) {
+        publish_chunk(this, &this->chunks[0]);
+    }
+
+    for (i = 1; i < nb_chunks; i++) {
+        pthread_mutex_lock(&this->mutex);
+        while (!this->chunks[i].done) {
+            pthread_cond_wait(&this->cond, &this->mutex);
+        }
+        pthread_mutex_unlock(&this->mutex);
+
+        /* a stopped chunk didn't see all its entries */
+        if (!filter_stopped(this)) {
+            publish_chunk(this, &this->chunks[i]);
+        }
+    }
+
+    pthread_cond_destroy(&this->cond);
+    pthread_mutex_destroy(&this->mutex);
+    free(counters);
+    free(this->chunks);
+}
+
+
+/* CHAIN THREAD ***************************************************************/
+/**
+ * Bring the chain of subsearches up to date, one step at a time. A level
+ * pushed on the chain is first filled from the results of its parent, then
+ * new root entries go through all the levels at once.
+ * Returns 0 if there was nothing to do.
+ */
+static uint8_t chain_update(struct search *root)
+{
+    struct search *levels[256];
+    uint32_t nb_levels = 0;
+    uint32_t k = 0;
+
+    struct search *level = root->subsearch;
+    while (level && nb_levels < sizeof(levels) / sizeof(levels[0])) {
+        levels[nb_levels++] = level;
+        level = level->subsearch;
+    }
+
+    if (nb_levels == 0) {
+        return 0;
+    }
+
+    /* reuse the results of the prefix of the chain for a new level */
+    pthread_mutex_lock(&entries_mutex);
+    for (k = 1; k < nb_levels; k++) {
+        if (levels[k]->entries->end < levels[k - 1]->entries->end) {
+            break;
         }
     }
-    this->parent_previous_nb_entries = parent_nb_entries;
+    uint32_t start = k < nb_levels ? levels[k]->entries->end : levels[0]->entries->end;
+    uint32_t end = k < nb_levels ? levels[k - 1]->entries->end : search_get_entries(root)->end;
+    pthread_mutex_unlock(&entries_mutex);
+
+    struct filter filter = {0};
+    if (k < nb_levels) {
+        filter.levels = &levels[k];
+        filter.nb_levels = 1;
+    } else if (start < end) {
+        filter.levels = levels;
+        filter.nb_levels = nb_levels;
+    } else {
+        return 0;
+    }
+
+    /* don't hold the chain for too long, levels may be pushed or popped */
+    if (end - start > MAX_PASS_SIZE) {
+        end = start + MAX_PASS_SIZE;
+    }
+
+    filter_run(&filter, start, end);
+
+    /* refined results are not needed anymore once caught up */
+    struct search *first = filter.levels[0];
+    if (first->refined && first->entries->end >= first->refined->end) {
+        entries_delete(first->refined);
+        first->refined = NULL;
+    }
+
+    return 1;
 }
 
-void * subsearch_search_thread_start(void *context)
+static void * chain_thread_start(void *context)
 {
-    struct search *this = context;
+    struct search *root = context;
+    struct entries *root_entries = search_get_entries(root);
+
+    while (1) {
+        pthread_mutex_lock(&entries_mutex);
+        uint32_t root_end = root_entries->end;
+        pthread_mutex_unlock(&entries_mutex);
+
+        pthread_mutex_lock(&root->chain_mutex);
+        uint8_t updated = chain_update(root);
+        uint8_t stop = root->subsearch == NULL;
+        pthread_mutex_unlock(&root->chain_mutex);
+
+        if (stop) {
+            break;
+        }
+
+        if (updated) {
+            /* batch the updates of a running search, catch up on a finished one */
+            if (search_get_status(root)) {
+                usleep(SUBSEARCH_INTERVAL);
+            }
+            continue;
+        }
 
-    while (!this->stop) {
-        subsearch_search(this);
-        sleep(0.5);
+        /* sleep until there are new root entries or the chain changes */
+        pthread_mutex_lock(&entries_mutex);
+        while (!root->chain_changed && root_entries->end == root_end) {
+            pthread_cond_wait(&root_entries->updated, &entries_mutex);
+        }
+        root->chain_changed = 0;
+        pthread_mutex_unlock(&entries_mutex);
     }
 
     return NULL;
 }
 
+/**
+ * Signal the chain thread that levels were pushed or popped.
+ */
+static void chain_changed(struct search *root)
+{
+    pthread_mutex_lock(&entries_mutex);
+    root->chain_changed = 1;
+    pthread_cond_broadcast(&search_get_entries(root)->updated);
+    pthread_mutex_unlock(&entries_mutex);
+}
 
-/* CONSTRUCTOR ****************************************************************/
-struct search * subsearch_new(struct search *parent, const struct subsearch_user_params *user_params)
+
+/**
+ * Check if the results of a pattern can be narrowed down to get the results
+ * of another one: every line containing the new literal pattern also
+ * contains the previous one.
+ */
+static uint8_t narrows(const struct search *previous,
+                       const struct subsearch_user_params *user_params)
+{
+    if (previous->invert_search || user_params->invert_search ||
+        previous->match_context != user_params->match_context ||
+        previous->regex_search || user_params->search_type == search_type_regex ||
+        previous->path_search || user_params->search_type >= search_type_path ||
+        previous->case_insensitive != (user_params->search_type == search_type_nocase)) {
+        return 0;
+    }
+
+    if (previous->case_insensitive) {
+        return strcasestr(user_params->pattern, previous->pattern) != NULL;
+    }
+
+    return strstr(user_params->pattern, previous->pattern) != NULL;
+}
+
+static struct search * subsearch_alloc(struct search *parent,
+                                       const struct subsearch_user_params *user_params)
 {
     struct search *this = calloc(1, sizeof(struct search));
     this->parent = parent;
     this->pattern = strdup(user_params->pattern);
     this->invert_search = user_params->invert_search;
+    this->match_context = user_params->match_context;
     this->parser = search_algorithm_normal_search;
 
     if (user_params->search_type == search_type_nocase) {
@@ -89,20 +440,107 @@ struct search * subsearch_new(struct search *parent, const struct subsearch_user
         this->parser = search_algorithm_regex_search;
     }
 
-    this->entries = entries_new();
+    if (user_params->search_type == search_type_path) {
+        this->path_search = 1;
+        if (strpbrk(this->pattern, "*?[")) {
+            this->parser = search_algorithm_glob_search;
+        }
+    }
 
-    pthread_create(&this->subsearch_search_thread, NULL, subsearch_search_thread_start, (void *) this);
+    if (user_params->search_type == search_type_path_regex) {
+        this->path_search = 1;
+        this->regex_search = 1;
+        this->regex = search_algorithm_compile_regex(this->pattern);
+        this->parser = search_algorithm_regex_search;
+    }
+
+    this->entries = entries_new_view(search_get_entries(parent));
 
     return this;
 }
 
-void subsearch_delete(struct search *this)
+static void subsearch_free(struct search *this)
 {
-    this->stop = 1;
-    pthread_join(this->subsearch_search_thread, NULL);
-    entries_delete_copy(this->entries);
+    if (this->refined) {
+        entries_delete(this->refined);
+    }
+    if (this->entries) {
+        entries_delete(this->entries);
+    }
+    if (this->regex) {
+        regfree(this->regex);
+    }
 
     free(this->regex);
     free(this->pattern);
     free(this);
 }
+
+
+/* API ************************************************************************/
+/**
+ * Replace the pattern of the last subsearch of the chain, typically while
+ * the user is typing it. The filter running for the previous pattern is
+ * cancelled. When the new pattern narrows the previous one, its results are
+ * filtered instead of those of the parent.
+ */
+struct search * subsearch_refine(struct search *this,
+                                 const struct subsearch_user_params *user_params)
+{
+    struct search *root = get_root(this);
+    struct search *refined = subsearch_alloc(this->parent, user_params);
+
+    /* cancel the filter of the previous pattern, then swap the levels */
+    this->stop = 1;
+    pthread_mutex_lock(&root->chain_mutex);
+    if (narrows(this, user_params)) {
+        refined->refined = this->entries;
+        this->entries = NULL;
+    }
+    this->parent->subsearch = refined;
+    pthread_mutex_unlock(&root->chain_mutex);
+    chain_changed(root);
+
+    subsearch_free(this);
+
+    return refined;
+}
+
+
+/* CONSTRUCTOR ****************************************************************/
+struct search * subsearch_new(struct search *parent, const struct subsearch_user_params *user_params)
+{
+    struct search *this = subsearch_alloc(parent, user_params);
+
+    /* push the new level on the chain */
+    struct search *root = get_root(parent);
+    pthread_mutex_lock(&root->chain_mutex);
+    parent->subsearch = this;
+    pthread_mutex_unlock(&root->chain_mutex);
+
+    if (parent == root) {
+        pthread_create(&root->chain_thread, NULL, chain_thread_start, (void *) root);
+    } else {
+        chain_changed(root);
+    }
+
+    return this;
+}
+
+void subsearch_delete(struct search *this)
+{
+    struct search *root = get_root(this);
+
+    /* cancel the filters running on this level, then pop it */
+    this->stop = 1;
+    pthread_mutex_lock(&root->chain_mutex);
+    this->parent->subsearch = NULL;
+    pthread_mutex_unlock(&root->chain_mutex);
+    chain_changed(root);
+
+    if (this->parent == root) {
+        pthread_join(root->chain_thread, NULL);
+    }
+
+    subsearch_free(this);
+}
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <string.h>
 #include "tree.h"
+#include "file_utils.h"
 
 
 /* UTILS **********************************************************************/
@@ -38,6 +39,22 @@ static void leaves_delete(struct leaf *this)
     free(this);
 }
 
+/* hash the letters of the leaves below a leaf, and where words end */
+static uint64_t leaves_hash(const struct leaf *this, uint64_t hash)
+{
+    int i = 0;
+
+    hash = file_utils_hash_value(hash, this->terminate);
+    for (i = 0; i < 256; i++) {
+        if (this->leaves[i]) {
+            hash = file_utils_hash_value(hash, i);
+            hash = leaves_hash(this->leaves[i], hash);
+        }
+    }
+
+    return file_utils_hash_value(hash, 256);
+}
+
 
 /* API ************************************************************************/
 uint8_t is_string_in_tree(const struct tree *this, const char *string)
@@ -87,6 +104,15 @@ void tree_add_string(struct tree *this, const char *string)
     leaf->terminate = 1;
 }
 
+/**
+ * Hash the words of a tree, trees holding the same words hash the same
+ * whatever the order they were added in.
+ */
+uint64_t tree_hash(const struct tree *this)
+{
+    return leaves_hash(this->root, FILE_UTILS_HASH_SEED);
+}
+
 
 /* CONTRUCTOR *****************************************************************/
 struct tree * tree_new(void)
@@ -0,0 +1,383 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+
+#include "watch.h"
+#include "entries.h"
+#include "file_list.h"
+#include "file_utils.h"
+#include "search.h"
+
+
+#define WATCH_EVENTS    (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                         IN_MOVED_TO | IN_ONLYDIR)
+#define RESCAN_EVENTS   (IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO)
+#define QUIET_DELAY     50      // time without events before files are searched again (ms)
+#define MAX_DELAY       500     // time changes wait at most while events keep coming (ms)
+#define POLL_DELAY      100     // time between checks that the search was stopped (ms)
+#define MIN_SLOTS       1024
+
+
+/**
+ * File entry of the store for a path, NO_FILE once its entries were removed.
+ * Paths are the data of the first file entries found for them, which are
+ * never freed.
+ */
+struct file_slot {
+    const char *path;
+    uint32_t index;
+};
+
+/**
+ * Change of a path reported by inotify, applied once events stop coming.
+ */
+struct change {
+    char *path;
+    uint32_t mask;
+};
+
+/**
+ * Files of a search kept up to date after it's done: the directories it went
+ * through are watched, and the files changed in them are searched again. The
+ * entries of their previous versions are removed from the results and from
+ * the subsearches, the new ones are added at the end.
+ */
+struct watch {
+    struct search *search;
+    int inotify;
+    uint32_t nb_watched;        // directories of the search watched so far
+
+    char **directories;         // watched directories by watch descriptor
+    uint32_t max_directories;
+
+    struct file_slot *slots;    // files of the store by path
+    uint32_t slot_mask;
+    uint32_t nb_slots_used;
+    uint32_t nb_indexed;        // entries of the store looked at for files
+
+    struct change *changes;
+    uint32_t nb_changes;
+    uint32_t max_changes;
+    uint64_t first_change;      // time the oldest pending change was seen (ms)
+};
+
+
+/* UTILS **********************************************************************/
+static uint64_t now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint32_t hash_path(const char *path)
+{
+    return file_utils_hash(FILE_UTILS_HASH_SEED, path, strlen(path));
+}
+
+
+/* FILES **********************************************************************/
+static struct file_slot * find_slot(const struct watch *this, const char *path)
+{
+    uint32_t i = hash_path(path) & this->slot_mask;
+
+    while (this->slots[i].path && strcmp(this->slots[i].path, path) != 0) {
+        i = (i + 1) & this->slot_mask;
+    }
+
+    return &this->slots[i];
+}
+
+static void slots_grow(struct watch *this)
+{
+    struct file_slot *slots = this->slots;
+    uint32_t nb_slots = this->slots ? this->slot_mask + 1 : 0;
+    uint32_t i = 0;
+
+    this->slot_mask = nb_slots ? 2 * nb_slots - 1 : MIN_SLOTS - 1;
+    this->slots = calloc(this->slot_mask + 1, sizeof(struct file_slot));
+
+    for (i = 0; i < nb_slots; i++) {
+        if (slots[i].path) {
+            *find_slot(this, slots[i].path) = slots[i];
+        }
+    }
+    free(slots);
+}
+
+static void set_file(struct watch *this, const char *path, const uint32_t index)
+{
+    if (2 * (this->nb_slots_used + 1) > this->slot_mask + 1) {
+        slots_grow(this);
+    }
+
+    struct file_slot *slot = find_slot(this, path);
+    if (slot->path == NULL) {
+        slot->path = path;
+        this->nb_slots_used++;
+    }
+    slot->index = index;
+}
+
+/**
+ * Record the files added to the store since the last call. This thread is
+ * the only one adding entries, each file is followed by its lines.
+ */
+static void index_files(struct watch *this)
+{
+    struct entries *store = this->search->entries;
+    uint32_t nb_entries = entries_get_nb_entries(store);
+
+    while (this->nb_indexed < nb_entries) {
+        const struct entry *file = entries_get_entry(store, this->nb_indexed);
+
+        set_file(this, file->data, this->nb_indexed);
+        this->nb_indexed += 1 + file->length;
+    }
+}
+
+/**
+ * Remove the root entries in [start, stop) from the results shown and from
+ * every level of the subsearch chain, which can't be filtering meanwhile.
+ */
+static void remove_entries(struct watch *this, const uint32_t start, const uint32_t stop)
+{
+    struct search *search = this->search;
+    struct search *level = NULL;
+
+    pthread_mutex_lock(&search->chain_mutex);
+    entries_unselect(search->watched, start, stop, 0);
+    entries_notify(search->watched);
+
+    for (level = search->subsearch; level; level = level->subsearch) {
+        entries_unselect(level->entries, start, stop, level->match_context);
+        if (level->refined) {
+            entries_unselect(level->refined, start, stop, level->match_context);
+        }
+        entries_notify(level->entries);
+    }
+    pthread_mutex_unlock(&search->chain_mutex);
+}
+
+static void remove_file(struct watch *this, struct file_slot *slot)
+{
+    if (slot->path == NULL || slot->index == NO_FILE) {
+        return;
+    }
+
+    const struct entry *file = entries_get_entry(this->search->entries, slot->index);
+    remove_entries(this, slot->index, slot->index + 1 + file->length);
+    slot->index = NO_FILE;
+}
+
+/**
+ * Remove the files under a directory moved away, and stop watching it.
+ */
+static void remove_tree(struct watch *this, const char *directory)
+{
+    size_t length = strlen(directory);
+    uint32_t i = 0;
+
+    for (i = 0; i <= this->slot_mask; i++) {
+        const char *path = this->slots[i].path;
+        if (path && strncmp(path, directory, length) == 0 && path[length] == '/') {
+            remove_file(this, &this->slots[i]);
+        }
+    }
+
+    for (i = 0; i < this->max_directories; i++) {
+        const char *path = this->directories[i];
+        if (path && strncmp(path, directory, length) == 0 &&
+            (path[length] == '/' || path[length] == 0)) {
+            inotify_rm_watch(this->inotify, i);
+        }
+    }
+}
+
+
+/* WATCHES ********************************************************************/
+/**
+ * Watch the directories the search went through since the last call. Past
+ * the limit of watches of the user, the remaining ones are left unwatched.
+ */
+static void watch_directories(struct watch *this)
+{
+    const struct file_list *directories = this->search->directories;
+    uint32_t nb_directories = file_list_get_nb_files(directories);
+
+    for (; this->nb_watched < nb_directories; this->nb_watched++) {
+        const char *path = file_list_get_path(directories, this->nb_watched);
+
+        int wd = inotify_add_watch(this->inotify, path, WATCH_EVENTS);
+        if (wd < 0) {
+            if (errno == ENOSPC) {
+                this->nb_watched = nb_directories;
+                break;
+            }
+            continue;
+        }
+
+        if ((uint32_t) wd >= this->max_directories) {
+            uint32_t max_directories = 2 * wd + 1;
+            this->directories = realloc(this->directories, max_directories * sizeof(char *));
+            memset(this->directories + this->max_directories, 0,
+                   (max_directories - this->max_directories) * sizeof(char *));
+            this->max_directories = max_directories;
+        }
+
+        /* a directory watched again keeps its descriptor */
+        free(this->directories[wd]);
+        this->directories[wd] = strdup(path);
+    }
+}
+
+/**
+ * Queue the change of a file of a watched directory, merged with the previous
+ * one if it's the same file.
+ */
+static void add_change(struct watch *this, const char *directory,
+                       const char *name, const uint32_t mask)
+{
+    size_t directory_length = strlen(directory);
+    size_t name_length = strlen(name);
+    uint8_t separator = directory[directory_length - 1] != '/';
+
+    /* paths are built the way the search builds them */
+    char *path = malloc(directory_length + separator + name_length + 1);
+    memcpy(path, directory, directory_length);
+    path[directory_length] = '/';
+    memcpy(path + directory_length + separator, name, name_length + 1);
+
+    if (this->nb_changes && strcmp(this->changes[this->nb_changes - 1].path, path) == 0) {
+        this->changes[this->nb_changes - 1].mask |= mask;
+        free(path);
+        return;
+    }
+
+    if (this->nb_changes == this->max_changes) {
+        this->max_changes = this->max_changes ? 2 * this->max_changes : 64;
+        this->changes = realloc(this->changes, this->max_changes * sizeof(struct change));
+    }
+    if (this->nb_changes == 0) {
+        this->first_change = now_ms();
+    }
+    this->changes[this->nb_changes++] = (struct change) {path, mask};
+}
+
+static void read_events(struct watch *this)
+{
+    char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t size = 0;
+
+    while ((size = read(this->inotify, events, sizeof(events))) > 0) {
+        char *position = events;
+
+        while (position < events + size) {
+            const struct inotify_event *event = (const struct inotify_event *) position;
+            position += sizeof(struct inotify_event) + event->len;
+
+            if (event->wd < 0 || (uint32_t) event->wd >= this->max_directories ||
+                this->directories[event->wd] == NULL) {
+                continue;
+            }
+
+            /* the directory was removed, or isn't watched anymore */
+            if (event->mask & IN_IGNORED) {
+                free(this->directories[event->wd]);
+                this->directories[event->wd] = NULL;
+                continue;
+            }
+
+            if (event->len) {
+                add_change(this, this->directories[event->wd], event->name, event->mask);
+            }
+        }
+    }
+}
+
+/**
+ * Replace the entries of the files changed: the old ones are removed, then
+ * the files are searched again. Directories created or moved in are searched
+ * and watched as well.
+ */
+static void apply_changes(struct watch *this)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < this->nb_changes && !this->search->stop; i++) {
+        const struct change *change = &this->changes[i];
+
+        remove_file(this, find_slot(this, change->path));
+        if ((change->mask & IN_ISDIR) && (change->mask & IN_MOVED_FROM)) {
+            remove_tree(this, change->path);
+        }
+
+        if (change->mask & RESCAN_EVENTS) {
+            search_rescan(this->search, change->path);
+            index_files(this);
+        }
+    }
+
+    for (i = 0; i < this->nb_changes; i++) {
+        free(this->changes[i].path);
+    }
+    this->nb_changes = 0;
+
+    watch_directories(this);
+}
+
+
+/* API ************************************************************************/
+/**
+ * Keep the results of a search done up to date with the changes of its files,
+ * until it's stopped.
+ */
+void watch_run(struct search *search)
+{
+    struct watch this;
+    uint32_t i = 0;
+
+    memset(&this, 0, sizeof(struct watch));
+    this.search = search;
+    this.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this.inotify < 0) {
+        return;
+    }
+
+    slots_grow(&this);
+    index_files(&this);
+    watch_directories(&this);
+
+    while (!search->stop) {
+        struct pollfd fd = {this.inotify, POLLIN, 0};
+        int timeout = this.nb_changes ? QUIET_DELAY : POLL_DELAY;
+
+        if (poll(&fd, 1, timeout) > 0) {
+            read_events(&this);
+        }
+
+        /* wait for a burst of changes to end, editors write files in steps */
+        if (this.nb_changes && (fd.revents == 0 ||
+                                now_ms() - this.first_change >= MAX_DELAY)) {
+            apply_changes(&this);
+        }
+    }
+
+    for (i = 0; i < this.nb_changes; i++) {
+        free(this.changes[i].path);
+    }
+    for (i = 0; i < this.max_directories; i++) {
+        free(this.directories[i]);
+    }
+    free(this.changes);
+    free(this.directories);
+    free(this.slots);
+    close(this.inotify);
+}
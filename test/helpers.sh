@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# Sourced by the tests, from the test directory
+
+NGP=$(realpath ../ngp_perf)
+
+# temporary directories of the test, removed when it exits
+TEMPORARY=()
+trap 'rm -rf "${TEMPORARY[@]}"' EXIT
+
+# fail the test if the result isn't the one expected
+check()
+{
+    if [ "$result" != "$EXPECT" ]
+    then
+        echo "$0 failed"
+        echo "Expected: '$EXPECT'"
+        echo "Got: '$result'"
+        exit -1
+    fi
+}
+
+# cache files written by the test go to a directory of its own
+use_temporary_cache()
+{
+    export XDG_CACHE_HOME=$(mktemp -d)
+    TEMPORARY+=("$XDG_CACHE_HOME")
+}
+
+# copy of the resources in RESOURCE, for the test to change
+copy_resources()
+{
+    RESOURCE=$(mktemp -d)
+    TEMPORARY+=("$RESOURCE")
+    cp -r ./resources/. $RESOURCE
+}
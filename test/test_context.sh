@@ -0,0 +1,29 @@
+#!/bin/bash
+
+. ./helpers.sh
+
+# context lines are not counted as matches
+EXPECT="Found 1 files, 2 lines"
+result=$($NGP -C 3 int ./resources/normal_file.c)
+check
+
+# context lines are the ones grep shows, groups separated the same way
+for file in ./resources/normal_file.c ./resources/file_with_no_ending_newline.c
+do
+    for args in "-A1 int" "-B1 int" "-C1 int" "-A1 mine" "-B2 keyword" "-C1 test" "-C3 newline"
+    do
+        EXPECT=$(grep -n -H $args $file)
+        result=$($NGP --stream $args $file | grep -v "^Found")
+        check
+    done
+done
+
+# counts of lines that can't be kept are rejected
+for count in -1 4294967295 100000000 1x
+do
+    EXPECT="Failed parsing arguments"
+    result=$($NGP -C $count int ./resources/normal_file.c | head -1)
+    check
+done
+
+echo "$0 OK"
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+. ./helpers.sh
+
+RESOURCE=./resources
+
+# listed files are searched like the ones a crawl finds, listed in the same order
+for args in "int" "-r int" "-f int" "-x extensions int"
+do
+    EXPECT=$($NGP --stream $args $RESOURCE)
+
+    result=$(find $RESOURCE | $NGP --stream --files-from - $args)
+    check
+    result=$(find $RESOURCE -print0 | $NGP --stream --files-from - $args)
+    check
+done
+
+# relative paths are of the directory, the last one may not end with a separator
+EXPECT=$($NGP --stream int $RESOURCE/normal_file.c)
+result=$(printf "normal_file.c" | $NGP --stream --files-from - int $RESOURCE)
+check
+
+echo "$0 OK"
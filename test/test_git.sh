@@ -0,0 +1,43 @@
+#!/bin/bash
+
+. ./helpers.sh
+
+# checkout of a copy of resources, with untracked files, indexed along with
+# them in the cache of the test only
+use_temporary_cache
+copy_resources
+cd $RESOURCE
+git init -q .
+git add -A .
+mkdir untracked_directory
+echo "int untracked" > untracked_directory/untracked.c
+echo "int untracked" > untracked.c
+$NGP --index . > /dev/null
+
+# tracked files are the ones a crawl finds but the untracked ones, in the
+# order of the index, summaries differ by the untracked files
+for version in 2 3 4
+do
+    git update-index --index-version $version
+
+    for args in "int" "-r int" "-f int" "-x extensions -r int"
+    do
+        EXPECT=$($NGP --stream $args . | grep -v "untracked\|^Found" | sort)
+        result=$($NGP --stream --git $args . | grep -v "^Found" | sort)
+        check
+    done
+
+    # paths of a subdirectory are relative to it
+    EXPECT=$($NGP --stream -r int extensions | sort)
+    result=$($NGP --stream --git -r int extensions | sort)
+    check
+
+    # files not checked out are skipped
+    git update-index --skip-worktree normal_file.c
+    EXPECT=$($NGP --stream int . | grep -v "untracked\|normal_file\|^Found" | sort)
+    result=$($NGP --stream --git int . | grep -v "^Found" | sort)
+    check
+    git update-index --no-skip-worktree normal_file.c
+done
+
+echo "$0 OK"
@@ -0,0 +1,55 @@
+#!/bin/bash
+
+. ./helpers.sh
+
+# copy of resources with ignore files, the files they ignore hold "int ignored"
+use_temporary_cache
+copy_resources
+cd $RESOURCE
+mkdir -p build sub/build sub/deep/er
+printf "build/\n/anchored.c\nsub/**/deep.c\n*.generated.c\n" > .gitignore
+printf "!kept.generated.c\n" > sub/.gitignore
+printf "local.c\n" > sub/.ignore
+echo "int ignored" > build/file.c
+echo "int ignored" > sub/build/file.c
+echo "int ignored" > anchored.c
+echo "int kept" > sub/anchored.c
+echo "int ignored" > sub/deep.c
+echo "int ignored" > sub/deep/er/deep.c
+echo "int ignored" > file.generated.c
+echo "int ignored" > sub/file.generated.c
+echo "int kept" > sub/kept.generated.c
+echo "int ignored" > sub/local.c
+echo "int kept" > local.c
+
+# directories changed in the last second are read again by snapshots
+sleep 1.1
+
+# the crawl finds what --no-ignore does but the ignored files, in the same
+# order, and the snapshot lists the same
+for args in "int" "-r int" "-f int"
+do
+    EXPECT=$($NGP --stream --no-ignore $args . | grep -v "int ignored\|^Found")
+    result=$($NGP --stream $args . | grep -v "^Found")
+    check
+
+    result=$($NGP --stream --snapshot $args . | grep -v "^Found")
+    check
+    result=$($NGP --stream --snapshot $args . | grep -v "^Found")
+    check
+done
+
+# ignore files above the directory searched are not read
+EXPECT=$($NGP --stream --no-ignore int sub | grep -v "local.c\|^Found")
+result=$($NGP --stream int sub | grep -v "^Found")
+check
+
+# ignore files changed are followed, even by a snapshot of unchanged directories
+printf "/anchored.c\n" > .gitignore
+EXPECT=$($NGP --stream --no-ignore int . | grep -v "anchored.c:1:int ignored\|sub/local.c\|^Found")
+result=$($NGP --stream int . | grep -v "^Found")
+check
+result=$($NGP --stream --snapshot int . | grep -v "^Found")
+check
+
+echo "$0 OK"
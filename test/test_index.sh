@@ -0,0 +1,33 @@
+#!/bin/bash
+
+. ./helpers.sh
+
+# indexes are written to the cache of the test only, of a copy of resources
+use_temporary_cache
+copy_resources
+
+# searches of an indexed directory find the same results as a full scan
+check_searches()
+{
+    for args in "int" "-i INT" "-e in[a-z]" "-e keyword\|test" "refreshed" \
+                "-w file" "-w -i FILE" "-w refreshed" "-r test" "-o txt test"
+    do
+        EXPECT=$($NGP --no-index $args $RESOURCE)
+        result=$($NGP $args $RESOURCE)
+        check
+    done
+}
+
+$NGP --index $RESOURCE > /dev/null
+check_searches
+
+# searches find the files new, changed and removed since the directory was
+# indexed, and refreshes pick them up
+echo "refreshed int" > $RESOURCE/new_file.c
+echo "refreshed" >> $RESOURCE/normal_file.c
+rm $RESOURCE/unicode.c
+check_searches
+$NGP --index $RESOURCE > /dev/null
+check_searches
+
+echo "$0 OK"
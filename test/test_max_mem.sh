@@ -0,0 +1,36 @@
+#!/bin/bash
+
+NGP=../ngp_perf
+PATTERN="int"
+RESOURCE=$(mktemp -d)
+EXPECT="Found 1 files, 200000 lines"
+
+# enough lines to fill several segments of entries
+for i in $(seq 1 200000); do echo "int i = $i;"; done > $RESOURCE/big_file.c
+
+result=$($NGP --max-mem 1M $PATTERN $RESOURCE)
+rm -rf $RESOURCE
+
+if [ "$result" != "$EXPECT" ]
+then
+    echo "$0 failed"
+    echo "Expected: '$EXPECT'"
+    echo "Got: '$result'"
+    exit -1
+fi
+
+# sizes that aren't counts of bytes, or don't fit, are rejected
+EXPECT="Failed parsing arguments"
+for size in -1M 1x K 17179869184G 99999999999999999999
+do
+    result=$($NGP --max-mem $size $PATTERN ./resources/normal_file.c | head -1)
+    if [ "$result" != "$EXPECT" ]
+    then
+        echo "$0 failed"
+        echo "Expected: '$EXPECT'"
+        echo "Got: '$result'"
+        exit -1
+    fi
+done
+
+echo "$0 OK"
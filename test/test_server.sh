@@ -0,0 +1,37 @@
+#!/bin/bash
+
+. ./helpers.sh
+
+# the server socket lives in the cache of the test only, along with an index
+# of a copy of resources changed since
+use_temporary_cache
+copy_resources
+$NGP --index $RESOURCE > /dev/null
+echo "int test" > $RESOURCE/new_file.c
+touch $RESOURCE/.gitignore
+# directories excluded by the server itself stay visible to its clients
+$NGP --serve -x extensions $RESOURCE > /dev/null &
+SERVER=$!
+trap 'kill $SERVER; wait $SERVER; rm -rf "${TEMPORARY[@]}"' EXIT
+
+for i in $(seq 50)
+do
+    [ -S $XDG_CACHE_HOME/ngp/*.sock ] && break
+    sleep 0.1
+done
+
+# searches answered by the server find the same results as local ones
+for args in "int" "-i INT" "-w file" "-C1 test" "-r test" "-f int" "-x extensions test"
+do
+    EXPECT=$($NGP --no-server --no-index --stream $args $RESOURCE)
+    result=$($NGP --stream $args $RESOURCE)
+    check
+done
+
+# ignore files edited in place are followed at once
+echo "new_file.c" >> $RESOURCE/.gitignore
+EXPECT=$($NGP --no-server --no-index --stream int $RESOURCE)
+result=$($NGP --stream int $RESOURCE)
+check
+
+echo "$0 OK"
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+. ./helpers.sh
+
+# snapshots are written to the cache of the test only, of a copy of resources
+use_temporary_cache
+copy_resources
+
+# directories changed in the last second are read again, let them settle so
+# that the snapshot is reused
+sleep 1.1
+
+# files listed from the snapshot are the ones a crawl finds, in the same order
+check_searches()
+{
+    for args in "int" "-r int" "-f int" "-x extensions int" "-o c int" "snapshot"
+    do
+        EXPECT=$($NGP --stream $args $RESOURCE)
+        result=$($NGP --stream --snapshot $args $RESOURCE)
+        check
+    done
+}
+
+check_searches
+check_searches
+
+# changed directories are read again
+mkdir $RESOURCE/new_directory
+echo "snapshot int" > $RESOURCE/new_directory/new_file.c
+echo "snapshot int" > $RESOURCE/extensions/new_file.c
+rm $RESOURCE/unicode.c
+check_searches
+
+echo "$0 OK"
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+. ./helpers.sh
+
+PATTERN="int"
+RESOURCE=./resources/normal_file.c
+
+# results are written like grep -n does
+EXPECT="./resources/normal_file.c:1:This is a test file int
+./resources/normal_file.c:4:The keyword is int
+Found 1 files, 2 lines"
+result=$($NGP --stream $PATTERN $RESOURCE)
+check
+
+# or as JSON Lines, with the position of the matches
+EXPECT='{"type":"match","file":"./resources/normal_file.c","line":1,"column":21,"spans":[[20,3]],"text":"This is a test file int"}
+{"type":"match","file":"./resources/normal_file.c","line":4,"column":16,"spans":[[15,3]],"text":"The keyword is int"}
+Found 1 files, 2 lines'
+result=$($NGP --stream=json $PATTERN $RESOURCE)
+check
+
+# lines that aren't valid UTF-8 are given as their bytes in base64
+LATIN1=$(mktemp -d)
+TEMPORARY+=("$LATIN1")
+printf 'caf\xe9 int\n\xff int\n"\t\\ int\n' > $LATIN1/latin1.c
+EXPECT='{"type":"match","file":"'$LATIN1'/latin1.c","line":1,"column":6,"spans":[[5,3]],"text":{"bytes":"Y2Fm6SBpbnQ="}}
+{"type":"match","file":"'$LATIN1'/latin1.c","line":2,"column":3,"spans":[[2,3]],"text":{"bytes":"/yBpbnQ="}}
+{"type":"match","file":"'$LATIN1'/latin1.c","line":3,"column":5,"spans":[[4,3]],"text":"\"\t\\ int"}
+Found 1 files, 3 lines'
+result=$($NGP --stream=json $PATTERN $LATIN1/latin1.c)
+check
+
+echo "$0 OK"
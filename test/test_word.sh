@@ -0,0 +1,19 @@
+#!/bin/bash
+
+NGP=../ngp_perf
+PATTERN="file"
+RESOURCE=./resources/
+EXPECT="Found 2 files, 2 lines"
+
+# "files" is not a match
+result=$($NGP -w $PATTERN $RESOURCE)
+
+if [ "$result" != "$EXPECT" ]
+then
+    echo "$0 failed"
+    echo "Expected: '$EXPECT'"
+    echo "Got: '$result'"
+    exit -1
+fi
+
+echo "$0 OK"